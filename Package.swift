@@ -29,6 +29,7 @@ let package = Package(
         .testTarget(
             name: "RsPackTests",         
             dependencies: [
+                "CMBL",
                 "MBL",
             	"POLE",
                 "Zlib",
@@ -4,7 +4,42 @@
 extern "C" {
 #endif
 
+typedef enum {
+    SCALE_IMAGE_FILTER_BILINEAR = 0,
+    SCALE_IMAGE_FILTER_AREA = 1
+} ScaleImageFilter;
+
 void ScaleImage(const unsigned char *srcRGB, int srcWidth, int srcHeight, unsigned char *destRGB, int destWidth, int destHeight);
+void ScaleImageWithFilter(const unsigned char *srcRGB, int srcWidth, int srcHeight, unsigned char *destRGB, int destWidth, int destHeight,
+                          ScaleImageFilter filter);
+int ScaleImageStrided(const unsigned char *srcRGB, int srcWidth, int srcHeight, int srcRowBytes,
+                      unsigned char *destRGB, int destWidth, int destHeight, int destRowBytes, ScaleImageFilter filter);
+
+typedef struct ImagePyramidHandle ImagePyramidHandle;
+typedef void (*ImagePyramidTileCallback)(void *context, int level, int column, int row, const unsigned char *rgb, int width, int height,
+                                         int rowBytes);
+
+ImagePyramidHandle *CreateImagePyramid(int width, int height, int tileWidth, int tileHeight, int levels,
+                                       ImagePyramidTileCallback callback, void *context);
+int GetImagePyramidLevelCount(const ImagePyramidHandle *pyramid);
+int PushImagePyramidTile(ImagePyramidHandle *pyramid, int column, int row, const unsigned char *rgb, int width, int height, int rowBytes);
+int FinishImagePyramid(ImagePyramidHandle *pyramid);
+void DestroyImagePyramid(ImagePyramidHandle *pyramid);
+
+typedef enum {
+    FOCUS_MERGE_MAX = 0,
+    FOCUS_MERGE_CONTRAST = 1,
+    FOCUS_MERGE_TENENGRAD = 2
+} FocusStackMergeMethod;
+
+typedef struct FocusMergerHandle FocusMergerHandle;
+
+FocusMergerHandle *CreateFocusMerger(int width, int height, FocusStackMergeMethod method, int windowSize, int threshold);
+int PushFocusMergerFrame(FocusMergerHandle *merger, const unsigned char *rgb, int rowBytes);
+int FinishFocusMerger(FocusMergerHandle *merger, unsigned char *dem, unsigned char *montageRGB);
+void DestroyFocusMerger(FocusMergerHandle *merger);
+int MergeFocusStack(const unsigned char *const *framesRGB, int count, int width, int height, FocusStackMergeMethod method, int windowSize,
+                    unsigned char *dem, unsigned char *montageRGB);
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,10 @@
 #ifndef __AUTOFOCUSOPERATOR_H__
 #define __AUTOFOCUSOPERATOR_H__
 
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
 /**
  * @file
  *
@@ -44,7 +48,7 @@ namespace MBL
       long int lap_sum;
       T r, g, b, cendata = 0, leftdata = 0, rightdata = 0, updata = 0, downdata = 0, *pdata = 0;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
 
       if (image->Pixels == 0 ) throw NullPointerException();
       switch (image->Format)
@@ -140,7 +144,7 @@ namespace MBL
       T r, g, b, leftupdata = 0, leftcendata = 0, leftdowndata = 0, *pdata;
       T rightupdata = 0, rightcendata = 0, rightdowndata = 0, cenupdata = 0, cendowndata = 0;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
 
       if (image->Pixels == 0 ) throw NullPointerException();
       switch (image->Format)
@@ -255,7 +259,7 @@ namespace MBL
      long int smd_sum;
      T r, g, b, *pdata, cendata = 0, rightcendata = 0, cenupdata = 0;
      int nr = image->Height;
-     int nc = image->Width;
+     ptrdiff_t nc = image->Width;
 
      if (image->Pixels == 0 ) throw NullPointerException();
      switch (image->Format)
@@ -338,7 +342,7 @@ namespace MBL
      long int var_sum;
      T r, g, b, *pdata, cendata = 0;
      int nr = image->Height;
-     int nc = image->Width;
+     ptrdiff_t nc = image->Width;
 
      if (image->Pixels == 0 ) throw NullPointerException();
      switch (image->Format)
@@ -431,7 +435,7 @@ namespace MBL
       long int robert_sum;
       T r, g, b, *pdata, cendata = 0, rightcendata = 0, cendowndata = 0, rightdowndata = 0;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
 
       if (image->Pixels == 0 ) throw NullPointerException();
       switch (image->Format)
@@ -526,7 +530,7 @@ namespace MBL
       int avgGray = 0;//灰度
 
       int hb = GetUnitsPerPixel(image);
-      int vb = GetUnitsPerRow(image);
+      size_t vb = GetUnitsPerRow(image);
       int row = image->Width - hb;
 
       T *p = image->Pixels, *p_end = image->Pixels + GetUnitsOfPixelData(image) - vb - hb;
@@ -597,6 +601,420 @@ namespace MBL
       }
       return res;
     }
+
+    /// 聚焦评价值的种类。
+    enum FocusMetric
+    {
+      /// 改进拉普拉斯算子，见LaplacianAutoFocusOperator。
+      FOCUS_METRIC_LAPLACIAN,
+      /// Tenengrad函数，见TenengradAutoFocusOperator。
+      FOCUS_METRIC_TENENGRAD,
+      /// 灰度差分绝对值之和，见SMDAutoFocusOperator。
+      FOCUS_METRIC_SMD,
+      /// 灰度方差，见VarianceAutoFocusOperator。
+      FOCUS_METRIC_VARIANCE,
+      /// Robert算子，见RobertAutoFocusOperator。
+      FOCUS_METRIC_ROBERT,
+      /// 另一种Robert算子，见Robert2AutoFocusOperator。
+      FOCUS_METRIC_ROBERT2
+    };
+
+    /// 一幅图像的各种聚焦评价值。
+    /**
+     * 由GetImageFocusMeasurement遍历一次图像同时求出。前五种评价值与对应的算子函数结果相同，只是改用long long累加，大图像
+     * 不会溢出。
+     */
+    class FocusMeasurement
+    {
+      public:
+        /// 改进拉普拉斯算子值。
+        long long Laplacian;
+        /// Tenengrad函数值。
+        long long Tenengrad;
+        /// 灰度差分绝对值之和。
+        long long SMD;
+        /// 灰度方差。
+        long long Variance;
+        /// Robert算子值。
+        long long Robert;
+        /// 另一种Robert算子值，已按平均灰度归一化。
+        double Robert2;
+
+        /**
+         * @brief 取得某一种聚焦评价值。
+         *
+         * @param metric 评价值的种类。
+         * @return 评价值，越大表示聚焦越好。
+         */
+        double GetValue(FocusMetric metric) const
+        {
+          switch (metric)
+          {
+            case FOCUS_METRIC_LAPLACIAN:
+              return static_cast<double>(Laplacian);
+            case FOCUS_METRIC_TENENGRAD:
+              return static_cast<double>(Tenengrad);
+            case FOCUS_METRIC_SMD:
+              return static_cast<double>(SMD);
+            case FOCUS_METRIC_VARIANCE:
+              return static_cast<double>(Variance);
+            case FOCUS_METRIC_ROBERT:
+              return static_cast<double>(Robert);
+            case FOCUS_METRIC_ROBERT2:
+              return Robert2;
+            default:
+              throw IllegalArgumentException();
+          }
+        }
+    };
+
+    // 聚焦评价值的部分和，各个条带分别累加后再合并。
+    struct _FocusSums
+    {
+      long long Laplacian;
+      long long Tenengrad;
+      long long SMD;
+      long long Robert;
+      long long Gray;         // 灰度之和，用于求方差。
+      long long GraySquare;   // 灰度平方和。
+      long long Robert2;      // Robert2算子中差分之和的平方和，还没有除以36。
+      long long Robert2Gray;  // Robert2算子所用各分量之和的累计。
+    };
+
+    // 把一行象素转换为各聚焦算子所用的灰度，公式与算子函数相同；sums返回各分量之和，供Robert2算子使用。
+    template <int UNITS, class T>
+    void _GetFocusRow(const T *p, int width, T *gray, int *sums)
+    {
+      if (UNITS == 1)
+      {
+        for (int x = 0; x < width; x++)
+        {
+          gray[x] = p[x];
+          sums[x] = p[x];
+        }
+        return;
+      }
+
+      // 分块解交错，使转换循环可以向量化。
+      const int BLOCK = 64;
+      int r[BLOCK], g[BLOCK], b[BLOCK];
+      for (int x0 = 0; x0 < width; x0 += BLOCK)
+      {
+        const int n = MBL::Utility::GetMin(BLOCK, width - x0);
+        const T *q = p + static_cast<size_t>(x0) * 3;
+        for (int x = 0; x < n; x++)
+        {
+          r[x] = q[3 * x];
+          g[x] = q[3 * x + 1];
+          b[x] = q[3 * x + 2];
+        }
+        for (int x = 0; x < n; x++)
+        {
+          gray[x0 + x] = (T)(r[x] * 0.3 + g[x] * 0.59 + b[x] * 0.11);
+          sums[x0 + x] = r[x] + g[x] + b[x];
+        }
+      }
+    }
+
+    // 累加第i行的各种聚焦评价值。rows和sums按行号取得灰度行和分量和行，只会用到i - h到i + h之间的行。
+    template <class T, class Rows, class Sums>
+    void _AddFocusRow(int i, int width, int height, int step, int laplacian_threshold, int tenengrad_threshold,
+                      Rows rows, Sums sums, _FocusSums *s)
+    {
+      // 8位图像的梯度平方和放得进int，可以更好地向量化。
+      typedef typename std::conditional<sizeof(T) == 1, int, long long>::type G;
+
+      const T *c = rows(i);
+      long long gray = 0, square = 0;
+      for (int j = 0; j < width; j++)
+      {
+        gray += c[j];
+        square += static_cast<G>(c[j]) * c[j];
+      }
+      s->Gray += gray;
+      s->GraySquare += square;
+
+      if (i >= step && i < height - step)
+      {
+        const T *u = rows(i - step), *d = rows(i + step);
+        long long lap = 0;
+        for (int j = step; j < width - step; j++)
+        {
+          const int v = abs(2 * c[j] - c[j - step] - c[j + step]) + abs(2 * c[j] - u[j] - d[j]);
+          lap += v > laplacian_threshold ? v : 0;
+        }
+        s->Laplacian += lap;
+      }
+
+      if (i + 1 < height)
+      {
+        const int *a = sums(i), *e = sums(i + 1);
+        long long robert = 0, gray_sum = 0;
+        for (int j = 0; j < width - 1; j++)
+        {
+          const G v = abs(a[j] - e[j + 1]) + abs(e[j] - a[j + 1]);
+          robert += v * v;
+          gray_sum += a[j];
+        }
+        s->Robert2 += robert;
+        s->Robert2Gray += gray_sum;
+      }
+
+      if (i < 1 || i >= height - 1) return;
+
+      const T *u = rows(i - 1), *d = rows(i + 1);
+      long long tenengrad = 0, smd = 0, robert = 0;
+      for (int j = 1; j < width - 1; j++)
+      {
+        const G gx = (d[j - 1] + 2 * d[j] + d[j + 1]) - (u[j - 1] + 2 * u[j] + u[j + 1]);
+        const G gy = (u[j - 1] + 2 * c[j - 1] + d[j - 1]) - (u[j + 1] + 2 * c[j + 1] + d[j + 1]);
+        const G v = gx * gx + gy * gy;
+        tenengrad += v > tenengrad_threshold ? v : 0;
+      }
+      for (int j = 1; j < width - 1; j++)
+      {
+        smd += abs(c[j] - c[j - 1]) + abs(c[j] - d[j]);
+      }
+      for (int j = 1; j < width - 1; j++)
+      {
+        robert += abs(c[j] - d[j + 1]) + abs(d[j] - c[j + 1]);
+      }
+      s->Tenengrad += tenengrad;
+      s->SMD += smd;
+      s->Robert += robert;
+    }
+
+    // 计算[top, bottom)各行的聚焦评价值，灰度行只转换一次，放在2h + 1行的环形缓冲区中。
+    template <int UNITS, class T>
+    void _GetFocusSums(const ImageDef<T> *image, int top, int bottom, int step, int laplacian_threshold,
+                       int tenengrad_threshold, _FocusSums *s)
+    {
+      const int width = image->Width, height = image->Height;
+      const int h = MBL::Utility::GetMax(step, 1);
+      const int ring = 2 * h + 1;
+      std::vector<T> gray(static_cast<size_t>(ring) * width);
+      std::vector<int> sums(static_cast<size_t>(ring) * width);
+      auto rows = [&](int y) { return &gray[static_cast<size_t>(y % ring) * width]; };
+      auto row_sums = [&](int y) { return &sums[static_cast<size_t>(y % ring) * width]; };
+
+      int next = MBL::Utility::GetMax(top - h, 0);
+      for (int i = top; i < bottom; i++)
+      {
+        for (; next <= MBL::Utility::GetMin(i + h, height - 1); next++)
+        {
+          _GetFocusRow<UNITS>(GetRowPointer(image, next), width, rows(next), row_sums(next));
+        }
+        _AddFocusRow<T>(i, width, height, step, laplacian_threshold, tenengrad_threshold, rows, row_sums, s);
+      }
+    }
+
+    /**
+     * @brief 遍历一次图像，同时计算各种聚焦评价值。
+     *
+     * 每行象素只转换一次灰度，所有算子共用同一组灰度行，图像格式在编译期确定，内层循环没有分支，可以被编译器向量化。
+     * 图像按行分成条带，在多个线程上并行计算。结果与分别调用各算子函数相同，但Robert2对RGB图像按正确的行对齐计算，
+     * 与Robert2AutoFocusOperator略有不同。例如：
+     * @code
+     * FocusMeasurement m = GetImageFocusMeasurement(image);
+     * if (m.Tenengrad > best) ...
+     * @endcode
+     *
+     * @param image 单幅图像结构指针，必须是索引、RGB或BGR图像。
+     * @param step 拉普拉斯算子的步长，见LaplacianAutoFocusOperator。
+     * @param laplacian_threshold 拉普拉斯算子的阈值。
+     * @param tenengrad_threshold Tenengrad函数的阈值。
+     * @return 各种聚焦评价值。
+     */
+    template <class T>
+    FocusMeasurement GetImageFocusMeasurement(const ImageDef<T> *image, int step = 5, int laplacian_threshold = 0,
+                                              int tenengrad_threshold = 0)
+    {
+      if (image == 0 || image->Pixels == 0) throw NullPointerException();
+      if (step < 0) throw IllegalArgumentException();
+      switch (image->Format)
+      {
+        case IMAGE_FORMAT_INDEX:
+        case IMAGE_FORMAT_RGB:
+        case IMAGE_FORMAT_BGR:
+          break;
+        default:
+          throw UnsupportedFormatException();
+      }
+
+      const int BAND = 64;
+      const int bands = (image->Height + BAND - 1) / BAND;
+      const bool indexed = image->Format == IMAGE_FORMAT_INDEX;
+      _FocusSums total = {};
+      std::mutex lock;
+
+      MBL::Utility::ParallelFor(0, bands, [&](int k)
+      {
+        _FocusSums s = {};
+        const int top = k * BAND, bottom = MBL::Utility::GetMin(top + BAND, image->Height);
+        if (indexed)
+          _GetFocusSums<1>(image, top, bottom, step, laplacian_threshold, tenengrad_threshold, &s);
+        else
+          _GetFocusSums<3>(image, top, bottom, step, laplacian_threshold, tenengrad_threshold, &s);
+
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          total.Laplacian += s.Laplacian;
+          total.Tenengrad += s.Tenengrad;
+          total.SMD += s.SMD;
+          total.Robert += s.Robert;
+          total.Gray += s.Gray;
+          total.GraySquare += s.GraySquare;
+          total.Robert2 += s.Robert2;
+          total.Robert2Gray += s.Robert2Gray;
+        }
+      });
+
+      FocusMeasurement m;
+      m.Laplacian = total.Laplacian;
+      m.Tenengrad = total.Tenengrad;
+      m.SMD = total.SMD;
+      m.Robert = total.Robert;
+
+      // 方差沿用VarianceAutoFocusOperator的整数均值：Σ(c - mean)² = Σc² - 2·mean·Σc + n·mean²。
+      const long long n = static_cast<long long>(image->Width) * image->Height;
+      const long long mean = n > 0 ? total.Gray / n : 0;
+      m.Variance = n > 0 ? (total.GraySquare - 2 * mean * total.Gray + n * mean * mean) / n : 0;
+
+      const long long count = static_cast<long long>(image->Width - 1) * (image->Height - 1);
+      m.Robert2 = 0;
+      if (count > 0 && total.Robert2Gray > 0)
+      {
+        const double avg_gray = total.Robert2Gray / (indexed ? 1.0 : 3.0) / count;
+        m.Robert2 = total.Robert2 / 36.0 / count * (ImageDefTraits<T>::MidValueRoundUp / avg_gray);
+      }
+      return m;
+    }
+
+    /// 聚焦评价的探测点。
+    class FocusPoint
+    {
+      public:
+        /// 探测区域中心的横坐标（象素）。
+        int X;
+        /// 探测区域中心的纵坐标（象素）。
+        int Y;
+    };
+
+    // 计算图像中一个矩形区域的聚焦评价值，stride大于1时每隔stride行、stride列取一个象素组成缩小的图像再计算。
+    template <class T>
+    FocusMeasurement _GetRegionFocusMeasurement(const ImageDef<T> *image, int left, int top, int width, int height, int stride,
+                                                int step, int laplacian_threshold, int tenengrad_threshold)
+    {
+      const int l = MBL::Utility::GetMax(left, 0), t = MBL::Utility::GetMax(top, 0);
+      const int w = MBL::Utility::GetMin(left + width, image->Width) - l;
+      const int h = MBL::Utility::GetMin(top + height, image->Height) - t;
+      if (w <= 0 || h <= 0)
+      {
+        FocusMeasurement m = {};
+        return m;
+      }
+
+      if (stride == 1)
+      {
+        ImageView<T> view(const_cast<ImageDef<T> *>(image), l, t, w, h);
+        return GetImageFocusMeasurement(&view, step, laplacian_threshold, tenengrad_threshold);
+      }
+
+      ImageDef<T> *part = ImageDef<T>::CreateInstance(image->Format, (w + stride - 1) / stride, (h + stride - 1) / stride);
+      const int units = GetUnitsPerPixel(image);
+      for (int y = 0; y < part->Height; y++)
+      {
+        const T *p = GetRowPointer(image, t + y * stride) + static_cast<size_t>(l) * units;
+        T *q = GetRowPointer(part, y);
+        for (int x = 0; x < part->Width; x++)
+        {
+          for (int c = 0; c < units; c++) q[x * units + c] = p[static_cast<size_t>(x) * stride * units + c];
+        }
+      }
+
+      FocusMeasurement m;
+      try
+      {
+        m = GetImageFocusMeasurement(part, step, laplacian_threshold, tenengrad_threshold);
+      }
+      catch (...)
+      {
+        delete part;
+        throw;
+      }
+      delete part;
+      return m;
+    }
+
+    /**
+     * @brief 计算处理子区中的各种聚焦评价值。
+     *
+     * 只处理子区的外接矩形，并且可以每隔stride行、stride列取一个象素，计算量与子区面积成正比、与stride的平方成反比，
+     * 适合在大幅面图像上只用组织所在的一小块区域快速判断聚焦。stride大于1时各算子的邻点间距也相应放大，评价值只能与
+     * 同样参数下的结果比较。
+     *
+     * @param image 单幅图像结构指针，必须是索引、RGB或BGR图像。
+     * @param sub_area 处理子区，为0表示全图。只使用其外接矩形，超出图像的部分被舍去。
+     * @param stride 抽样间隔（象素），1表示不抽样。
+     * @param step 拉普拉斯算子的步长，以抽样后的象素为单位。
+     * @param laplacian_threshold 拉普拉斯算子的阈值。
+     * @param tenengrad_threshold Tenengrad函数的阈值。
+     * @return 各种聚焦评价值，子区与图像不相交时全为0。
+     *
+     * @see GetImageFocusMeasurement
+     */
+    template <class T>
+    FocusMeasurement GetAreaFocusMeasurement(const ImageDef<T> *image, const ImageSubArea *sub_area, int stride = 1, int step = 5,
+                                             int laplacian_threshold = 0, int tenengrad_threshold = 0)
+    {
+      if (image == 0 || image->Pixels == 0) throw NullPointerException();
+      if (stride < 1) throw IllegalArgumentException();
+
+      if (sub_area == 0)
+        return _GetRegionFocusMeasurement(image, 0, 0, image->Width, image->Height, stride, step, laplacian_threshold,
+                                          tenengrad_threshold);
+      return _GetRegionFocusMeasurement(image, sub_area->Left, sub_area->Top, sub_area->Width, sub_area->Height, stride, step,
+                                        laplacian_threshold, tenengrad_threshold);
+    }
+
+    /**
+     * @brief 计算若干探测点周围的聚焦评价值。
+     *
+     * 每个探测点取以其为中心的patch_width×patch_height区域，按GetAreaFocusMeasurement的方法计算，各探测点在多个线程上
+     * 并行处理。计算量只与探测点数和区域大小有关，与图像尺寸无关，适合建立焦面图。例如在2000万象素的图像上取几块组织：
+     * @code
+     * std::vector<FocusMeasurement> scores;
+     * GetPointFocusMeasurements(image, points, 256, 256, 2, &scores);
+     * @endcode
+     *
+     * @param image 单幅图像结构指针，必须是索引、RGB或BGR图像。
+     * @param points 探测点。
+     * @param patch_width 探测区域宽度（象素）。
+     * @param patch_height 探测区域高度（象素）。
+     * @param stride 抽样间隔（象素），1表示不抽样。
+     * @param results 返回各探测点的聚焦评价值，与points一一对应。区域超出图像的部分被舍去，完全在图像外时全为0。
+     * @param step 拉普拉斯算子的步长，以抽样后的象素为单位。
+     * @param laplacian_threshold 拉普拉斯算子的阈值。
+     * @param tenengrad_threshold Tenengrad函数的阈值。
+     */
+    template <class T>
+    void GetPointFocusMeasurements(const ImageDef<T> *image, const std::vector<FocusPoint> &points, int patch_width,
+                                   int patch_height, int stride, std::vector<FocusMeasurement> *results, int step = 5,
+                                   int laplacian_threshold = 0, int tenengrad_threshold = 0)
+    {
+      if (image == 0 || image->Pixels == 0 || results == 0) throw NullPointerException();
+      if (patch_width <= 0 || patch_height <= 0 || stride < 1) throw IllegalArgumentException();
+
+      const int n = static_cast<int>(points.size());
+      results->resize(n);
+
+      MBL::Utility::ParallelFor(0, n, [&](int k)
+      {
+        (*results)[k] = _GetRegionFocusMeasurement(image, points[k].X - patch_width / 2, points[k].Y - patch_height / 2,
+                                                   patch_width, patch_height, stride, step, laplacian_threshold,
+                                                   tenengrad_threshold);
+      });
+    }
   }// Image2D namespace
 }// MBL namespace
 
@@ -1,6 +1,9 @@
 #ifndef __BAYER_H__
 #define __BAYER_H__
 
+#include <algorithm>
+#include <vector>
+
 /**
  * @file
  *
@@ -164,7 +167,7 @@ namespace MBL
     void ConvertBayer2Color(ImageDef<T> *bayer, ImageDef<T> *rgb, BayerConvertFlag flag = BAYER_CONVERT_NORMAL)
     {
       int bayer_row_units = bayer->Width;
-      int rgb_row_units = rgb->Width * 3;
+      ptrdiff_t rgb_row_units = static_cast<ptrdiff_t>(rgb->Width) * 3;
       T *p_in = bayer->Pixels + bayer_row_units + 1;
       T *p_out = rgb->Pixels + rgb_row_units + 3;
       int x_end = (bayer->Width - 2) / 2;
@@ -172,7 +175,7 @@ namespace MBL
       int x, y;
       ImageFormat fmt = bayer->Format;
 
-      int rgb_row_offset = rgb_row_units;
+      ptrdiff_t rgb_row_offset = rgb_row_units;
       int rgb_pixel_offset = 3;
       if (flag & BAYER_CONVERT_FLIP)
       {
@@ -294,6 +297,247 @@ namespace MBL
       if (rgb->Format == IMAGE_FORMAT_BGR) ExchangeBand(rgb, 0, 2);
     }
 
+    /**
+     * Bayer图像去马赛克的插值方法。
+     */
+    typedef enum
+    {
+      BAYER_DEMOSAIC_BILINEAR, ///< 双线性插值，缺失的颜色取相邻同色象素的平均值。
+      BAYER_DEMOSAIC_MALVAR    ///< Malvar-He-Cutler梯度校正的双线性插值，用5×5邻域中其它颜色的梯度校正插值结果，边缘处色彩失真小。
+    } BayerDemosaicMethod;
+
+    // 取得Bayer格式中红色象素在2×2单元中的位置。
+    inline void _GetBayerRedPosition(ImageFormat format, int *rx, int *ry)
+    {
+      switch (format)
+      {
+        case IMAGE_FORMAT_BAYER_RG_GB:
+          *rx = 0;
+          *ry = 0;
+          break;
+        case IMAGE_FORMAT_BAYER_GR_BG:
+          *rx = 1;
+          *ry = 0;
+          break;
+        case IMAGE_FORMAT_BAYER_GB_RG:
+          *rx = 0;
+          *ry = 1;
+          break;
+        case IMAGE_FORMAT_BAYER_BG_GR:
+          *rx = 1;
+          *ry = 1;
+          break;
+        default:
+          throw UnsupportedFormatException();
+      }
+    }
+
+    // 把Bayer图像的第y行复制到buf + 2处，左右各补两个象素。超出图像的行和列按边界镜像（不重复边界），Bayer排列的奇偶
+    // 保持不变。
+    template <class T>
+    void _LoadBayerRow(const ImageDef<T> *bayer, int y, T *buf)
+    {
+      const int w = bayer->Width, h = bayer->Height;
+      if (y < 0) y = -y;
+      if (y >= h) y = 2 * h - 2 - y;
+
+      const T *p = GetRowPointer(bayer, y);
+      memcpy(buf + 2, p, static_cast<size_t>(w) * sizeof(T));
+      buf[0] = p[2];
+      buf[1] = p[1];
+      buf[w + 2] = p[w - 2];
+      buf[w + 3] = p[w - 3];
+    }
+
+    // 以下四个函数计算第x个象素缺失的一种颜色，a、u、c、d、e依次为第y-2～y+2行。
+
+    // 红色或蓝色象素处的绿色，取上下左右四个绿色象素。
+    template <BayerDemosaicMethod METHOD, class T>
+    inline T _InterpolateBayerCross(const T *a, const T *u, const T *c, const T *d, const T *e, int x)
+    {
+      if (METHOD == BAYER_DEMOSAIC_BILINEAR) return static_cast<T>((u[x] + d[x] + c[x - 1] + c[x + 1] + 2) >> 2);
+
+      const int v = (8 * c[x] + 4 * (u[x] + d[x] + c[x - 1] + c[x + 1]) - 2 * (a[x] + e[x] + c[x - 2] + c[x + 2]) + 8) >> 4;
+      return static_cast<T>(std::min(std::max(v, 0), static_cast<int>(ImageDefTraits<T>::MaxValue)));
+    }
+
+    // 红色象素处的蓝色或者蓝色象素处的红色，取对角线上的四个象素。
+    template <BayerDemosaicMethod METHOD, class T>
+    inline T _InterpolateBayerDiagonal(const T *a, const T *u, const T *c, const T *d, const T *e, int x)
+    {
+      if (METHOD == BAYER_DEMOSAIC_BILINEAR) return static_cast<T>((u[x - 1] + u[x + 1] + d[x - 1] + d[x + 1] + 2) >> 2);
+
+      const int v = (12 * c[x] + 4 * (u[x - 1] + u[x + 1] + d[x - 1] + d[x + 1]) - 3 * (a[x] + e[x] + c[x - 2] + c[x + 2]) + 8) >> 4;
+      return static_cast<T>(std::min(std::max(v, 0), static_cast<int>(ImageDefTraits<T>::MaxValue)));
+    }
+
+    // 绿色象素处本行的另一种颜色，取左右两个象素。
+    template <BayerDemosaicMethod METHOD, class T>
+    inline T _InterpolateBayerHorizontal(const T *a, const T *u, const T *c, const T *d, const T *e, int x)
+    {
+      if (METHOD == BAYER_DEMOSAIC_BILINEAR) return static_cast<T>((c[x - 1] + c[x + 1] + 1) >> 1);
+
+      const int v = (10 * c[x] + 8 * (c[x - 1] + c[x + 1]) - 2 * (c[x - 2] + c[x + 2] + u[x - 1] + u[x + 1] + d[x - 1] + d[x + 1])
+                     + a[x] + e[x] + 8) >> 4;
+      return static_cast<T>(std::min(std::max(v, 0), static_cast<int>(ImageDefTraits<T>::MaxValue)));
+    }
+
+    // 绿色象素处上下行的颜色，取上下两个象素。
+    template <BayerDemosaicMethod METHOD, class T>
+    inline T _InterpolateBayerVertical(const T *a, const T *u, const T *c, const T *d, const T *e, int x)
+    {
+      if (METHOD == BAYER_DEMOSAIC_BILINEAR) return static_cast<T>((u[x] + d[x] + 1) >> 1);
+
+      const int v = (10 * c[x] + 8 * (u[x] + d[x]) - 2 * (a[x] + e[x] + u[x - 1] + u[x + 1] + d[x - 1] + d[x + 1])
+                     + c[x - 2] + c[x + 2] + 8) >> 4;
+      return static_cast<T>(std::min(std::max(v, 0), static_cast<int>(ImageDefTraits<T>::MaxValue)));
+    }
+
+    // 计算一行的去马赛克结果，按平面写入r、g、b。rows为第y-2～y+2行补边后的数据，指向各行的第0个象素。RED为true表示
+    // 本行是红色与绿色相间的行，否则是蓝色与绿色相间的行；CX为本行红色或蓝色象素所在列的奇偶。象素的种类在编译时确定，
+    // 每个平面用一个按象素对进行的循环计算，循环中没有分支，可以被编译器向量化。
+    template <BayerDemosaicMethod METHOD, bool RED, int CX, class T>
+    void _DemosaicBayerRow(const T * const *rows, int width, T *r, T *g, T *b)
+    {
+      const T *a = rows[0], *u = rows[1], *c = rows[2], *d = rows[3], *e = rows[4];
+      T *own = RED ? r : b;     // 本行中存在的颜色。
+      T *other = RED ? b : r;   // 只在上下行中存在的颜色。
+      const int n = width / 2;
+
+      for (int k = 0; k < n; k++)
+      {
+        g[2 * k + CX] = _InterpolateBayerCross<METHOD>(a, u, c, d, e, 2 * k + CX);
+        g[2 * k + 1 - CX] = c[2 * k + 1 - CX];
+      }
+      for (int k = 0; k < n; k++)
+      {
+        own[2 * k + CX] = c[2 * k + CX];
+        own[2 * k + 1 - CX] = _InterpolateBayerHorizontal<METHOD>(a, u, c, d, e, 2 * k + 1 - CX);
+      }
+      for (int k = 0; k < n; k++)
+      {
+        other[2 * k + CX] = _InterpolateBayerDiagonal<METHOD>(a, u, c, d, e, 2 * k + CX);
+        other[2 * k + 1 - CX] = _InterpolateBayerVertical<METHOD>(a, u, c, d, e, 2 * k + 1 - CX);
+      }
+
+      // 宽度为奇数时的最后一个象素。
+      const int x = width - 1;
+      if (width % 2 == 0)
+      {
+        return;
+      }
+      else if ((x & 1) == CX)
+      {
+        own[x] = c[x];
+        g[x] = _InterpolateBayerCross<METHOD>(a, u, c, d, e, x);
+        other[x] = _InterpolateBayerDiagonal<METHOD>(a, u, c, d, e, x);
+      }
+      else
+      {
+        g[x] = c[x];
+        own[x] = _InterpolateBayerHorizontal<METHOD>(a, u, c, d, e, x);
+        other[x] = _InterpolateBayerVertical<METHOD>(a, u, c, d, e, x);
+      }
+    }
+
+    // 按行的种类选择特化的行处理函数。
+    template <BayerDemosaicMethod METHOD, class T>
+    void _DemosaicBayerRow(const T * const *rows, int width, bool red, int cx, T *r, T *g, T *b)
+    {
+      if (red)
+      {
+        if (cx == 0) _DemosaicBayerRow<METHOD, true, 0>(rows, width, r, g, b);
+        else _DemosaicBayerRow<METHOD, true, 1>(rows, width, r, g, b);
+      }
+      else
+      {
+        if (cx == 0) _DemosaicBayerRow<METHOD, false, 0>(rows, width, r, g, b);
+        else _DemosaicBayerRow<METHOD, false, 1>(rows, width, r, g, b);
+      }
+    }
+
+    /**
+     * @brief 将Bayer图像去马赛克，转换为彩色图像。
+     *
+     * 与ConvertBayer2Color相比，该函数逐行处理，每一行中各个象素的种类由Bayer格式在编译时确定，内层循环没有分支，可以
+     * 被编译器向量化；图像按行分成条带，在多个线程上同时处理。图像边缘按镜像补齐，不再简单地复制相邻的行列。
+     *
+     * 双线性插值速度最快；Malvar-He-Cutler方法用5×5邻域中已知颜色的梯度校正双线性插值的结果，在边缘处的色彩失真
+     * （彩色镶边、拉链效应）明显减少，计算量约为双线性插值的两倍。
+     *
+     * @param bayer Bayer图像，格式为IMAGE_FORMAT_BAYER_GR_BG、IMAGE_FORMAT_BAYER_BG_GR、IMAGE_FORMAT_BAYER_GB_RG或
+     *              IMAGE_FORMAT_BAYER_RG_GB之一，宽度和高度都不能小于3。
+     * @param rgb 彩色图像，可以是RGB或者BGR格式，必须与Bayer图像同尺寸。
+     * @param method 插值方法。
+     * @param flag 转化时是否做Flip或(与)mirror，参见BayerConvertFlag定义。
+     *
+     * @see ConvertBayer2Color
+     */
+    template <class T>
+    void DemosaicBayerImage(const ImageDef<T> *bayer, ImageDef<T> *rgb, BayerDemosaicMethod method = BAYER_DEMOSAIC_BILINEAR,
+                            BayerConvertFlag flag = BAYER_CONVERT_NORMAL)
+    {
+      if (bayer == 0 || rgb == 0) throw NullPointerException();
+
+      int rx, ry;
+      _GetBayerRedPosition(bayer->Format, &rx, &ry);
+      if (rgb->Format != IMAGE_FORMAT_RGB && rgb->Format != IMAGE_FORMAT_BGR) throw UnsupportedFormatException();
+      if (rgb->Width != bayer->Width || rgb->Height != bayer->Height) throw UnmatchedImageException();
+      if (bayer->Width < 3 || bayer->Height < 3) throw IllegalArgumentException();
+
+      const int width = bayer->Width, height = bayer->Height, stride = width + 4;
+      const bool bgr = rgb->Format == IMAGE_FORMAT_BGR;
+      const bool flip = (flag & BAYER_CONVERT_FLIP) != 0, mirror = (flag & BAYER_CONVERT_MIRROR) != 0;
+      const int band = 32;
+      const int bands = (height + band - 1) / band;
+
+      MBL::Utility::ParallelFor(0, bands, [&](int s)
+      {
+        // 5行补边后的输入组成环形缓冲区，第y行存放在第(y + 2) % 5个位置。
+        std::vector<T> ring(5 * static_cast<size_t>(stride)), planes(3 * static_cast<size_t>(width));
+        T *r = &planes[0], *g = r + width, *b = g + width;
+        const int y0 = s * band, y1 = MBL::Utility::GetMin(y0 + band, height);
+        for (int y = y0 - 2; y < y0 + 2; y++) _LoadBayerRow(bayer, y, &ring[((y + 2) % 5) * stride]);
+
+        for (int y = y0; y < y1; y++)
+        {
+          _LoadBayerRow(bayer, y + 2, &ring[((y + 4) % 5) * stride]);
+          const T *rows[5];
+          for (int k = 0; k < 5; k++) rows[k] = &ring[((y + k) % 5) * stride + 2];
+
+          const bool red = (y & 1) == ry;
+          const int cx = red ? rx : 1 - rx;
+          if (method == BAYER_DEMOSAIC_MALVAR)
+            _DemosaicBayerRow<BAYER_DEMOSAIC_MALVAR>(rows, width, red, cx, r, g, b);
+          else
+            _DemosaicBayerRow<BAYER_DEMOSAIC_BILINEAR>(rows, width, red, cx, r, g, b);
+
+          // 交错写入彩色图像，BGR格式交换红蓝分量。
+          T *out = GetRowPointer(rgb, flip ? height - 1 - y : y);
+          const T *first = bgr ? b : r, *third = bgr ? r : b;
+          if (!mirror)
+          {
+            for (int x = 0; x < width; x++)
+            {
+              out[3 * x] = first[x];
+              out[3 * x + 1] = g[x];
+              out[3 * x + 2] = third[x];
+            }
+          }
+          else
+          {
+            for (int x = 0; x < width; x++)
+            {
+              const int m = width - 1 - x;
+              out[3 * m] = first[x];
+              out[3 * m + 1] = g[x];
+              out[3 * m + 2] = third[x];
+            }
+          }
+        }
+      });
+    }
+
     /**
      * @brief 计算一幅Bayer图像的平均亮度。
      *
@@ -315,7 +559,7 @@ namespace MBL
       //Byer数据计算平均亮度。
       int x, y;
       int x_end = image->Width / 2, y_end = image->Height / 2;
-      long R = 0, G = 0, B = 0;
+      long long R = 0, G = 0, B = 0;
 
       switch (image->Format)
       {
@@ -383,7 +627,7 @@ namespace MBL
           break;
       }
 
-      int n = image->Width * image->Height / 4;
+      long long n = static_cast<long long>(image->Width) * image->Height / 4;
       G /= 2 * n;
       B /= n;
       R /= n;
@@ -473,49 +717,29 @@ namespace MBL
     /**
      * @brief Bayer图像增强,使用锐化算法补尝因BAYER转RGB/BGR图像时引起的图像模糊
      * 
-     * @param image Bayer索引图像,或0用于释放临时临时缓冲区见attention，目前只适用于8bit图像。
-     * 
-     * @attention 调用该函数会产生临时内存缓冲区,当不再使用后请以0为参数调用一次以释放该临时缓冲区
+     * @param image Bayer索引图像，目前只适用于8bit图像。为0时不做任何处理，以兼容以前释放临时缓冲区的调用方式。
+     * @param scratch 调用者提供的临时缓冲区，至少能容纳Width × Height个单元。为0时函数内部临时分配。
+     *                各个线程使用各自的缓冲区即可同时处理不同的图像。
      *
      * @author 陈德敏
      */
     template<class T>
-    void BayerEnhance(ImageDef<T> *image, int c_o = -96, int c_c = 640, int c_a= 12)
+    void BayerEnhance(ImageDef<T> *image, int c_o = -96, int c_c = 640, int c_a= 12, T *scratch = 0)
     {
       //static const int c_o = -96;//增强系数*255
       //static const int c_c = 640;
       //static const int c_a = 12;
-      static unsigned char*tempBuf = 0;
-      static unsigned int tempSize = 0;
-      if (image == 0)//释放临时缓冲
-      {
-        if (tempBuf)
-        {
-          delete[] tempBuf;
-          tempBuf = 0;
-        }
-        tempSize = 0;
-        return;
-      }
-      if (tempBuf == 0 || tempSize < image->Width * image->Height * sizeof(T))
-      {
-        if (tempBuf)
-        {
-          delete[] tempBuf;
-          tempBuf = 0;
-        }
-        tempSize = image->Width * image->Height * sizeof(T);
-        tempBuf = new unsigned char[tempSize];
-      }
+      if (image == 0) return;
 
-      T* temp = (T*) tempBuf;
-      if (temp == 0) return;
+      const size_t imageSize = static_cast<size_t>(image->Width) * image->Height * sizeof(T);
+      T *tempBuf = (scratch == 0) ? new T[static_cast<size_t>(image->Width) * image->Height] : 0;
+      T* temp = (scratch == 0) ? tempBuf : scratch;
 
       long maxValue = ((1 << (sizeof(T) * 8)) - 1);
 
       int width = image->Width;
       int height = image->Height;
-      memcpy(temp, image->Pixels, image->Width * image->Height * sizeof(T));
+      memcpy(temp, image->Pixels, imageSize);
 
       T* p1, *p2, *p3, *p4;
       int pitch = width * 2;
@@ -603,6 +827,8 @@ namespace MBL
         p3 = pL3 + pitch;
         p4 = pL4 + pitch;
       }
+
+      MBL::Utility::SafeReleaseArray(&tempBuf);
     }
   }
 }
@@ -4,7 +4,11 @@
 #include "ImageSubArea.h"
 #include "ImageSequenceDef.h"
 #include "ImageRW.h"
+#include "RunLengthMask.h"
+#include "ImageView.h"
+#include "ImageTile.h"
 #include "ImageTransform.h"
+#include "ImagePyramid.h"
 #include "ImageColor.h"
 #include "ImageFilter.h"
 #include "ImageMeasure.h"
@@ -25,8 +29,180 @@
 using namespace MBL::Image2D;
 
 void ScaleImage(const unsigned char *srcRGB, int srcWidth, int srcHeight, unsigned char *destRGB, int destWidth, int destHeight) {
-    ImageDef8b srcImg(IMAGE_FORMAT_RGB, const_cast<unsigned char*>(srcRGB), srcWidth, srcHeight);
-    ImageDef8b *scaleImg = ScaleImage2Linear(&srcImg, destWidth, destHeight);
-    memcpy(destRGB, scaleImg->Pixels, GetBytesOfPixelData(scaleImg));
-    delete scaleImg;
-}
\ No newline at end of file
+    ScaleImageWithFilter(srcRGB, srcWidth, srcHeight, destRGB, destWidth, destHeight, SCALE_IMAGE_FILTER_BILINEAR);
+}
+
+void ScaleImageWithFilter(const unsigned char *srcRGB, int srcWidth, int srcHeight, unsigned char *destRGB, int destWidth, int destHeight,
+                          ScaleImageFilter filter) {
+    ScaleImageStrided(srcRGB, srcWidth, srcHeight, 0, destRGB, destWidth, destHeight, 0, filter);
+}
+
+int ScaleImageStrided(const unsigned char *srcRGB, int srcWidth, int srcHeight, int srcRowBytes,
+                      unsigned char *destRGB, int destWidth, int destHeight, int destRowBytes, ScaleImageFilter filter) {
+    if (srcRGB == 0 || destRGB == 0 || srcRowBytes < 0 || destRowBytes < 0) return -1;
+    try {
+        // 源和目标都直接包裹调用者的内存，缩放结果写入目标缓冲区，不经过中间图像。
+        ImageView8b srcImg(IMAGE_FORMAT_RGB, const_cast<unsigned char*>(srcRGB), srcWidth, srcHeight, srcRowBytes);
+        ImageView8b destImg(IMAGE_FORMAT_RGB, destRGB, destWidth, destHeight, destRowBytes);
+        // 区域平均只能缩小，放大时仍然使用双线性插值。
+        if (filter == SCALE_IMAGE_FILTER_AREA && destWidth <= srcWidth && destHeight <= srcHeight) {
+            ScaleImageArea(&srcImg, &destImg);
+        } else {
+            BilinearScalePlan plan(&srcImg, destWidth, destHeight);
+            ScaleImage2LinearFast(&srcImg, &destImg, plan);
+        }
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+struct ImagePyramidHandle {
+    ImagePyramidBuilder<unsigned char> *Builder;
+};
+
+ImagePyramidHandle *CreateImagePyramid(int width, int height, int tileWidth, int tileHeight, int levels,
+                                       ImagePyramidTileCallback callback, void *context) {
+    if (callback == 0) return 0;
+    try {
+        ImagePyramidHandle *pyramid = new ImagePyramidHandle;
+        try {
+            pyramid->Builder = new ImagePyramidBuilder<unsigned char>(IMAGE_FORMAT_RGB, width, height, tileWidth, tileHeight, levels,
+                [callback, context](int level, int column, int row, ImageDef8b *tile) {
+                    callback(context, level, column, row, tile->Pixels, tile->Width, tile->Height, static_cast<int>(GetUnitsPerRow(tile)));
+                });
+        } catch (...) {
+            delete pyramid;
+            throw;
+        }
+        return pyramid;
+    } catch (...) {
+        return 0;
+    }
+}
+
+int GetImagePyramidLevelCount(const ImagePyramidHandle *pyramid) {
+    return pyramid == 0 ? 0 : pyramid->Builder->GetLevelCount();
+}
+
+int PushImagePyramidTile(ImagePyramidHandle *pyramid, int column, int row, const unsigned char *rgb, int width, int height, int rowBytes) {
+    if (pyramid == 0 || rgb == 0) return -1;
+    try {
+        ImageView8b tile(IMAGE_FORMAT_RGB, const_cast<unsigned char*>(rgb), width, height, rowBytes);
+        pyramid->Builder->PushTile(column, row, &tile);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+int FinishImagePyramid(ImagePyramidHandle *pyramid) {
+    if (pyramid == 0) return -1;
+    try {
+        pyramid->Builder->Finish();
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+void DestroyImagePyramid(ImagePyramidHandle *pyramid) {
+    if (pyramid == 0) return;
+    delete pyramid->Builder;
+    delete pyramid;
+}
+
+struct FocusMergerHandle {
+    SequenceMerger<unsigned char> *Merger;
+    int Width;
+    int Height;
+};
+
+// 把融合结果复制到调用者的紧凑缓冲区中。
+static void CopyFocusMergeResult(const ImageDef8b *dem, const ImageDef8b *montage, unsigned char *demOut, unsigned char *montageRGB) {
+    for (int y = 0; y < dem->Height; y++) {
+        memcpy(demOut + static_cast<size_t>(y) * dem->Width, GetRowPointer(dem, y), dem->Width);
+        memcpy(montageRGB + static_cast<size_t>(y) * montage->Width * 3, GetRowPointer(montage, y), static_cast<size_t>(montage->Width) * 3);
+    }
+}
+
+FocusMergerHandle *CreateFocusMerger(int width, int height, FocusStackMergeMethod method, int windowSize, int threshold) {
+    try {
+        FocusMergerHandle *merger = new FocusMergerHandle;
+        merger->Width = width;
+        merger->Height = height;
+        try {
+            merger->Merger = new SequenceMerger<unsigned char>(IMAGE_FORMAT_RGB, width, height, static_cast<SequenceMergeMethod>(method),
+                                                               windowSize, threshold);
+        } catch (...) {
+            delete merger;
+            throw;
+        }
+        return merger;
+    } catch (...) {
+        return 0;
+    }
+}
+
+int PushFocusMergerFrame(FocusMergerHandle *merger, const unsigned char *rgb, int rowBytes) {
+    if (merger == 0 || rgb == 0 || rowBytes < 0) return -1;
+    try {
+        ImageView8b frame(IMAGE_FORMAT_RGB, const_cast<unsigned char*>(rgb), merger->Width, merger->Height, rowBytes);
+        merger->Merger->PushFrame(&frame);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+int FinishFocusMerger(FocusMergerHandle *merger, unsigned char *dem, unsigned char *montageRGB) {
+    if (merger == 0 || dem == 0 || montageRGB == 0) return -1;
+    try {
+        merger->Merger->Finish();
+        CopyFocusMergeResult(merger->Merger->GetDEM(), merger->Merger->GetMontage(), dem, montageRGB);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+void DestroyFocusMerger(FocusMergerHandle *merger) {
+    if (merger == 0) return;
+    delete merger->Merger;
+    delete merger;
+}
+
+int MergeFocusStack(const unsigned char *const *framesRGB, int count, int width, int height, FocusStackMergeMethod method, int windowSize,
+                    unsigned char *dem, unsigned char *montageRGB) {
+    if (framesRGB == 0 || count <= 0 || dem == 0 || montageRGB == 0) return -1;
+    if (method != FOCUS_MERGE_MAX && method != FOCUS_MERGE_CONTRAST && method != FOCUS_MERGE_TENENGRAD) return -1;
+    ImageDef8b *demImg = 0, *montage = 0;
+    ImageSequenceDef<unsigned char> *seq = 0;
+    int ret = -1;
+    try {
+        // 整个序列都在内存中，直接包裹调用者的各帧。
+        std::vector<unsigned char*> frames(count);
+        for (int k = 0; k < count; k++) frames[k] = const_cast<unsigned char*>(framesRGB[k]);
+        seq = ImageSequenceDef<unsigned char>::CreateWrapperInstance(IMAGE_FORMAT_RGB, &frames[0], width, height, 0, count);
+        switch (method) {
+            case FOCUS_MERGE_MAX:
+                demImg = MaxMergeSequenceIntoDEM(seq);
+                break;
+            case FOCUS_MERGE_CONTRAST:
+                demImg = ContrastMergeSequenceIntoDEM(seq);
+                break;
+            default:
+                demImg = TenengradMergeSequenceIntoDEM(seq, windowSize, 0);
+                break;
+        }
+        montage = MontageSequenceDEM(seq, demImg);
+        CopyFocusMergeResult(demImg, montage, dem, montageRGB);
+        ret = 0;
+    } catch (...) {
+    }
+    if (seq != 0) seq->Pixels = 0;
+    delete seq;
+    delete demImg;
+    delete montage;
+    return ret;
+}
@@ -1,7 +1,9 @@
 #ifndef __HISTOGRAM_H__
 #define __HISTOGRAM_H__
 
+#include <mutex>
 #include <limits>
+#include <vector>
 
 /**
  * @file
@@ -13,6 +15,172 @@ namespace MBL
 {
   namespace Image2D
   {
+    // 直方图只能统计各分量交错存放的图像。
+    template <class T>
+    void _CheckHistogramFormat(const ImageDef<T> *image)
+    {
+      switch (image->Format)
+      {
+        case IMAGE_FORMAT_INDEX:
+        case IMAGE_FORMAT_RGB:
+        case IMAGE_FORMAT_BGR:
+        case IMAGE_FORMAT_RGBA:
+        case IMAGE_FORMAT_ARGB:
+        case IMAGE_FORMAT_INDEX_ALPHA:
+          break;
+        default:
+          throw UnsupportedFormatException();
+      }
+    }
+
+    // 统计一段象素的直方图。n个象素、每象素m个通道，第i个象素计入第i % Ways组子直方图，相邻象素的计数落在不同的数组中，
+    // 颜色相同的大片背景不会反复读写同一个计数单元。counts按[组][通道][灰度]存放。
+    template <int Ways, class T>
+    void _CountHistogramSpan(const T *p, int n, int m, unsigned int *counts)
+    {
+      const size_t length = ImageDefTraits<T>::LengthOfLUT;
+      int i = 0;
+      for (; i + Ways <= n; i += Ways, p += Ways * m)
+      {
+        for (int w = 0; w < Ways; w++)
+        {
+          unsigned int *h = counts + static_cast<size_t>(w) * m * length;
+          for (int c = 0; c < m; c++) h[c * length + p[w * m + c]]++;
+        }
+      }
+      for (; i < n; i++, p += m)
+      {
+        for (int c = 0; c < m; c++) counts[c * length + p[c]]++;
+      }
+    }
+
+    // 并行统计[left, right)×[top, bottom)内的直方图，mask不为0时只统计掩模选中的段。
+    template <class T>
+    void _GetImageHistograms(const ImageDef<T> *image, const RunLengthMask *mask, int left, int top, int right, int bottom,
+                             std::vector<long long> *histograms)
+    {
+      // 8位图像的直方图很小，用4组子直方图；16位图像的计数本来就分散，子直方图只会增加缓存的压力。
+      const int ways = sizeof(T) == 1 ? 4 : 1;
+      const int m = GetUnitsPerPixel(image);
+      const size_t length = ImageDefTraits<T>::LengthOfLUT;
+      const size_t size = static_cast<size_t>(m) * length;
+      histograms->assign(size, 0);
+      if (right <= left || bottom <= top) return;
+
+      const int strip = 64;
+      const int strips = (bottom - top + strip - 1) / strip;
+      std::mutex lock;
+
+      MBL::Utility::ParallelRun(strips, [&](MBL::Utility::ParallelTasks &tasks)
+      {
+        std::vector<unsigned int> counts(ways * size, 0);
+        std::vector<long long> total(size, 0);
+        size_t counted = 0;
+
+        // 把子直方图累加到本线程的总计数中，防止32位计数溢出。
+        auto flush = [&]()
+        {
+          for (int w = 0; w < ways; w++)
+          {
+            unsigned int *h = &counts[w * size];
+            for (size_t k = 0; k < size; k++) total[k] += h[k];
+          }
+          std::fill(counts.begin(), counts.end(), 0);
+          counted = 0;
+        };
+
+        int s;
+        while (tasks.Next(&s))
+        {
+          const int y0 = top + s * strip, y1 = MBL::Utility::GetMin(y0 + strip, bottom);
+          for (int y = y0; y < y1; y++)
+          {
+            const T *row = GetRowPointer(image, y);
+            int count = 1;
+            const ImageSpan *spans = 0;
+            if (mask != 0) spans = mask->GetRowSpans(y, &count);
+            for (int i = 0; i < count; i++)
+            {
+              const int l = mask != 0 ? MBL::Utility::GetMax(spans[i].Left, left) : left;
+              const int r = mask != 0 ? MBL::Utility::GetMin(spans[i].Right, right) : right;
+              if (r <= l) continue;
+
+              if (counted + (r - l) > 0x7fffffffu) flush();
+              if (ways == 4)
+                _CountHistogramSpan<4>(row + static_cast<size_t>(l) * m, r - l, m, &counts[0]);
+              else
+                _CountHistogramSpan<1>(row + static_cast<size_t>(l) * m, r - l, m, &counts[0]);
+              counted += r - l;
+            }
+          }
+        }
+
+        flush();
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t k = 0; k < size; k++) (*histograms)[k] += total[k];
+      });
+    }
+
+    /**
+     * @brief 取得图像各个通道的直方图。
+     *
+     * 处理区域按行划分为条带，在多个线程上同时统计，每个线程有自己的直方图，最后合并。8位图像每个线程使用4组交错的子直方图，
+     * 相邻象素写入不同的计数单元，大片相同颜色的背景不会因为反复修改同一个计数而变慢。16位图像使用65536级的直方图。
+     * 任意子区按行内连续段统计，不逐点判断。
+     *
+     * @param image 源图像，各分量必须交错存放，如索引、RGB、BGR、RGBA等格式。
+     * @param sub_area 处理子区，为0表示全图。
+     * @param histograms 返回的直方图，按图像中分量的顺序每个通道依次存放ImageDefTraits<T>::LengthOfLUT个计数。
+     *
+     * @see GetImageHistogram
+     */
+    template <class T>
+    void GetImageHistograms(const ImageDef<T> *image, ImageSubArea *sub_area, std::vector<long long> *histograms)
+    {
+      if (image == 0 || histograms == 0) throw NullPointerException();
+      _CheckHistogramFormat(image);
+
+      int left = 0, top = 0, right = image->Width, bottom = image->Height;
+      if (sub_area != 0)
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+      }
+
+      if (sub_area != 0 && sub_area->Pixels != 0)
+      {
+        RunLengthMask mask(sub_area, image->Width, image->Height);
+        _GetImageHistograms(image, &mask, left, top, right, bottom, histograms);
+      }
+      else
+      {
+        _GetImageHistograms(image, static_cast<const RunLengthMask *>(0), left, top, right, bottom, histograms);
+      }
+    }
+
+    /**
+     * @brief 取得图像中掩模选中象素的各个通道的直方图。
+     *
+     * @param image 源图像，各分量必须交错存放，如索引、RGB、BGR、RGBA等格式。
+     * @param mask 掩模，尺寸必须与图像相同。
+     * @param histograms 返回的直方图，按图像中分量的顺序每个通道依次存放ImageDefTraits<T>::LengthOfLUT个计数。
+     *
+     * @see GetImageHistograms
+     */
+    template <class T>
+    void GetImageHistograms(const ImageDef<T> *image, const RunLengthMask &mask, std::vector<long long> *histograms)
+    {
+      if (image == 0 || histograms == 0) throw NullPointerException();
+      _CheckHistogramFormat(image);
+      if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
+
+      int left, top, width, height;
+      mask.GetBounds(&left, &top, &width, &height);
+      _GetImageHistograms(image, &mask, left, top, left + width, top + height, histograms);
+    }
+
     /**
      * @brief 取得一幅图像的直方图。
      *
@@ -22,24 +190,11 @@ namespace MBL
     template <class T>
     void GetImageHistogram(ImageDef<T> *image, int *buf)
     {
-      T *pixels;
-    	int units;
-    	units = GetUnitsPerRow(image) * image->Height;
-    	memset(buf, 0, ImageDefTraits<T>::LengthOfLUT *sizeof(int));
-    	pixels = image->Pixels;
-
-  		switch (image->Format)
-  		{
-  		  case IMAGE_FORMAT_INDEX:
-  		    for (int i = 0; i < units; i++, pixels++)
-  		    {
-  		      buf[*pixels]++;
-  		    }
-  		    break;
-        default:
-          throw UnsupportedFormatException();
-  			  break;
-  		}
+      if (image->Format != IMAGE_FORMAT_INDEX) throw UnsupportedFormatException();
+
+      std::vector<long long> histogram;
+      GetImageHistograms(image, static_cast<ImageSubArea *>(0), &histogram);
+      for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; i++) buf[i] = static_cast<int>(histogram[i]);
     }
 
     /**
@@ -56,54 +211,17 @@ namespace MBL
     {
       if (image->Format != IMAGE_FORMAT_RGB && image->Format != IMAGE_FORMAT_BGR) throw UnsupportedFormatException();
 
-    	T max_T;
-    	MBL::Utility::GetMaxValue(&max_T);
-    	memset(r_buf, 0, (max_T + 1) *sizeof(int));
-    	memset(g_buf, 0, (max_T + 1) *sizeof(int));
-    	memset(b_buf, 0, (max_T + 1) *sizeof(int));
-
-    	int left, top, right, bottom;
-      if (sub_area == 0)
-      {
-        left = 0;
-        top = 0;
-        right = image->Width;
-        bottom = image->Height;
-      }
-      else
-      {
-        left = sub_area->Left;
-        top = sub_area->Top;
-        right = sub_area->Left + sub_area->Width;
-        bottom = sub_area->Top + sub_area->Height;
-      }
+      std::vector<long long> histograms;
+      GetImageHistograms(image, sub_area, &histograms);
 
-      T buf[8];
-      for (int y = top; y < bottom; y++)
+      const int length = ImageDefTraits<T>::LengthOfLUT;
+      const long long *first = &histograms[0], *third = &histograms[2 * length];
+      if (image->Format == IMAGE_FORMAT_BGR) std::swap(first, third);
+      for (int i = 0; i < length; i++)
       {
-        for (int x = left; x < right; x++)
-        {
-          if (sub_area == 0 || sub_area->IsFill(x, y))
-          {
-            ReadPixel(image, x, y, buf);
-
-            switch (image->Format)
-        		{
-        		  case IMAGE_FORMAT_RGB:
-      		      r_buf[buf[0]]++;
-       		      g_buf[buf[1]]++;
-       		      b_buf[buf[2]]++;
-        		    break;
-        		  case IMAGE_FORMAT_BGR:
-       		      b_buf[buf[0]]++;
-       		      g_buf[buf[1]]++;
-       		      r_buf[buf[2]]++;
-        		    break;
-              default:
-        			  break;
-        		}
-          }
-        }
+        r_buf[i] = static_cast<int>(first[i]);
+        g_buf[i] = static_cast<int>(histograms[length + i]);
+        b_buf[i] = static_cast<int>(third[i]);
       }
     }
 
@@ -212,19 +330,15 @@ namespace MBL
     double GetOpticalDensity(T background, int *histogram)
     {
       double od = 0;
-      static double map[256][256];
 
       if (background > 0)
       {
+        double log_bg = log10((double)background);
         for (int i = 1; i < background; i++)
         {
           if (histogram[i] > 0)
           {
-            if (map[background][i] == 0) // 没有初始化。
-            {
-              map[background][i] = log10((double)background) - log10((double)i);
-            }
-            od += map[background][i] * histogram[i];
+            od += (log_bg - log10((double)i)) * histogram[i];
           }
         }
       }
@@ -309,16 +423,19 @@ namespace MBL
       GetImageHistogram(image, hist);
       T threshold;
       GetHistogramThreshold(hist, max_T + 1, &threshold);
-      T *p = image->Pixels;
-      for (int i = 0, n = GetUnitsPerRow(image) * image->Height; i < n; i++)
+      for (int y = 0; y < image->Height; y++)
       {
-        if (*p <= threshold)
-        {
-          *p++ = object;
-        }
-        else
+        T *p = GetRowPointer(image, y);
+        for (int x = 0; x < image->Width; x++)
         {
-          *p++ = 0;
+          if (*p <= threshold)
+          {
+            *p++ = object;
+          }
+          else
+          {
+            *p++ = 0;
+          }
         }
       }
 
@@ -339,7 +456,7 @@ namespace MBL
       //const int nEffectWidth 400;
       //const int nEffectHeight = 300;
 
-      static int	nHistogram[3][256];//直方图数据
+      int nHistogram[3][256];//直方图数据
       memset(nHistogram, 0, sizeof(nHistogram));
 
       //统计Histogram------------
@@ -347,13 +464,17 @@ namespace MBL
       //int dwHStep = MBL::Utility::GetMax(image->Height / nEffectHeight, 1);
 
       int i;
-      int dwtotal = image->Width * image->Height;
-      T *ptr = image->Pixels;
-      for (i = 0; i < dwtotal; i++)
+      size_t dwtotal = static_cast<size_t>(image->Width) * image->Height;
+      T *ptr = 0;
+      for (int y = 0; y < image->Height; y++)
       {
-        nHistogram[0][*ptr++]++;
-        nHistogram[1][*ptr++]++;
-        nHistogram[2][*ptr++]++;
+        ptr = GetRowPointer(image, y);
+        for (int x = 0; x < image->Width; x++)
+        {
+          nHistogram[0][*ptr++]++;
+          nHistogram[1][*ptr++]++;
+          nHistogram[2][*ptr++]++;
+        }
       }
 
       //统计Histogram_Low, Histogram_High
@@ -388,7 +509,7 @@ namespace MBL
         }
       }
 
-      static T HistogramTable[256];
+      T HistogramTable[256];
       T nCenter = (Histogram_High + Histogram_Low) >> 1;
       //刷新HistogramTable的数据
       for (i = 0; i < Histogram_Low; i++)
@@ -409,15 +530,18 @@ namespace MBL
         HistogramTable[i] = 255;
       }
 
-      ptr = image->Pixels;
-      for (i = 0; i < dwtotal; i++)
+      for (int y = 0; y < image->Height; y++)
       {
-        *ptr = HistogramTable[*ptr];
-        ptr++;
-        *ptr = HistogramTable[*ptr];
-        ptr++;
-        *ptr = HistogramTable[*ptr];
-        ptr++;
+        ptr = GetRowPointer(image, y);
+        for (int x = 0; x < image->Width; x++)
+        {
+          *ptr = HistogramTable[*ptr];
+          ptr++;
+          *ptr = HistogramTable[*ptr];
+          ptr++;
+          *ptr = HistogramTable[*ptr];
+          ptr++;
+        }
       }
     }
   }
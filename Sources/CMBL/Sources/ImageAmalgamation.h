@@ -83,10 +83,10 @@ namespace MBL
             {
               for (int x = 0; x < image->Width; x++)
               {
-                src2 = &(image->Pixels[(y * image->Width + x) * b]);
+                src2 = image->Pixels + GetUnitsOffset(image, x, y);
                 if (x < Result->Width && y < Result->Height)
                 {
-                  src1 = &(Result->Pixels[(y * Result->Width + x) * b]);
+                  src1 = Result->Pixels + GetUnitsOffset(Result, x, y);
                   AmalgamatePixel(src1, src2, buf, b, min, max);
                   WritePixel(temp, x, y, buf);
                 }
@@ -124,7 +124,7 @@ namespace MBL
               {
                 for (int j = 0; j < Result->Width; j++)
                 {
-                  Result->Pixels[(i * Result->Width + j) * b + alpha] = max;
+                  Result->Pixels[GetUnitsOffset(Result, j, i) + alpha] = max;
                 }
               }
             }
@@ -476,7 +476,7 @@ namespace MBL
     	int count = pool.count(id);
 			if(count == 1) background = pool[id];
 
-      int i, n;
+      size_t i, n;
       T *ptr = 0;
       short *bkptr = 0;
 
@@ -490,8 +490,8 @@ namespace MBL
         }
 
         //计算全幅图象的平均R,G,B值作为参考光的R,G,B值。
-        int R = 0, G = 0, B = 0;
-        n = bk->Width * bk->Height;
+        long long R = 0, G = 0, B = 0;
+        n = static_cast<size_t>(bk->Width) * bk->Height;
         ptr = bk->Pixels;
         for (i = 0; i < n; i++)
         {
@@ -499,9 +499,9 @@ namespace MBL
           G += *ptr++;
           B += *ptr++;
         }
-        R /= n;
-        G /= n;
-        B /= n;
+        R /= static_cast<long long>(n);
+        G /= static_cast<long long>(n);
+        B /= static_cast<long long>(n);
 
         bkptr = background->Pixels;
         ptr = bk->Pixels;
@@ -518,7 +518,7 @@ namespace MBL
       {
         ptr = image->Pixels;
         bkptr = background->Pixels;
-        n = image->Width * image->Height * 3;
+        n = static_cast<size_t>(image->Width) * image->Height * 3;
         for (i = 0; i < n; i++)
         {
           *ptr = MBL::Utility::Clamp(*ptr + *bkptr++, 0, 255);
@@ -543,17 +543,17 @@ namespace MBL
 
 		  //计算平均值
 		  T *p = bg->Pixels;
-		  int m_Rav = 0, m_Gav = 0, m_Bav = 0;
-		  int n = bg->Width * bg->Height;
-		  for (int i = 0; i < n; ++i)
+		  long long m_Rav = 0, m_Gav = 0, m_Bav = 0;
+		  size_t n = static_cast<size_t>(bg->Width) * bg->Height;
+		  for (size_t i = 0; i < n; ++i)
 		  {
 		    m_Rav += *p++;
 		    m_Gav += *p++;
 		    m_Bav += *p++;
 		  }
-		  m_Rav /= n;
-		  m_Gav /= n;
-		  m_Bav /= n;
+		  m_Rav /= static_cast<long long>(n);
+		  m_Gav /= static_cast<long long>(n);
+		  m_Bav /= static_cast<long long>(n);
 
 		  //填充查找表
 		  for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; ++i)
@@ -589,7 +589,7 @@ namespace MBL
 		  const T *lut_r = lut;
 		  const T *lut_g = lut + ImageDefTraits<T>::LengthOfLUT * ImageDefTraits<T>::LengthOfLUT;
 		  const T *lut_b = lut + ImageDefTraits<T>::LengthOfLUT * ImageDefTraits<T>::LengthOfLUT * 2;
-		  for (int i = 0, n = image->Width * image->Height; i < n; ++i)
+		  for (size_t i = 0, n = static_cast<size_t>(image->Width) * image->Height; i < n; ++i)
 		  {
 		    *p = lut_r[(*p) * ImageDefTraits<T>::LengthOfLUT + (*pbg)]; ++p; ++pbg;
 		    *p = lut_g[(*p) * ImageDefTraits<T>::LengthOfLUT + (*pbg)]; ++p; ++pbg;
@@ -711,18 +711,18 @@ namespace MBL
 
       if (n > 1 && n <= level)
       {
-        int m = GetUnitsOfPixelData(image);
+        size_t m = GetUnitsOfPixelData(image);
         int t = 0;
         int j = 0;
-        for (i = 0; i < m; i++)
+        for (size_t k = 0; k < m; k++)
         {
           t = 0;
           for (j = 0; j < n; j++)
           {
-            t += recent[j]->Pixels[i];
+            t += recent[j]->Pixels[k];
           }
           t /= n;
-          image->Pixels[i] = MBL::Utility::Clamp(t, 0, 255);
+          image->Pixels[k] = MBL::Utility::Clamp(t, 0, 255);
         }
       }
     }
@@ -7,15 +7,29 @@
  * @brief 包含调整、改变图像色彩的函数。
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 #include <limits>
 #include <omp.h>
+#include <vector>
 
 namespace MBL
 {
   namespace Image2D
   {
+    // 把第y行的[left, right)变换为灰度。
+    template <class T>
+    void _GrayImageSpan(ImageDef<T> *image, int y, int left, int right)
+    {
+      T *p = GetRowPointer(image, y) + static_cast<size_t>(left) * 3;
+      for (int x = left; x < right; x++, p += 3)
+      {
+        const T v = static_cast<T>((299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000);
+        p[0] = p[1] = p[2] = v;
+      }
+    }
+
     /**
      * @brief 将一个真彩色图像变换为灰度图像。
      *
@@ -29,37 +43,45 @@ namespace MBL
       if (image == 0) throw NullPointerException();
       if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
 
-      T buf[3], v;
-      int left, top, right, bottom;
-      if (sub_area == 0)
-      {
-        left = 0;
-        top = 0;
-        right = image->Width;
-        bottom = image->Height;
-      }
-      else
-      {
-        left = sub_area->Left;
-        top = sub_area->Top;
-        right = sub_area->Left + sub_area->Width;
-        bottom = sub_area->Top + sub_area->Height;
-      }
+      ForEachSubAreaSpan(sub_area, image->Width, image->Height, [=](int y, int left, int right) { _GrayImageSpan(image, y, left, right); });
+    }
 
-      for (int y = top; y < bottom; y++)
-      {
-        for (int x = left; x < right; x++)
+    /**
+     * @brief 将真彩色图像中掩模选中的象素变换为灰度。
+     *
+     * @param image RGB格式源图像，处理后该图像仍然是真彩色格式，但选中象素的RGB分量均相等。
+     * @param mask 掩模，尺寸必须与图像相同。
+     */
+    template <class T>
+    void GrayImage(ImageDef<T> *image, const RunLengthMask &mask)
+    {
+      if (image == 0) throw NullPointerException();
+      if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
+      if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
+
+      mask.ForEachSpan([=](int y, int left, int right) { _GrayImageSpan(image, y, left, right); });
+    }
+
+    /// GrayImage2使用的RGB分量加权查找表，构造后只读。
+    template <class T>
+    class _GrayLUT
+    {
+      public:
+        T r_lut[ImageDefTraits<T>::LengthOfLUT];
+        T g_lut[ImageDefTraits<T>::LengthOfLUT];
+        T b_lut[ImageDefTraits<T>::LengthOfLUT];
+
+        /// 构造函数，建立查找表。
+        _GrayLUT()
         {
-          if (sub_area == 0 || sub_area->IsFill(x, y))
+          for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; ++i)
           {
-            ReadPixel(image, x, y, buf);
-            v = (299 * buf[0] + 587 * buf[1] + 114 * buf[2]) / 1000;
-            buf[0] = buf[1] = buf[2] = v;
-            WritePixel(image, x, y, buf);
+            r_lut[i] = 299 * i / 1000;
+            g_lut[i] = 587 * i / 1000;
+            b_lut[i] = 114 * i / 1000;
           }
         }
-      }
-    }
+    };
 
     /**
      * @brief 将一个真彩色图像变换为灰度图像。
@@ -75,30 +97,22 @@ namespace MBL
       if (image == 0) throw NullPointerException();
       if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
 
-      static T r_lut[ImageDefTraits<T>::LengthOfLUT];
-      static T g_lut[ImageDefTraits<T>::LengthOfLUT];
-      static T b_lut[ImageDefTraits<T>::LengthOfLUT];
-      static bool init = false;
-      if (!init)
-      {
-        for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; ++i)
-        {
-          r_lut[i] = 299 * i / 1000;
-          g_lut[i] = 587 * i / 1000;
-          b_lut[i] = 114 * i / 1000;
-        }
-        init = true;
-      }
+      // 局部静态对象的初始化是线程安全的，查找表建立后只读。
+      static const _GrayLUT<T> lut;
+      const T *r_lut = lut.r_lut, *g_lut = lut.g_lut, *b_lut = lut.b_lut;
 
       if (sub_area == 0)
       {
-        T *p = image->Pixels;
-        for (int i = 0, n = image->Width * image->Height; i < n; ++i)
+        for (int y = 0; y < image->Height; ++y)
         {
-          T t = r_lut[*p] + g_lut[*(p + 1)] + b_lut[*(p + 2)];
-          *p++ = t;
-          *p++ = t;
-          *p++ = t;
+          T *p = GetRowPointer(image, y);
+          for (int x = 0; x < image->Width; ++x)
+          {
+            T t = r_lut[*p] + g_lut[*(p + 1)] + b_lut[*(p + 2)];
+            *p++ = t;
+            *p++ = t;
+            *p++ = t;
+          }
         }
       }
       else
@@ -121,29 +135,36 @@ namespace MBL
 
       ImageDef<T> *nimage = ImageDef<T>::CreateInstance(IMAGE_FORMAT_INDEX, image->Width, image->Height, 0);
       
-      T *p = nimage->Pixels, *p1 = image->Pixels;
-      int cnt = image->Width * image->Height;
+      T *p = nimage->Pixels, *p1 = 0;
       
       int r, g, b;
       if (image->Format == IMAGE_FORMAT_RGB)
       {
-        for (int i = 0; i < cnt; ++i)
+        for (int y = 0; y < image->Height; ++y)
         {
-          r = *p1++;
-          g = *p1++;
-          b = *p1++;
-          *p++ = (299 * r + 587 * g + 114 * b) / 1000;
+          p1 = GetRowPointer(image, y);
+          for (int i = 0; i < image->Width; ++i)
+          {
+            r = *p1++;
+            g = *p1++;
+            b = *p1++;
+            *p++ = (299 * r + 587 * g + 114 * b) / 1000;
+          }
         }
       }
       else if (image->Format == IMAGE_FORMAT_ARGB)
       {
-        for (int i = 0; i < cnt; ++i)
+        for (int y = 0; y < image->Height; ++y)
         {
-          ++p1;
-          r = *p1++;
-          g = *p1++;
-          b = *p1++;
-          *p++ = (299 * r + 587 * g + 114 * b) / 1000;
+          p1 = GetRowPointer(image, y);
+          for (int i = 0; i < image->Width; ++i)
+          {
+            ++p1;
+            r = *p1++;
+            g = *p1++;
+            b = *p1++;
+            *p++ = (299 * r + 587 * g + 114 * b) / 1000;
+          }
         }
       }
 
@@ -218,6 +239,18 @@ namespace MBL
       return ret;
     }
 
+    // 把第y行的[left, right)变换为反色。
+    template <class T>
+    void _InvertImageSpan(ImageDef<T> *image, int y, int left, int right)
+    {
+      const size_t b = GetUnitsPerPixel(image);
+      T *p = GetRowPointer(image, y) + left * b;
+      for (size_t u = 0, n = (right - left) * b; u < n; u++)
+      {
+        p[u] = ImageDefTraits<T>::MaxValue - p[u];
+      }
+    }
+
     /**
      * @brief 将一个图像变换为反色图像。
      *
@@ -229,65 +262,73 @@ namespace MBL
     {
       if (image == 0) throw NullPointerException();
 
-      T buf[8];
-      int b = GetUnitsPerPixel(image);
+      ForEachSubAreaSpan(sub_area, image->Width, image->Height, [=](int y, int left, int right) { _InvertImageSpan(image, y, left, right); });
+    }
 
-      int left, top, right, bottom;
-      if (sub_area == 0)
-      {
-        left = 0;
-        top = 0;
-        right = image->Width;
-        bottom = image->Height;
-      }
-      else
-      {
-        left = sub_area->Left;
-        top = sub_area->Top;
-        right = sub_area->Left + sub_area->Width;
-        bottom = sub_area->Top + sub_area->Height;
-      }
+    /**
+     * @brief 将图像中掩模选中的象素变换为反色。
+     *
+     * @param image 源图像。
+     * @param mask 掩模，尺寸必须与图像相同。
+     */
+    template <class T>
+    void InvertImage(ImageDef<T> *image, const RunLengthMask &mask)
+    {
+      if (image == 0) throw NullPointerException();
+      if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
 
-      for (int y = top; y < bottom; y++)
+      mask.ForEachSpan([=](int y, int left, int right) { _InvertImageSpan(image, y, left, right); });
+    }
+
+    /**
+     * @brief 填充反色图像算法的查找表。
+     *
+     * @param lut 单个通道的查找表，长度为ImageDefTraits<T>::LengthOfLUT。
+     */
+    template <class T>
+    void FillInvertLUT(T *lut)
+    {
+      for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; ++i)
       {
-        for (int x = left; x < right; x++)
-        {
-          if (sub_area == 0 || sub_area->IsFill(x, y))
-          {
-            ReadPixel(image, x, y, buf);
-            for (int i = 0; i < b; i++)
-            {
-              buf[i] = ImageDefTraits<T>::MaxValue - buf[i];
-            }
-            WritePixel(image, x, y, buf);
-          }
-        }
+        lut[i] = ImageDefTraits<T>::MaxValue - i;
       }
     }
 
     /**
      * @brief 取得反色图像算法的查找表。
      *
-     * @return 查找表。由于反色算法各个通道是一致的，所以只返回单个通道的查找表。
+     * @return 查找表。由于反色算法各个通道是一致的，所以只返回单个通道的查找表。每个线程各有一份。
+     *
+     * @see FillInvertLUT
      */
     template <class T>
     const T * GetInvertLUT()
     {
-      static T lut[ImageDefTraits<T>::LengthOfLUT];
-      static bool init = false;
+      static thread_local T lut[ImageDefTraits<T>::LengthOfLUT];
+      static thread_local bool init = false;
 
       if (!init)
       {
-        for (int i = 0; i < ImageDefTraits<T>::LengthOfLUT; ++i)
-        {
-          lut[i] = ImageDefTraits<T>::MaxValue - i;
-        }
+        FillInvertLUT(lut);
         init = true;
       }
 
       return lut;
     }
 
+    // 调整第y行[left, right)的RGB颜色均衡。
+    template <class T>
+    void _AdjustImageRGBSpan(ImageDef<T> *image, int y, int left, int right, int r, int g, int b)
+    {
+      T *p = GetRowPointer(image, y) + static_cast<size_t>(left) * 3;
+      for (int x = left; x < right; x++, p += 3)
+      {
+        p[0] = MBL::Utility::Clamp(p[0] + p[0] * r / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
+        p[1] = MBL::Utility::Clamp(p[1] + p[1] * g / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
+        p[2] = MBL::Utility::Clamp(p[2] + p[2] * b / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
+      }
+    }
+
     /**
      * @brief 调整图像的RGB颜色均衡。
      *
@@ -303,37 +344,27 @@ namespace MBL
       if (image == 0) throw NullPointerException();
       if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
 
-      int left, top, right, bottom;
-      if (sub_area == 0)
-      {
-        left = 0;
-        top = 0;
-        right = image->Width;
-        bottom = image->Height;
-      }
-      else
-      {
-        left = sub_area->Left;
-        top = sub_area->Top;
-        right = sub_area->Left + sub_area->Width;
-        bottom = sub_area->Top + sub_area->Height;
-      }
+      ForEachSubAreaSpan(sub_area, image->Width, image->Height,
+                         [=](int y, int left, int right) { _AdjustImageRGBSpan(image, y, left, right, r, g, b); });
+    }
 
-      T buf[3];
-      for (int y = top; y < bottom; y++)
-      {
-        for (int x = left; x < right; x++)
-        {
-          if (sub_area == 0 || sub_area->IsFill(x, y))
-          {
-            ReadPixel(image, x, y, buf);
-            buf[0] = MBL::Utility::Clamp(buf[0] + buf[0] * r / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
-            buf[1] = MBL::Utility::Clamp(buf[1] + buf[1] * g / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
-            buf[2] = MBL::Utility::Clamp(buf[2] + buf[2] * b / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
-            WritePixel(image, x, y, buf);
-          }
-        }
-      }
+    /**
+     * @brief 调整图像中掩模选中部分的RGB颜色均衡。
+     *
+     * @param image 欲处理图像，必须是RGB格式。
+     * @param mask 掩模，尺寸必须与图像相同。
+     * @param r 红色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+     * @param g 绿色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+     * @param b 蓝色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+     */
+    template <class T>
+    void AdjustImageRGB(ImageDef<T> *image, const RunLengthMask &mask, int r, int g, int b)
+    {
+      if (image == 0) throw NullPointerException();
+      if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
+      if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
+
+      mask.ForEachSpan([=](int y, int left, int right) { _AdjustImageRGBSpan(image, y, left, right, r, g, b); });
     }
 
     /**
@@ -826,18 +857,16 @@ namespace MBL
     }
 
     /**
-     * @brief 取得对比度拉伸算法的查找表。
+     * @brief 填充对比度拉伸算法的查找表。
      *
      * @param contrast 对比度拉伸参数，在[-100, 100]区间，0表示不拉伸。
-     * @return 单个通道查找表。
+     * @param lut 单个通道的查找表，长度为ImageDefTraits<T>::LengthOfLUT。
      */
     template <class T>
-    const T * GetContrastLUT(int contrast)
+    void FillContrastLUT(int contrast, T *lut)
     {
       assert(-100 <= contrast && contrast <= 100);
 
-      static T lut[ImageDefTraits<T>::LengthOfLUT];
-
       int val = contrast * ImageDefTraits<T>::MidValueRoundDown / 100;
       if (val >= 0)
       {
@@ -870,7 +899,21 @@ namespace MBL
           lut[i] = MBL::Utility::GetMax(i - val, (int)ImageDefTraits<T>::MidValueRoundUp);
         }
       }
+    }
 
+    /**
+     * @brief 取得对比度拉伸算法的查找表。
+     *
+     * @param contrast 对比度拉伸参数，在[-100, 100]区间，0表示不拉伸。
+     * @return 单个通道查找表，每个线程各有一份。
+     *
+     * @see FillContrastLUT
+     */
+    template <class T>
+    const T * GetContrastLUT(int contrast)
+    {
+      static thread_local T lut[ImageDefTraits<T>::LengthOfLUT];
+      FillContrastLUT(contrast, lut);
       return lut;
     }
 
@@ -905,72 +948,110 @@ namespace MBL
       return lut;
     }
 
+    /// CorrectImageColor使用的色彩校正表。
     /**
-     * @brief 校正图像色彩。
+     * 校正表在构造时根据校正级别一次建立，之后不再改变，同一个对象可以在多个线程中同时使用。
+     *
+     * @see CorrectImageColor
+     */
+    class ColorCorrectionPlan
+    {
+      public:
+        /// 校正级别，为1～10。
+        int Level;
+        /// 各分量值的幂次表。
+        int Table[256];
+
+      public:
+        /**
+         * @brief 建立校正表。
+         *
+         * @param level 校正级别参数，为1～10。
+         */
+        explicit ColorCorrectionPlan(int level)
+          : Level(level)
+        {
+          if (level < 1 || level > 10) throw IllegalArgumentException();
+
+          double c1 = 0.15 * (level - 10) + 2.5;
+          for (int i = 0; i < 256; i++)
+          {
+            Table[i] = (int)pow((double)i, c1);
+          }
+        }
+    };
+
+    /**
+     * @brief 用预先建立的校正表校正图像色彩。
      *
      * @param image 欲处理图像，必须是RGB或BGR格式。
-     * @param level 校正级别参数，为1～10。
+     * @param plan 色彩校正表。
      *
      * @author 陈进
      */
     template <class T>
-    void CorrectImageColor(ImageDef<T> *image, int level)
+    void CorrectImageColor(ImageDef<T> *image, const ColorCorrectionPlan &plan)
     {
       if (image == 0 || (image->Format != IMAGE_FORMAT_RGB && image->Format != IMAGE_FORMAT_BGR)) throw UnsupportedFormatException();
-      if (level < 1 || level > 10) throw IllegalArgumentException();
 
       int itemp1;
-      int i,j;
+      size_t j;
       int f,f1,f2,f3;
       int s,s1,s2,s3;
+      const int *tab = plan.Table;
 
-      static double c1 = 0;
-      static int tab[256];
-      static int c = 0;
-
-      if (level != c)
+      size_t n = static_cast<size_t>(image->Width);
+      for (int y = 0; y < image->Height; y++)
       {
-        c = level;
-        c1 = 0.15*(c-10)+2.5;
-
-        for(i=0;i<256;i++)
+        T *lpBits = GetRowPointer(image, y);
+        for(size_t k=0;k<n;k++)
         {
-          tab[i] = (int)pow((double)i,c1);
+          j=k*3;
+          f1 = lpBits[j];
+          f2 = lpBits[j+1];
+          f3 = lpBits[j+2];
+          f = f1+f2+f3;
+          s1 = tab[f1];
+          s2 = tab[f2];
+          s3 = tab[f3];
+          s = s1+s2+s3;
+          if (s ==0) s =1;
+          itemp1 = (f*s1)/s;
+          if (itemp1 > 255)
+            lpBits[j] = 255;
+          else
+            lpBits[j] = itemp1;
+  
+          itemp1 = (f*s2)/s;
+          if (itemp1 > 255)
+            lpBits[j+1] = 255;
+          else
+            lpBits[j+1] = itemp1;
+  
+          itemp1 = (f*s3)/s;
+          if (itemp1 > 255)
+            lpBits[j+2] = 255;
+          else
+            lpBits[j+2] = itemp1;
         }
       }
+    }
 
-      int n = image->Width * image->Height;
-      T *lpBits = image->Pixels;
-      for(i=0;i<n;i++)
-      {
-        j=i*3;
-        f1 = lpBits[j];
-        f2 = lpBits[j+1];
-        f3 = lpBits[j+2];
-        f = f1+f2+f3;
-        s1 = tab[f1];
-        s2 = tab[f2];
-        s3 = tab[f3];
-        s = s1+s2+s3;
-        if (s ==0) s =1;
-        itemp1 = (f*s1)/s;
-        if (itemp1 > 255)
-          lpBits[j] = 255;
-        else
-          lpBits[j] = itemp1;
-
-        itemp1 = (f*s2)/s;
-        if (itemp1 > 255)
-          lpBits[j+1] = 255;
-        else
-          lpBits[j+1] = itemp1;
-
-        itemp1 = (f*s3)/s;
-        if (itemp1 > 255)
-          lpBits[j+2] = 255;
-        else
-          lpBits[j+2] = itemp1;
-      }
+    /**
+     * @brief 校正图像色彩。
+     *
+     * 该函数每次调用都会建立校正表，需要反复处理时请建立ColorCorrectionPlan对象。
+     *
+     * @param image 欲处理图像，必须是RGB或BGR格式。
+     * @param level 校正级别参数，为1～10。
+     *
+     * @author 陈进
+     */
+    template <class T>
+    void CorrectImageColor(ImageDef<T> *image, int level)
+    {
+      ColorCorrectionPlan plan(level);
+      CorrectImageColor(image, plan);
     }
 
     /**
@@ -1053,35 +1134,34 @@ namespace MBL
 	    T *p = nullptr;
       int r, g, b;
       int r1, g1, b1;
-	    const int n = image->Width * image->Height;
+      const int w = image->Width, h = image->Height;
       const int *pt = table; // Avoid parallel for cause another local storage of LUT.
 
-#pragma omp parallel for firstprivate(p) private(r, g, b, r1, g1, b1)
-      for (int i = 0; i < n; ++i)
+#pragma omp parallel for private(p, r, g, b, r1, g1, b1)
+      for (int y = 0; y < h; ++y)
       {
-        if (p == nullptr)
-        {
-          p = image->Pixels + i * 3;
-        }
-
-        r1 = *p;
-        g1 = *(p + 1);
-        b1 = *(p + 2);
-        r = (pt[t0 + r1] + pt[t1 + g1] + pt[t2 + b1]);
-        g = (pt[t3 + r1] + pt[t4 + g1] + pt[t5 + b1]);
-        b = (pt[t6 + r1] + pt[t7 + g1] + pt[t8 + b1]);
-        if (r < ImageDefTraits<T>::MinValue) r = ImageDefTraits<T>::MinValue;
-        if (g < ImageDefTraits<T>::MinValue) g = ImageDefTraits<T>::MinValue;
-        if (b < ImageDefTraits<T>::MinValue) b = ImageDefTraits<T>::MinValue;
-        r = r >> 10;
-        g = g >> 10;
-        b = b >> 10;
-        if (r > ImageDefTraits<T>::MaxValue) r = ImageDefTraits<T>::MaxValue;
-        if (g > ImageDefTraits<T>::MaxValue) g = ImageDefTraits<T>::MaxValue;
-        if (b > ImageDefTraits<T>::MaxValue) b = ImageDefTraits<T>::MaxValue;
-        *p++ = r;
-        *p++ = g;
-        *p++ = b;
+        p = GetRowPointer(image, y);
+        for (int x = 0; x < w; ++x)
+        {
+          r1 = *p;
+          g1 = *(p + 1);
+          b1 = *(p + 2);
+          r = (pt[t0 + r1] + pt[t1 + g1] + pt[t2 + b1]);
+          g = (pt[t3 + r1] + pt[t4 + g1] + pt[t5 + b1]);
+          b = (pt[t6 + r1] + pt[t7 + g1] + pt[t8 + b1]);
+          if (r < ImageDefTraits<T>::MinValue) r = ImageDefTraits<T>::MinValue;
+          if (g < ImageDefTraits<T>::MinValue) g = ImageDefTraits<T>::MinValue;
+          if (b < ImageDefTraits<T>::MinValue) b = ImageDefTraits<T>::MinValue;
+          r = r >> 10;
+          g = g >> 10;
+          b = b >> 10;
+          if (r > ImageDefTraits<T>::MaxValue) r = ImageDefTraits<T>::MaxValue;
+          if (g > ImageDefTraits<T>::MaxValue) g = ImageDefTraits<T>::MaxValue;
+          if (b > ImageDefTraits<T>::MaxValue) b = ImageDefTraits<T>::MaxValue;
+          *p++ = r;
+          *p++ = g;
+          *p++ = b;
+        }
       }
     }
 
@@ -1263,16 +1343,71 @@ namespace MBL
       assert(gray->Format == IMAGE_FORMAT_INDEX && (rgb->Format == IMAGE_FORMAT_RGB || rgb->Format == IMAGE_FORMAT_BGR));
       assert(gray->Width == rgb->Width && gray->Height == rgb->Height);
 
-      T *p0 = gray->Pixels;
-      T *p1 = gray->Pixels + gray->Width * gray->Height - 1;
-      T *p2 = rgb->Pixels + rgb->Width * rgb->Height * 3 - 1;
+      // 从最后一行的末尾向前处理，以支持灰度图像存储在彩色图像内存前部的情况。
+      for (int y = gray->Height - 1; y >= 0; --y)
+      {
+        T *p1 = GetRowPointer(gray, y) + gray->Width - 1;
+        T *p2 = GetRowPointer(rgb, y) + static_cast<size_t>(rgb->Width) * 3 - 1;
 
-      while (p1 >= p0)
+        for (int x = 0; x < gray->Width; ++x)
+        {
+          *p2-- = *p1;
+          *p2-- = *p1;
+          *p2-- = *p1--;
+        }
+      }
+    }
+
+    // 把浮点计算结果四舍五入并截断到[0, 255]，先舍入后截断与先截断后舍入的结果相同，而整数截断可以被编译器向量化。
+    inline int _RoundYUV(float v)
+    {
+      return std::min(std::max(static_cast<int>(v + 0.5f), 0), 255);
+    }
+
+    // 按BT.601把n个（不超过64）U-Y0-V-Y1排列的象素对转换为RGB或BGR。输入先全部读入局部数组再计算输出，共用缓冲内存时
+    // 写出的数据不会覆盖还没有读取的输入；各个循环之间没有依赖，可以被编译器向量化。G分量的色度部分
+    // 先舍入为整数，结果与以前查表的实现完全一致。
+    template <bool BGR, class T>
+    void _ConvertYUYV2RGBPairs(const T *in, T *out, int n)
+    {
+      const int block = 64;
+      const float f2 = (0.813f + 0.391f) * 127.0f;
+      float y0[block], y1[block], cb[block], cr[block];
+      for (int i = 0; i < n; i++)
       {
-        *p2-- = *p1;
-        *p2-- = *p1;
-        *p2-- = *p1--;
+        cb[i] = static_cast<float>(in[4 * i] - 128);
+        y0[i] = 1.164f * (in[4 * i + 1] - 16);
+        cr[i] = static_cast<float>(in[4 * i + 2] - 128);
+        y1[i] = 1.164f * (in[4 * i + 3] - 16);
       }
+
+      // 先按平面计算每个象素对的6个分量，再交错排列，两个循环都可以被向量化。
+      T planes[6][block];
+      for (int i = 0; i < n; i++)
+      {
+        const float r = 1.596f * cr[i], b = 2.018f * cb[i];
+        const float g = static_cast<float>(static_cast<int>(-0.813f * cr[i] - 0.391f * cb[i] + f2 + 0.5f)) - f2;
+        planes[0][i] = static_cast<T>(_RoundYUV(y0[i] + r));
+        planes[1][i] = static_cast<T>(_RoundYUV(y0[i] + g));
+        planes[2][i] = static_cast<T>(_RoundYUV(y0[i] + b));
+        planes[3][i] = static_cast<T>(_RoundYUV(y1[i] + r));
+        planes[4][i] = static_cast<T>(_RoundYUV(y1[i] + g));
+        planes[5][i] = static_cast<T>(_RoundYUV(y1[i] + b));
+      }
+
+      T rgb[6 * block];
+      const int ri = BGR ? 2 : 0, bi = BGR ? 0 : 2;
+      for (int i = 0; i < n; i++)
+      {
+        T *p = rgb + 6 * i;
+        p[ri] = planes[0][i];
+        p[1] = planes[1][i];
+        p[bi] = planes[2][i];
+        p[3 + ri] = planes[3][i];
+        p[4] = planes[4][i];
+        p[3 + bi] = planes[5][i];
+      }
+      memcpy(out, rgb, 6 * static_cast<size_t>(n) * sizeof(T));
     }
 
     /**
@@ -1287,6 +1422,8 @@ namespace MBL
      * 其中 16 < Y < 235，16 < Cb、Cr <240，  0 < = RGB < = 255。
      * </PRE>
      *
+     * 按上述公式逐点计算，不使用查找表，每64个象素对为一组，可以被编译器向量化。
+     *
      * @param yuv 输入YUV图像，目前只支持YUV422格式。
      * @param rgb 输出RGB/BGR图像，为RGB 8:8:8格式。
      *
@@ -1306,107 +1443,24 @@ namespace MBL
     {
       assert(yuv->Format == IMAGE_FORMAT_YUV422_PACKED);
 
-      int width = yuv->Width;
-      int height = yuv->Height;
-      T *pin = yuv->Pixels;
-      T *pout = rgb->Pixels;
-
-      int precalc_xy = 0, precalc_xy_raw = 0;
-	    int uc0, uc1, uc2, uc3, Ig;
-	    static bool flag = true;
-	    static int u308[256], u256[256];
-
-	    static unsigned char YCr2R[256 * 256];
-	    static unsigned char YCb2B[256 * 256];
-	    static short CrCb2Ig[256 * 256];
-	    static unsigned char YIg2G[256 * 308];
-
-      if (flag == true)
-  	  {
-        int m, n,row,row1;
-        float ft, f1, f2, f3;
-        float f164[256];
-
-    		for (m = 0; m < 256; m++)
-    			f164[m] = 1.164f * (m - 16);
-
-    		f2= (0.813f + 0.391f) * 127.0f;
-
-    		//建立YCr2R表, YCb2B表, CrCb2Ig表, YIg2G表
-    		for (m = 0; m < 256; m++)
-    		{
-    			u308[m]= m * 308;
-    			u256[m]= m * 256;
-
-    			row = m * 256;
-    			row1 = m * 308;
-    			f1 = f164[m];
-    			f3 = -0.813f * (m - 128);
-    			for (n = 0; n < 256; n++)
-    			{
-    				ft = f1 + 1.596f * (n - 128);
-    				if (ft < 0.0f ) ft = 0.0f;
-    				if (ft > 255.0f) ft = 255.0f;
-    				*(YCr2R + row + n) = (unsigned char)(ft+0.5f);// +0.5f 是避免向下取整的偏差
-
-    				ft = f1 + 2.018f * (n - 128);
-    				if (ft < 0.0f) ft = 0.0f;
-    				if (ft > 255.0f) ft = 255.0f;
-    				*(YCb2B + row + n) = (unsigned char)(ft+0.5f);
-
-    				ft = f3 - 0.391f * (n - 128) + f2;
-    				*(CrCb2Ig + row + n) = (short)(ft+0.5f); //*(CrCb2Ig+i) 的值范围为 0 到307.
-    			}
-
-    			for (n = 0; n < 308; n++)
-    			{
-    				ft = f1 + n - f2;
-    				if (ft < 0.0f)	ft = 0.0f;
-    				if (ft > 255.0f)	ft = 255.0f;
-    				*(YIg2G + row1 + n) = (unsigned char)(ft+0.5f);
-    			}
-    		}
-
-  		  flag = false;
-  	  }
-
-  	  //读取源图像并做转换
-      if (rgb->Format == IMAGE_FORMAT_RGB)
-      {
-        for (int i = 0, k = width * height / 2; i< k; i++)
-        {
-          uc0 = pin[precalc_xy_raw++];
-          uc1 = pin[precalc_xy_raw++];
-          uc2 = pin[precalc_xy_raw++];
-          uc3 = pin[precalc_xy_raw++];
-          Ig = *(CrCb2Ig + u256[uc2] + uc0);
-
-          pout[precalc_xy++] = *(YCr2R + u256[uc1] + uc2);
-          pout[precalc_xy++] = *(YIg2G+ u308[uc1] + Ig);
-          pout[precalc_xy++] = *(YCb2B + u256[uc1] + uc0);
+      const int block = 64;
+      const bool bgr = rgb->Format != IMAGE_FORMAT_RGB;
 
-          pout[precalc_xy++] = *(YCr2R + u256[uc3] + uc2);
-          pout[precalc_xy++] = *(YIg2G + u308[uc3] + Ig);
-          pout[precalc_xy++] = *(YCb2B + u256[uc3] + uc0);
-        }
-      }
-      else
+  	  //读取源图像并做转换，两幅图像都紧密排列时当作一整行处理，以保持共用缓冲内存时的处理顺序。
+      bool packed = IsPackedImage(yuv) && IsPackedImage(rgb);
+      int rows = packed ? 1 : yuv->Height;
+      size_t pairs = packed ? static_cast<size_t>(yuv->Width) * yuv->Height / 2 : static_cast<size_t>(yuv->Width) / 2;
+      for (int y = 0; y < rows; y++)
       {
-        for (int i = 0, k = width * height / 2; i< k; i++)
+        const T *pin = GetRowPointer(yuv, y);
+        T *pout = GetRowPointer(rgb, y);
+        for (size_t i = 0; i < pairs; i += block)
         {
-          uc0 = pin[precalc_xy_raw++];
-          uc1 = pin[precalc_xy_raw++];
-          uc2 = pin[precalc_xy_raw++];
-          uc3 = pin[precalc_xy_raw++];
-          Ig = *(CrCb2Ig + u256[uc2] + uc0);
-
-          pout[precalc_xy++] = *(YCb2B + u256[uc1] + uc0);
-          pout[precalc_xy++] = *(YIg2G+ u308[uc1] + Ig);
-          pout[precalc_xy++] = *(YCr2R + u256[uc1] + uc2);
-
-          pout[precalc_xy++] = *(YCb2B + u256[uc3] + uc0);
-          pout[precalc_xy++] = *(YIg2G + u308[uc3] + Ig);
-          pout[precalc_xy++] = *(YCr2R + u256[uc3] + uc2);
+          const int n = static_cast<int>(std::min(pairs - i, static_cast<size_t>(block)));
+          if (bgr)
+            _ConvertYUYV2RGBPairs<true>(pin + 4 * i, pout + 6 * i, n);
+          else
+            _ConvertYUYV2RGBPairs<false>(pin + 4 * i, pout + 6 * i, n);
         }
       }
     }
@@ -1425,44 +1479,133 @@ namespace MBL
      * Cr = V = (0.439 * R) - (0.368 * G) - (0.071 * B) + 128
      * Cb = U = -(0.148 * R) - (0.291 * G) + (0.439 * B) + 128
      *
-     * @param rgb RGB数据块,目前必须是BGR格式。
+     * @param rgb RGB数据块，必须是RGB或BGR格式。
      * @param yuv 输出YUV数据缓冲区，外部必须保证缓冲区的长度可以容纳转换后的数据长度。
      *
      * @author 栗远
      */
-	template <class T>
-	void ConvertImageRGB2YUV420(ImageDef<T> *rgb, ImageDef<T> *yuv)
-	{
-		assert(rgb->Format == IMAGE_FORMAT_BGR);
-		assert(yuv->Format == IMAGE_FORMAT_YUV420_PLANAR);
-		
-		T *RgbBuf = rgb->Pixels;
-		T *bufY = yuv->Pixels;
-		T *bufV = yuv->Pixels + rgb->Width * rgb->Height;
-		T *bufU = bufV + ((rgb->Width + 1) / 2) * (rgb->Height / 2);
-		T *bufRGB = RgbBuf;
-		T r, g, b;
-		
-		for (int j = 0; j < rgb->Height; j++)
-		{
-		bufRGB = RgbBuf + rgb->Width * j * 3;
-		for (int i = 0; i < rgb->Width; i++)
-		{
-		    b = *(bufRGB++);
-		    g = *(bufRGB++);
-		    r = *(bufRGB++);
-		    *(bufY++) = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
-		      
-		    if (i % 2 == 0)
-		    {
-		    if (j % 2 == 0)
-		        *(bufU++) = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
-		    else
-		        *(bufV++) = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
-		    }		
-		}
-		}
-	}
+    template <class T>
+    void ConvertImageRGB2YUV420(ImageDef<T> *rgb, ImageDef<T> *yuv)
+    {
+      assert(rgb->Format == IMAGE_FORMAT_BGR || rgb->Format == IMAGE_FORMAT_RGB);
+      assert(yuv->Format == IMAGE_FORMAT_YUV420_PLANAR);
+
+      const int width = rgb->Width, chroma_width = (width + 1) / 2;
+      const int ri = rgb->Format == IMAGE_FORMAT_BGR ? 2 : 0, bi = 2 - ri;
+      T *bufY = yuv->Pixels;
+      T *bufV = yuv->Pixels + static_cast<size_t>(width) * rgb->Height;
+      T *bufU = bufV + static_cast<size_t>(chroma_width) * (rgb->Height / 2);
+
+      for (int j = 0; j < rgb->Height; j++, bufY += width)
+      {
+        const T *p = GetRowPointer(rgb, j);
+        for (int i = 0; i < width; i++)
+        {
+          const int r = p[3 * i + ri], g = p[3 * i + 1], b = p[3 * i + bi];
+          bufY[i] = static_cast<T>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+
+        // 色度每隔一个象素采样一次，偶数行采样U，奇数行采样V。
+        if (j % 2 == 0)
+        {
+          for (int i = 0; i < chroma_width; i++)
+          {
+            const int r = p[6 * i + ri], g = p[6 * i + 1], b = p[6 * i + bi];
+            bufU[i] = static_cast<T>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+          }
+          bufU += chroma_width;
+        }
+        else
+        {
+          for (int i = 0; i < chroma_width; i++)
+          {
+            const int r = p[6 * i + ri], g = p[6 * i + 1], b = p[6 * i + bi];
+            bufV[i] = static_cast<T>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+          }
+          bufV += chroma_width;
+        }
+      }
+    }
+
+    // 把一行RGB（BGR为true时是BGR）象素转换为YCbCr，cb、cr为0时不输出。每64个象素先拆分到各分量的数组中，三个分量
+    // 的计算都是连续访问，可以被编译器向量化。
+    template <bool BGR, class T>
+    void _ConvertRGB2YCbCrRow(const T *p, T *py, T *pb, T *pr, int width)
+    {
+      const int block = 64;
+      const int ri = BGR ? 2 : 0, bi = BGR ? 0 : 2;
+      int r[block], g[block], b[block];
+      for (int x = 0; x < width; x += block, p += 3 * block)
+      {
+        const int n = MBL::Utility::GetMin(block, width - x);
+        for (int i = 0; i < n; i++)
+        {
+          r[i] = p[3 * i + ri];
+          g[i] = p[3 * i + 1];
+          b[i] = p[3 * i + bi];
+        }
+        for (int i = 0; i < n; i++)
+        {
+          py[x + i] = static_cast<T>((9798 * r[i] + 19235 * g[i] + 3736 * b[i] + 16384) >> 15);
+        }
+        if (pb != 0)
+        {
+          for (int i = 0; i < n; i++)
+          {
+            pb[x + i] = static_cast<T>(std::min((-5529 * r[i] - 10855 * g[i] + 16384 * b[i] + (128 << 15) + 16384) >> 15, 255));
+          }
+        }
+        if (pr != 0)
+        {
+          for (int i = 0; i < n; i++)
+          {
+            pr[x + i] = static_cast<T>(std::min((16384 * r[i] - 13720 * g[i] - 2664 * b[i] + (128 << 15) + 16384) >> 15, 255));
+          }
+        }
+      }
+    }
+
+    /**
+     * @brief 将RGB/BGR图像转换为全范围的YCbCr平面（JFIF，即JPEG使用的BT.601变换）。
+     *
+     * <PRE>
+     * Y  =  0.299 R + 0.587 G + 0.114 B
+     * Cb = -0.1687 R - 0.3313 G + 0.5 B + 128
+     * Cr =  0.5 R - 0.4187 G - 0.0813 B + 128
+     * </PRE>
+     *
+     * 系数按15位定点整数计算，不使用查找表，乘法可以用16位整数的向量指令完成。各行之间没有依赖，在多个线程上同时处理。
+     *
+     * @param rgb 输入图像，必须是8位RGB或BGR格式。
+     * @param y 输出亮度平面，必须是与rgb尺寸相同的索引图像。
+     * @param cb 输出蓝色色度平面，必须是与rgb尺寸相同的索引图像，为0表示不输出。
+     * @param cr 输出红色色度平面，必须是与rgb尺寸相同的索引图像，为0表示不输出。
+     */
+    template <class T>
+    void ConvertImageRGB2YCbCr(const ImageDef<T> *rgb, ImageDef<T> *y, ImageDef<T> *cb = 0, ImageDef<T> *cr = 0)
+    {
+      if (rgb == 0 || y == 0) throw NullPointerException();
+      if (sizeof(T) != 1 || (rgb->Format != IMAGE_FORMAT_RGB && rgb->Format != IMAGE_FORMAT_BGR)) throw UnsupportedFormatException();
+      ImageDef<T> *planes[3] = { y, cb, cr };
+      for (int k = 0; k < 3; k++)
+      {
+        if (planes[k] == 0) continue;
+        if (planes[k]->Format != IMAGE_FORMAT_INDEX) throw UnsupportedFormatException();
+        if (planes[k]->Width != rgb->Width || planes[k]->Height != rgb->Height) throw UnmatchedImageException();
+      }
+
+      const int width = rgb->Width, height = rgb->Height;
+      const bool bgr = rgb->Format == IMAGE_FORMAT_BGR;
+
+      MBL::Utility::ParallelFor(0, height, [&](int j)
+      {
+        T *pb = cb != 0 ? GetRowPointer(cb, j) : 0, *pr = cr != 0 ? GetRowPointer(cr, j) : 0;
+        if (bgr)
+          _ConvertRGB2YCbCrRow<true>(GetRowPointer(rgb, j), GetRowPointer(y, j), pb, pr, width);
+        else
+          _ConvertRGB2YCbCrRow<false>(GetRowPointer(rgb, j), GetRowPointer(y, j), pb, pr, width);
+      });
+    }
 
     /**
      * @brief 计算一幅图像的平均亮度。
@@ -1493,15 +1636,18 @@ namespace MBL
           break;
       }
       // RGB 或 BGR 格式计算平均亮度。
-      T *ptr = image->Pixels;
-      long R = 0, G = 0, B = 0;
+      long long R = 0, G = 0, B = 0;
 
-      int n = image->Width * image->Height;
-      for (int i = 0; i < n; i++)
+      size_t n = static_cast<size_t>(image->Width) * image->Height;
+      for (int y = 0; y < image->Height; y++)
       {
-        R += *(ptr++);
-        G += *(ptr++);
-        B += *(ptr++);
+        T *ptr = GetRowPointer(image, y);
+        for (int x = 0; x < image->Width; x++)
+        {
+          R += *(ptr++);
+          G += *(ptr++);
+          B += *(ptr++);
+        }
       }
 
       R /= n;
@@ -1622,58 +1768,71 @@ namespace MBL
     void ApplyImageLUT(ImageDef<T> *img, const T *r_lut, const T *g_lut = 0, const T *b_lut = 0)
     {
       T *p = img->Pixels;
-      const int n = img->Width * img->Height;
+      const int w = img->Width, h = img->Height;
 
       switch (img->Format)
       {
         case IMAGE_FORMAT_RGB:
-          p = nullptr;
-#pragma omp parallel for firstprivate(p)
-          for (int i = 0; i < n; ++i)
+#pragma omp parallel for private(p)
+          for (int y = 0; y < h; ++y)
           {
-            if (p == nullptr)
+            p = GetRowPointer(img, y);
+            for (int x = 0; x < w; ++x)
             {
-              p = img->Pixels + i * 3;
+              *p = r_lut[*p]; ++p;
+              *p = g_lut[*p]; ++p;
+              *p = b_lut[*p]; ++p;
             }
-            *p = r_lut[*p]; ++p;
-            *p = g_lut[*p]; ++p;
-            *p = b_lut[*p]; ++p;
           }
           break;
         case IMAGE_FORMAT_BGR:
-          for (int i = 0; i < n; ++i)
+          for (int y = 0; y < h; ++y)
           {
-            *p = b_lut[*p]; ++p;
-            *p = g_lut[*p]; ++p;
-            *p = r_lut[*p]; ++p;
+            p = GetRowPointer(img, y);
+            for (int x = 0; x < w; ++x)
+            {
+              *p = b_lut[*p]; ++p;
+              *p = g_lut[*p]; ++p;
+              *p = r_lut[*p]; ++p;
+            }
           }
           break;
         case IMAGE_FORMAT_RGBA:
-          for (int i = 0; i < n; ++i)
+          for (int y = 0; y < h; ++y)
           {
-            *p = r_lut[*p]; ++p;
-            *p = g_lut[*p]; ++p;
-            *p = b_lut[*p]; ++p;
-            p++;
+            p = GetRowPointer(img, y);
+            for (int x = 0; x < w; ++x)
+            {
+              *p = r_lut[*p]; ++p;
+              *p = g_lut[*p]; ++p;
+              *p = b_lut[*p]; ++p;
+              p++;
+            }
           }
           break;
         case IMAGE_FORMAT_ARGB:
-          for (int i = 0; i < n; ++i)
+          for (int y = 0; y < h; ++y)
           {
-            p++;
-            *p = r_lut[*p]; ++p;
-            *p = g_lut[*p]; ++p;
-            *p = b_lut[*p]; ++p;
+            p = GetRowPointer(img, y);
+            for (int x = 0; x < w; ++x)
+            {
+              p++;
+              *p = r_lut[*p]; ++p;
+              *p = g_lut[*p]; ++p;
+              *p = b_lut[*p]; ++p;
+            }
           }
           break;
         case IMAGE_FORMAT_BAYER_GR_BG:
           for (int y = 0, x_end = img->Width / 2,  y_end = img->Height / 2; y < y_end; ++y)
           {
+            p = GetRowPointer(img, 2 * y);
             for(int x = 0; x < x_end; ++x)
             {
               *p = g_lut[*p]; ++p;
               *p = r_lut[*p]; ++p;
             }
+            p = GetRowPointer(img, 2 * y + 1);
             for(int x = 0; x < x_end; ++x)
             {
               *p = b_lut[*p]; ++p;
@@ -1684,11 +1843,13 @@ namespace MBL
         case IMAGE_FORMAT_BAYER_BG_GR:
           for (int y = 0, x_end = img->Width / 2,  y_end = img->Height / 2; y < y_end; ++y)
           {
+            p = GetRowPointer(img, 2 * y);
             for(int x = 0; x < x_end; ++x)
             {
               *p = b_lut[*p]; ++p;
               *p = g_lut[*p]; ++p;
             }
+            p = GetRowPointer(img, 2 * y + 1);
             for(int x = 0; x < x_end; ++x)
             {
               *p = g_lut[*p]; ++p;
@@ -1699,11 +1860,13 @@ namespace MBL
         case IMAGE_FORMAT_BAYER_GB_RG:
           for (int y = 0, x_end = img->Width / 2,  y_end = img->Height / 2; y < y_end; ++y)
           {
+            p = GetRowPointer(img, 2 * y);
             for(int x = 0; x < x_end; ++x)
             {
               *p = g_lut[*p]; ++p;
               *p = b_lut[*p]; ++p;
             }
+            p = GetRowPointer(img, 2 * y + 1);
             for(int x = 0; x < x_end; ++x)
             {
               *p = r_lut[*p]; ++p;
@@ -1714,11 +1877,13 @@ namespace MBL
         case IMAGE_FORMAT_BAYER_RG_GB:
           for (int y = 0, x_end = img->Width / 2,  y_end = img->Height / 2; y < y_end; ++y)
           {
+            p = GetRowPointer(img, 2 * y);
             for(int x = 0; x < x_end; ++x)
             {
               *p = r_lut[*p]; ++p;
               *p = g_lut[*p]; ++p;
             }
+            p = GetRowPointer(img, 2 * y + 1);
             for(int x = 0; x < x_end; ++x)
             {
               *p = g_lut[*p]; ++p;
@@ -1754,6 +1919,357 @@ namespace MBL
             dst_b[i] = src_b2[src_b[i]];
         }
     }
+
+    // 用各通道的查找表映射第y行[left, right)的象素，luts按图像中分量的顺序排列，为0的分量（如Alpha）保持不变。
+    template <class T>
+    void _ApplyImageLUTSpan(ImageDef<T> *image, int y, int left, int right, const T * const *luts)
+    {
+      const int m = GetUnitsPerPixel(image);
+      T *p = GetRowPointer(image, y) + static_cast<size_t>(left) * m;
+      const int n = right - left;
+      if (m == 1)
+      {
+        const T *l0 = luts[0];
+        for (int x = 0; x < n; x++) p[x] = l0[p[x]];
+      }
+      else if (m == 3)
+      {
+        const T *l0 = luts[0], *l1 = luts[1], *l2 = luts[2];
+        for (int x = 0; x < n; x++, p += 3)
+        {
+          p[0] = l0[p[0]];
+          p[1] = l1[p[1]];
+          p[2] = l2[p[2]];
+        }
+      }
+      else
+      {
+        for (int x = 0; x < n; x++, p += m)
+        {
+          for (int c = 0; c < m; c++)
+          {
+            if (luts[c] != 0) p[c] = luts[c][p[c]];
+          }
+        }
+      }
+    }
+
+    /// 由多个逐点颜色调整合成的查找表流水线。
+    /**
+     * 增益、Gamma、对比度、反色、白平衡等调整都只改变每个分量自身的值，可以各自表示为一个查找表。逐个调用相应的函数时，
+     * 每个调整都要把整幅图像读写一遍；这个类把依次加入的调整在查找表上合成为每个颜色通道一个表（8位图像3×256个元素，
+     * 16位图像3×65536个元素），最后只需遍历图像一次。合成只在查找表上进行，与图像大小无关。
+     *
+     * 例如先做白平衡，再校正Gamma、拉伸对比度：
+     * @code
+     * ImageLUTPipeline<unsigned char> pipeline;
+     * pipeline.AddColorBalance(r_gain, g_gain, b_gain, 0, 0, 0);
+     * pipeline.AddGamma(60, 0);
+     * pipeline.AddContrast(20);
+     * pipeline.Apply(image, 0);
+     * @endcode
+     *
+     * 亮度对比度调整（AdjustImageBrightContrast）依赖于每个象素的亮度和全图的平均亮度，不能表示为查找表，不在其中。
+     *
+     * @see ApplyImageLUT
+     * @see CombineImageLUT
+     */
+    template <class T>
+    class ImageLUTPipeline
+    {
+      public:
+        /// 每个通道查找表的长度。
+        static const int Length = ImageDefTraits<T>::LengthOfLUT;
+
+      private:
+        std::vector<T> m_LUT[3];   // 按红色、绿色、蓝色通道顺序排列。
+        bool m_Identity;
+
+      public:
+        /// 构造函数，初始时不做任何调整。
+        ImageLUTPipeline()
+        {
+          Reset();
+        }
+
+        /// 清除已经加入的所有调整。
+        void Reset()
+        {
+          for (int c = 0; c < 3; c++)
+          {
+            m_LUT[c].resize(Length);
+            for (int i = 0; i < Length; i++) m_LUT[c][i] = static_cast<T>(i);
+          }
+          m_Identity = true;
+        }
+
+        /**
+         * @brief 判断流水线是否不做任何调整。
+         *
+         * @return 返回true表示还没有加入调整，Apply不会改变图像。
+         */
+        bool IsIdentity() const
+        {
+          return m_Identity;
+        }
+
+        /**
+         * @brief 取得合成后的查找表。
+         *
+         * @param channel 通道，0、1、2分别为红色、绿色、蓝色，索引图像使用红色通道。
+         * @return 该通道的查找表。
+         */
+        const T * GetLUT(int channel) const
+        {
+          if (channel < 0 || channel > 2) throw IndexOutOfBoundsException();
+          return &m_LUT[channel][0];
+        }
+
+        /**
+         * @brief 在流水线末尾加入任意的查找表。
+         *
+         * @param r_lut 红色通道、或者单色索引通道的查找表。
+         * @param g_lut 绿色通道查找表，为0时与红色通道相同。
+         * @param b_lut 蓝色通道查找表，为0时与红色通道相同。
+         */
+        void AddLUT(const T *r_lut, const T *g_lut = 0, const T *b_lut = 0)
+        {
+          if (r_lut == 0) throw NullPointerException();
+
+          const T *luts[3] = { r_lut, g_lut != 0 ? g_lut : r_lut, b_lut != 0 ? b_lut : r_lut };
+          for (int c = 0; c < 3; c++)
+          {
+            T *lut = &m_LUT[c][0];
+            for (int i = 0; i < Length; i++) lut[i] = luts[c][lut[i]];
+          }
+          m_Identity = false;
+        }
+
+        /**
+         * @brief 加入颜色均衡调整，与ColorBalanceImage相同。
+         *
+         * 每个颜色通道的变换公式为：value = clamp(value * gain + offset, 0, max)。白平衡时把WhiteBalanceImage得到的增益
+         * 传入，偏移为0。
+         *
+         * @param r_gain 红色分量的增益。
+         * @param g_gain 绿色分量的增益。
+         * @param b_gain 蓝色分量的增益。
+         * @param r_offset 红色分量的偏移。
+         * @param g_offset 绿色分量的偏移。
+         * @param b_offset 蓝色分量的偏移。
+         *
+         * @see ColorBalanceImage
+         */
+        void AddColorBalance(float r_gain, float g_gain, float b_gain, int r_offset, int g_offset, int b_offset)
+        {
+          if (r_gain < 0 || g_gain < 0 || b_gain < 0) throw IllegalArgumentException();
+          if (r_gain == 1 && g_gain == 1 && b_gain == 1 && r_offset == 0 && g_offset == 0 && b_offset == 0) return;
+
+          const float gains[3] = { r_gain, g_gain, b_gain };
+          const int offsets[3] = { r_offset, g_offset, b_offset };
+          std::vector<T> stage(3 * Length);
+          for (int c = 0; c < 3; c++)
+          {
+            for (int i = 0; i < Length; i++)
+            {
+              stage[c * Length + i] = static_cast<T>(MBL::Utility::Clamp(i * gains[c] + offsets[c],
+                                                     ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue));
+            }
+          }
+          AddLUT(&stage[0], &stage[Length], &stage[2 * Length]);
+        }
+
+        /**
+         * @brief 加入RGB颜色均衡调整，与AdjustImageRGB相同。
+         *
+         * @param r 红色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+         * @param g 绿色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+         * @param b 蓝色分量调整值，为[-100, 100]区间，即增量占原值的百分比。
+         *
+         * @see AdjustImageRGB
+         */
+        void AddAdjustRGB(int r, int g, int b)
+        {
+          if (r == 0 && g == 0 && b == 0) return;
+
+          const int percents[3] = { r, g, b };
+          std::vector<T> stage(3 * Length);
+          for (int c = 0; c < 3; c++)
+          {
+            for (int i = 0; i < Length; i++)
+            {
+              stage[c * Length + i] = MBL::Utility::Clamp(i + i * percents[c] / 100, ImageDefTraits<T>::MinValue, ImageDefTraits<T>::MaxValue);
+            }
+          }
+          AddLUT(&stage[0], &stage[Length], &stage[2 * Length]);
+        }
+
+        /**
+         * @brief 加入Gamma校正，与CorrectImageGamma相同。
+         *
+         * @param gamma Gamma参数，为[0, 100]，50为无效果。
+         * @param shift Shift参数，为[0, 255]，0为无效果。
+         *
+         * @see CorrectImageGamma
+         */
+        void AddGamma(int gamma, int shift)
+        {
+          if (gamma < 0 || gamma > 100 || shift < 0 || shift > 255) throw IllegalArgumentException();
+          AddLUT(GetGammaLUT<T>(gamma, shift));
+        }
+
+        /**
+         * @brief 加入对比度拉伸。
+         *
+         * @param contrast 对比度拉伸参数，在[-100, 100]区间，0表示不拉伸。
+         *
+         * @see FillContrastLUT
+         */
+        void AddContrast(int contrast)
+        {
+          if (contrast < -100 || contrast > 100) throw IllegalArgumentException();
+          if (contrast == 0) return;
+
+          std::vector<T> stage(Length);
+          FillContrastLUT(contrast, &stage[0]);
+          AddLUT(&stage[0]);
+        }
+
+        /**
+         * @brief 加入对比度拉伸，把[min, max]线性拉伸到整个取值范围。
+         *
+         * @param min 最小亮度值。
+         * @param max 最大亮度值。
+         *
+         * @see GetContrastLUT
+         */
+        void AddContrast(T min, T max)
+        {
+          AddLUT(GetContrastLUT<T>(min, max));
+        }
+
+        /**
+         * @brief 加入反色，与InvertImage相同。
+         *
+         * @see InvertImage
+         */
+        void AddInvert()
+        {
+          std::vector<T> stage(Length);
+          FillInvertLUT(&stage[0]);
+          AddLUT(&stage[0]);
+        }
+
+        /**
+         * @brief 把合成后的查找表应用于图像，图像只被遍历一次。
+         *
+         * 图像按行在多个线程上同时处理。任意子区按行内连续段处理，不逐点判断。
+         *
+         * @param image 欲处理图像，可以是索引、RGB、BGR、RGBA、ARGB或带Alpha的索引格式，Alpha分量保持不变。
+         * @param sub_area 处理子区，为0表示全图。
+         */
+        void Apply(ImageDef<T> *image, ImageSubArea *sub_area) const
+        {
+          if (image == 0) throw NullPointerException();
+
+          const T *luts[4];
+          _GetChannelLUTs(image, luts);
+          if (m_Identity) return;
+
+          int left = 0, top = 0, right = image->Width, bottom = image->Height;
+          if (sub_area != 0)
+          {
+            left = MBL::Utility::GetMax(sub_area->Left, 0);
+            top = MBL::Utility::GetMax(sub_area->Top, 0);
+            right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+            bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+          }
+
+          if (sub_area != 0 && sub_area->Pixels != 0)
+          {
+            RunLengthMask mask(sub_area, image->Width, image->Height);
+            _Apply(image, &mask, luts, top, bottom, left, right);
+          }
+          else
+          {
+            _Apply(image, 0, luts, top, bottom, left, right);
+          }
+        }
+
+        /**
+         * @brief 把合成后的查找表应用于图像中掩模选中的象素。
+         *
+         * @param image 欲处理图像，可以是索引、RGB、BGR、RGBA、ARGB或带Alpha的索引格式，Alpha分量保持不变。
+         * @param mask 掩模，尺寸必须与图像相同。
+         */
+        void Apply(ImageDef<T> *image, const RunLengthMask &mask) const
+        {
+          if (image == 0) throw NullPointerException();
+          if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
+
+          const T *luts[4];
+          _GetChannelLUTs(image, luts);
+          if (m_Identity) return;
+
+          _Apply(image, &mask, luts, 0, image->Height, 0, image->Width);
+        }
+
+      private:
+        // 按图像中分量的顺序排列各通道的查找表，Alpha分量为0。
+        void _GetChannelLUTs(const ImageDef<T> *image, const T **luts) const
+        {
+          const T *r = &m_LUT[0][0], *g = &m_LUT[1][0], *b = &m_LUT[2][0];
+          luts[0] = luts[1] = luts[2] = luts[3] = 0;
+          switch (image->Format)
+          {
+            case IMAGE_FORMAT_INDEX:
+            case IMAGE_FORMAT_INDEX_ALPHA:
+              luts[0] = r;
+              break;
+            case IMAGE_FORMAT_RGB:
+            case IMAGE_FORMAT_RGBA:
+              luts[0] = r;
+              luts[1] = g;
+              luts[2] = b;
+              break;
+            case IMAGE_FORMAT_BGR:
+              luts[0] = b;
+              luts[1] = g;
+              luts[2] = r;
+              break;
+            case IMAGE_FORMAT_ARGB:
+              luts[1] = r;
+              luts[2] = g;
+              luts[3] = b;
+              break;
+            default:
+              throw UnsupportedFormatException();
+          }
+        }
+
+        // 并行处理[top, bottom)行中[left, right)列的象素，mask不为0时只处理掩模选中的段。
+        static void _Apply(ImageDef<T> *image, const RunLengthMask *mask, const T * const *luts, int top, int bottom, int left, int right)
+        {
+          if (right <= left) return;
+
+          MBL::Utility::ParallelFor(top, bottom, [&](int y)
+          {
+            if (mask == 0)
+            {
+              _ApplyImageLUTSpan(image, y, left, right, luts);
+              return;
+            }
+
+            int count;
+            const ImageSpan *spans = mask->GetRowSpans(y, &count);
+            for (int i = 0; i < count; i++)
+            {
+              const int l = MBL::Utility::GetMax(spans[i].Left, left), r = MBL::Utility::GetMin(spans[i].Right, right);
+              if (l < r) _ApplyImageLUTSpan(image, y, l, r, luts);
+            }
+          });
+        }
+    };
   }
 }
 
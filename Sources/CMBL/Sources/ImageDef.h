@@ -57,6 +57,10 @@ namespace MBL
         /// 图像数据格式。
         ImageFormat Format;
         /// 图像的宽度（象素）。
+        /**
+         * 宽度和高度本身用int表示已经足够，但它们的乘积（象素数、数据单元数）可能超过int的范围，计算偏移和数据量时请
+         * 先转换为size_t，或者使用GetUnitsPerRow等函数。
+         */
         int Width;
         /// 图像的高度（象素）。
         int Height;
@@ -73,6 +77,14 @@ namespace MBL
         ImageRGBQUAD *Palette;
         /// 实际图像数据指针，为模板类型。
         T *Pixels;
+        /// 相邻两行起始位置之间相隔的存储单元数（行跨度）。
+        /**
+         * 为0表示各行紧密排列，即行跨度等于Width × 每象素单元数，这是MBL库自己创建的图像的情况。指向父图像子区、libtiff
+         * 条带缓冲区或者按行对齐的外部缓冲区的图像视图，行跨度会大于每行的实际数据量。请用GetUnitsPerRow取得实际使用的行跨度。
+         *
+         * @see ImageView
+         */
+        size_t RowPitch;
 
       private:
         //该图像结构是否真正拥有数据缓冲区指针，是的话在对象析构时会自动删除该缓冲区。
@@ -91,6 +103,7 @@ namespace MBL
             UsedColor(0),
             Palette(0),
             Pixels(0),
+            RowPitch(0),
             OwnDataBuf(true)
         {
         }
@@ -121,6 +134,7 @@ namespace MBL
             UsedColor(0),
             Palette(0),
             Pixels(data),
+            RowPitch(0),
             OwnDataBuf(false)
         {
         }
@@ -171,35 +185,42 @@ namespace MBL
         {
           ImageDef<T> *image = new ImageDef<T>();
 
-          // 计算需要分配的调色板内存和图像数据内存。
-          int pal = 0, data = 0;
+          if (width < 0 || height < 0)
+          {
+            delete image;
+            throw IllegalArgumentException();
+          }
+
+          // 计算需要分配的调色板内存和图像数据内存。数据量用size_t计算，全切片图像的单层数据量会超过2G。
+          int pal = 0;
+          size_t data = 0, area = static_cast<size_t>(width) * static_cast<size_t>(height);
           switch (format)
           {
             case IMAGE_FORMAT_INDEX:
               pal = used_color;
-              data = width * height;
+              data = area;
               break;
             case IMAGE_FORMAT_RGB:
             case IMAGE_FORMAT_BGR:
               pal = 0;
-              data = 3 * width * height;
+              data = 3 * area;
               break;
             case IMAGE_FORMAT_RGBA:
             case IMAGE_FORMAT_ARGB:
               pal = 0;
-              data = 4 * width * height;
+              data = 4 * area;
               break;
             case IMAGE_FORMAT_INDEX_ALPHA:
               pal = used_color;
-              data = 2 * width * height;
+              data = 2 * area;
               break;
             case IMAGE_FORMAT_YUV422_PACKED:
               pal = 0;
-              data = 2 * width * height;
+              data = 2 * area;
               break;
             case IMAGE_FORMAT_YUV420_PLANAR:
               pal = 0;
-              data = width * height + (width + 1) / 2 * height;
+              data = area + static_cast<size_t>((width + 1) / 2) * static_cast<size_t>(height);
               break;
             default:
               delete image;
@@ -1,6 +1,10 @@
 ﻿#ifndef __IMAGEFILTER_H__
 #define __IMAGEFILTER_H__
 
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
 /**
  * @file
  *
@@ -11,83 +15,477 @@ namespace MBL
 {
   namespace Image2D
   {
+    /// 卷积滤波核。
     /**
-     * @brief 5×5自定义滤波。
+     * 卷积核的宽度和高度都是奇数，中心对准被处理的象素。滤波结果为卷积和除以除数后向下取整，再加上偏移量，最后截断到象素值
+     * 的范围内，图像边界以外的象素取最近的边界象素。
      *
-     * 该函数改写自许俊的IShop::UserFilter函数。
+     * 构造时会分析卷积核的结构，FilterImage据此选用最快的算法：
+     * - 所有系数都相同（均值滤波）时逐行维护积分图，每个象素的计算量与卷积核的尺寸无关；
+     * - 可以分解为一列整数与一行整数的乘积（如高斯平滑、Sobel算子）时，先做水平一维卷积再做垂直一维卷积；
+     * - 其他卷积核逐行累加二维卷积。
+     * 各种算法都用定点整数累加，结果完全相同。
      *
-     * @param image 源图像，处理后该图像会被更新。
-     * @param core 5×5卷积核。
-     * @param div 除数。
-     * @param bias 偏移量。
-     * @param sub_area 处理子区。
+     * @see FilterImage
      */
-    template <class T>
-    void CustomFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int core[5][5], int div, int bias)
+    class FilterKernel
     {
-      T max_T;
-      MBL::Utility::GetMaxValue(&max_T);
-      int b = GetUnitsPerPixel(image), rb = GetUnitsPerRow(image);
-      ImageDef<T> *nimage = DuplicateImage(image);
-      int x1 = 0, y1 = 0;
-      int core_v;
-      T *p;
+      public:
+        /// 卷积核宽度，必须是奇数。
+        int Width;
+        /// 卷积核高度，必须是奇数。
+        int Height;
+        /// 按行存放的卷积核系数。
+        std::vector<int> Coefficients;
+        /// 除数，不能为0。
+        int Divisor;
+        /// 偏移量。
+        int Bias;
+        /// 可分解时的列系数（共Height个），否则为空。
+        std::vector<int> Column;
+        /// 可分解时的行系数（共Width个），否则为空。
+        std::vector<int> Row;
 
-      int left, top, right, bottom;
-      if (sub_area == 0)
+      public:
+        /**
+         * @brief 构造任意尺寸的卷积核。
+         *
+         * @param width 卷积核宽度，必须是正奇数。
+         * @param height 卷积核高度，必须是正奇数。
+         * @param coefficients 按行存放的width×height个系数。
+         * @param div 除数。
+         * @param bias 偏移量。
+         */
+        FilterKernel(int width, int height, const int *coefficients, int div, int bias)
+          : Width(width),
+            Height(height),
+            Divisor(div),
+            Bias(bias)
+        {
+          if (coefficients == 0) throw NullPointerException();
+          if (width <= 0 || height <= 0 || width % 2 == 0 || height % 2 == 0 || div == 0) throw IllegalArgumentException();
+
+          Coefficients.assign(coefficients, coefficients + static_cast<size_t>(width) * height);
+          _Separate();
+        }
+
+        /**
+         * @brief 构造5×5卷积核。
+         *
+         * @param core 5×5卷积核。
+         * @param div 除数。
+         * @param bias 偏移量。
+         */
+        FilterKernel(int core[5][5], int div, int bias)
+          : Width(5),
+            Height(5),
+            Divisor(div),
+            Bias(bias)
+        {
+          if (core == 0) throw NullPointerException();
+          if (div == 0) throw IllegalArgumentException();
+
+          Coefficients.assign(&core[0][0], &core[0][0] + 25);
+          _Separate();
+        }
+
+        /**
+         * @brief 判断是否为均值滤波核，即所有系数都相同且不为0。
+         *
+         * @return 是均值滤波核时返回true。
+         */
+        bool IsBox() const
+        {
+          if (Coefficients[0] == 0) return false;
+          for (size_t i = 1; i < Coefficients.size(); i++)
+          {
+            if (Coefficients[i] != Coefficients[0]) return false;
+          }
+          return true;
+        }
+
+        /**
+         * @brief 判断卷积核是否可以分解为一列与一行的乘积。
+         *
+         * @return 可以分解时返回true，此时Column和Row中是分解的结果。
+         */
+        bool IsSeparable() const
+        {
+          return !Column.empty();
+        }
+
+        /**
+         * @brief 取得系数绝对值之和，用于估计卷积和的范围。
+         *
+         * @return 系数绝对值之和。
+         */
+        long long GetAbsoluteSum() const
+        {
+          long long s = 0;
+          for (size_t i = 0; i < Coefficients.size(); i++) s += Coefficients[i] < 0 ? -static_cast<long long>(Coefficients[i]) : Coefficients[i];
+          return s;
+        }
+
+      private:
+        // 把卷积核分解为整数列向量与整数行向量的乘积。以第一个非零行除以其各系数的最大公约数作为行向量，
+        // 若卷积核可以分解，这样得到的列向量一定也是整数。
+        void _Separate()
+        {
+          Column.clear();
+          Row.clear();
+
+          int r0 = -1;
+          for (int i = 0; i < Height && r0 < 0; i++)
+          {
+            for (int j = 0; j < Width; j++)
+            {
+              if (Coefficients[static_cast<size_t>(i) * Width + j] != 0)
+              {
+                r0 = i;
+                break;
+              }
+            }
+          }
+          if (r0 < 0) return;
+
+          const int *k0 = &Coefficients[static_cast<size_t>(r0) * Width];
+          int g = 0, j0 = -1;
+          for (int j = 0; j < Width; j++)
+          {
+            if (k0[j] != 0 && j0 < 0) j0 = j;
+            g = _GCD(g, k0[j] < 0 ? -k0[j] : k0[j]);
+          }
+          if (k0[j0] < 0) g = -g;
+
+          std::vector<int> row(Width), column(Height);
+          for (int j = 0; j < Width; j++) row[j] = k0[j] / g;
+          for (int i = 0; i < Height; i++)
+          {
+            const int *k = &Coefficients[static_cast<size_t>(i) * Width];
+            if (k[j0] % row[j0] != 0) return;
+            column[i] = k[j0] / row[j0];
+            for (int j = 0; j < Width; j++)
+            {
+              if (k[j] != column[i] * row[j]) return;
+            }
+          }
+
+          Column.swap(column);
+          Row.swap(row);
+        }
+
+        static int _GCD(int a, int b)
+        {
+          while (b != 0)
+          {
+            int t = a % b;
+            a = b;
+            b = t;
+          }
+          return a;
+        }
+    };
+
+    // 把源图像第y行从x0开始的n个象素读入out，行号和超出左右边界的象素都截断到图像内。
+    template <class A, class T>
+    void _LoadFilterRow(const ImageDef<T> *image, int y, int x0, int n, int m, A *out)
+    {
+      const T *p = GetRowPointer(image, MBL::Utility::Clamp(y, 0, image->Height - 1));
+      const int w = image->Width;
+      const int a = MBL::Utility::Clamp(-x0, 0, n);
+      const int b = MBL::Utility::Clamp(w - x0, a, n);
+
+      for (int j = 0; j < a; j++)
       {
-        left = 0;
-        top = 0;
-        right = image->Width;
-        bottom = image->Height;
+        for (int c = 0; c < m; c++) out[j * m + c] = p[c];
+      }
+      const T *q = p + static_cast<ptrdiff_t>(x0 + a) * m;
+      A *o = out + static_cast<size_t>(a) * m;
+      const size_t units = static_cast<size_t>(b - a) * m;
+      for (size_t u = 0; u < units; u++) o[u] = q[u];
+      for (int j = b; j < n; j++)
+      {
+        for (int c = 0; c < m; c++) out[j * m + c] = p[static_cast<size_t>(w - 1) * m + c];
+      }
+    }
+
+    // 把一行卷积和换算为象素值，写入dest第y行从left开始的n个象素，mask不为0时只写掩模选中的段。
+    template <class A, class T>
+    void _StoreFilterRow(ImageDef<T> *dest, const RunLengthMask *mask, int y, int left, int n, int m, const A *sum,
+                         const FilterKernel &kernel, A *out)
+    {
+      const A max_v = static_cast<A>(ImageDefTraits<T>::MaxValue);
+      const A bias = kernel.Bias;
+      const size_t units = static_cast<size_t>(n) * m;
+
+      if (kernel.Divisor > 0 && (kernel.Divisor & (kernel.Divisor - 1)) == 0)
+      {
+        int shift = 0;
+        while ((1 << shift) < kernel.Divisor) shift++;
+        for (size_t u = 0; u < units; u++) out[u] = std::min(std::max((sum[u] >> shift) + bias, static_cast<A>(0)), max_v);
       }
       else
       {
-        left = sub_area->Left;
-        top = sub_area->Top;
-        right = sub_area->Left + sub_area->Width;
-        bottom = sub_area->Top + sub_area->Height;
+        // 用倒数乘法代替除法。先加上k把商平移为正数，截断即为向下取整，倒数的舍入误差最多使商差1，再用余数校正。
+        const A sign = kernel.Divisor < 0 ? -1 : 1;
+        const A d = sign * kernel.Divisor;
+        const A k = static_cast<A>(kernel.GetAbsoluteSum() * ImageDefTraits<T>::MaxValue / d + 2);
+        const double inv = 1.0 / d;
+        for (size_t u = 0; u < units; u++)
+        {
+          const A s = sign * sum[u];
+          A q = static_cast<A>(s * inv + k) - k;
+          const A r = s - q * d;
+          q += static_cast<A>(r >= d) - static_cast<A>(r < 0);
+          out[u] = std::min(std::max(q + bias, static_cast<A>(0)), max_v);
+        }
       }
 
-      for (int y = top; y < bottom; y++)
+      T *p = GetRowPointer(dest, y) + static_cast<size_t>(left) * m;
+      if (mask == 0)
       {
-        for (int x = left; x < right; x++)
+        for (size_t u = 0; u < units; u++) p[u] = static_cast<T>(out[u]);
+        return;
+      }
+      int count;
+      const ImageSpan *spans = mask->GetRowSpans(y, &count);
+      for (int i = 0; i < count; i++)
+      {
+        const size_t u0 = static_cast<size_t>(MBL::Utility::Clamp(spans[i].Left - left, 0, n)) * m;
+        const size_t u1 = static_cast<size_t>(MBL::Utility::Clamp(spans[i].Right - left, 0, n)) * m;
+        for (size_t u = u0; u < u1; u++) p[u] = static_cast<T>(out[u]);
+      }
+    }
+
+    // 用累加类型A对[left, right)×[top, bottom)做卷积，行被分成若干条带在多个线程上处理。
+    template <class A, class T>
+    void _FilterRegion(const ImageDef<T> *image, ImageDef<T> *dest, const RunLengthMask *mask, const FilterKernel &kernel,
+                       int left, int top, int right, int bottom)
+    {
+      const int m = GetUnitsPerPixel(image);
+      const int n = right - left;
+      const int kw = kernel.Width, kh = kernel.Height;
+      const int rx = kw / 2, ry = kh / 2;
+      const size_t units = static_cast<size_t>(n) * m;
+      const size_t padded = static_cast<size_t>(n + kw - 1) * m;
+      const bool box = kernel.IsBox();
+      const bool separable = !box && kernel.IsSeparable();
+
+      const int strip = 64;
+      const int strips = (bottom - top + strip - 1) / strip;
+
+      MBL::Utility::ParallelFor(0, strips, [&](int s)
+      {
+        const int y0 = top + s * strip;
+        const int y1 = MBL::Utility::GetMin(y0 + strip, bottom);
+        std::vector<A> sum(padded), out(units), line(padded);
+
+        if (box)
         {
-          if (sub_area == 0 || sub_area->IsFill(x, y))
+          // 列和加上行内前缀和即为积分图的一行，方框内的和为前缀和之差。用无符号数运算，中间溢出不影响差值。
+          typedef typename std::make_unsigned<A>::type U;
+          std::vector<U> prefix(padded + m);
+          for (int i = -ry; i <= ry; i++)
           {
-            float total[8];
-            memset(total, 0, sizeof(total));
-
-            for (int dy = -2; dy < 3; dy++)
+            _LoadFilterRow(image, y0 + i, left - rx, n + kw - 1, m, &line[0]);
+            for (size_t u = 0; u < padded; u++) sum[u] += line[u];
+          }
+          for (int y = y0; y < y1; y++)
+          {
+            if (y > y0)
             {
-              y1 = MBL::Utility::Clamp(y + dy, 0, image->Height - 1);
-              for (int dx = -2; dx < 3; dx++)
-              {
-                x1 = MBL::Utility::Clamp(x + dx, 0, image->Width - 1);
-                core_v = core[dy + 2][dx + 2];
-                p = image->Pixels + y1 * rb + x1 * b;
-                for (int i = 0; i < b; i++)
-                {
-                  total[i] += core_v * p[i];
-                }
-              }
+              _LoadFilterRow(image, y - ry - 1, left - rx, n + kw - 1, m, &line[0]);
+              for (size_t u = 0; u < padded; u++) sum[u] -= line[u];
+              _LoadFilterRow(image, y + ry, left - rx, n + kw - 1, m, &line[0]);
+              for (size_t u = 0; u < padded; u++) sum[u] += line[u];
             }
+            for (size_t u = 0; u < padded; u++) prefix[u + m] = prefix[u] + static_cast<U>(sum[u]);
+            const U c = static_cast<U>(kernel.Coefficients[0]);
+            const size_t d = static_cast<size_t>(kw) * m;
+            for (size_t u = 0; u < units; u++) line[u] = static_cast<A>((prefix[u + d] - prefix[u]) * c);
+            _StoreFilterRow(dest, mask, y, left, n, m, &line[0], kernel, &out[0]);
+          }
+          return;
+        }
 
-            p = nimage->Pixels + y * rb + x * b;
-            for (int i = 0; i < b; i++)
+        // 环形缓冲区保存kh个源行（可分解时为水平卷积后的行）。
+        std::vector<A> ring(static_cast<size_t>(kh) * padded);
+        for (int y = y0 - ry; y < y1 + ry; y++)
+        {
+          A *r = &ring[static_cast<size_t>((y - y0 + ry) % kh) * padded];
+          if (separable)
+          {
+            _LoadFilterRow(image, y, left - rx, n + kw - 1, m, &line[0]);
+            std::fill(r, r + units, static_cast<A>(0));
+            for (int j = 0; j < kw; j++)
             {
-              total[i] /= div;
-              total[i] += bias;
-              total[i] = MBL::Utility::Clamp(total[i], (float)0, (float)max_T);
+              const A k = kernel.Row[j];
+              if (k == 0) continue;
+              const A *q = &line[static_cast<size_t>(j) * m];
+              for (size_t u = 0; u < units; u++) r[u] += k * q[u];
+            }
+          }
+          else
+          {
+            _LoadFilterRow(image, y, left - rx, n + kw - 1, m, r);
+          }
+          if (y < y0 + ry) continue;
 
-              p[i] = (T)total[i];
+          // 第y行已读入，可以计算输出行y - ry。
+          const int oy = y - ry;
+          std::fill(sum.begin(), sum.begin() + units, static_cast<A>(0));
+          for (int i = 0; i < kh; i++)
+          {
+            const A *q = &ring[static_cast<size_t>((oy + i - y0) % kh) * padded];
+            if (separable)
+            {
+              const A k = kernel.Column[i];
+              if (k == 0) continue;
+              for (size_t u = 0; u < units; u++) sum[u] += k * q[u];
+              continue;
+            }
+            for (int j = 0; j < kw; j++)
+            {
+              const A k = kernel.Coefficients[static_cast<size_t>(i) * kw + j];
+              if (k == 0) continue;
+              const A *qj = q + static_cast<size_t>(j) * m;
+              for (size_t u = 0; u < units; u++) sum[u] += k * qj[u];
             }
           }
+          _StoreFilterRow(dest, mask, oy, left, n, m, &sum[0], kernel, &out[0]);
         }
+      });
+    }
+
+    // 根据卷积和的范围选择累加类型。
+    template <class T>
+    void _FilterImage(const ImageDef<T> *image, ImageDef<T> *dest, const RunLengthMask *mask, const FilterKernel &kernel,
+                      int left, int top, int right, int bottom)
+    {
+      // 卷积和不会超出系数绝对值之和乘以最大象素值，据此决定能否用32位整数累加。
+      const double bound = static_cast<double>(kernel.GetAbsoluteSum()) * ImageDefTraits<T>::MaxValue;
+      if (bound < 2147483647.0)
+      {
+        _FilterRegion<int>(image, dest, mask, kernel, left, top, right, bottom);
       }
+      else
+      {
+        _FilterRegion<long long>(image, dest, mask, kernel, left, top, right, bottom);
+      }
+    }
 
-      CopyImage(image, nimage);
-      delete nimage;
+    /**
+     * @brief 卷积滤波，结果写入另一幅图像。
+     *
+     * 根据卷积核的结构自动选用积分图、可分解卷积或二维卷积，用定点整数累加，各行在多个线程上同时处理。
+     * 源图像不被修改，因此不需要复制图像。
+     *
+     * @param image 源图像，各分量必须交错存放。
+     * @param dest 目标图像，格式和尺寸必须与源图像相同，不能是源图像本身。子区外的象素保持不变。
+     * @param sub_area 处理子区，为0表示全图。
+     * @param kernel 卷积核。
+     *
+     * @exception UnmatchedImageException 目标图像与源图像的格式或者尺寸不同。
+     * @exception IllegalArgumentException 目标图像就是源图像。
+     *
+     * @see FilterKernel
+     */
+    template <class T>
+    void FilterImage(const ImageDef<T> *image, ImageDef<T> *dest, ImageSubArea *sub_area, const FilterKernel &kernel)
+    {
+      if (image == 0 || dest == 0) throw NullPointerException();
+      if (image->Format != dest->Format || image->Width != dest->Width || image->Height != dest->Height) throw UnmatchedImageException();
+      if (image->Pixels == dest->Pixels) throw IllegalArgumentException();
+
+      int left = 0, top = 0, right = image->Width, bottom = image->Height;
+      if (sub_area != 0)
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+      }
+      if (right <= left || bottom <= top) return;
+
+      // 任意子区先转换为行程编码，写回时整段复制。
+      if (sub_area != 0 && sub_area->Pixels != 0)
+      {
+        RunLengthMask mask(sub_area, image->Width, image->Height);
+        _FilterImage(image, dest, &mask, kernel, left, top, right, bottom);
+      }
+      else
+      {
+        _FilterImage(image, dest, static_cast<const RunLengthMask *>(0), kernel, left, top, right, bottom);
+      }
+    }
+
+    /**
+     * @brief 卷积滤波，只处理掩模选中的象素，结果写入另一幅图像。
+     *
+     * 只计算掩模外接矩形内的各行，每行的结果按掩模的段整段写入目标图像。
+     *
+     * @param image 源图像，各分量必须交错存放。
+     * @param dest 目标图像，格式和尺寸必须与源图像相同，不能是源图像本身。掩模外的象素保持不变。
+     * @param mask 掩模，尺寸必须与图像相同。
+     * @param kernel 卷积核。
+     *
+     * @see FilterImage
+     */
+    template <class T>
+    void FilterImage(const ImageDef<T> *image, ImageDef<T> *dest, const RunLengthMask &mask, const FilterKernel &kernel)
+    {
+      if (image == 0 || dest == 0) throw NullPointerException();
+      if (image->Format != dest->Format || image->Width != dest->Width || image->Height != dest->Height) throw UnmatchedImageException();
+      if (mask.Width != image->Width || mask.Height != image->Height) throw UnmatchedImageException();
+      if (image->Pixels == dest->Pixels) throw IllegalArgumentException();
+
+      int left, top, width, height;
+      mask.GetBounds(&left, &top, &width, &height);
+      if (width == 0) return;
+
+      _FilterImage(image, dest, &mask, kernel, left, top, left + width, top + height);
+    }
+
+    /**
+     * @brief 任意尺寸的自定义滤波。
+     *
+     * @param image 源图像，处理后该图像会被更新。
+     * @param sub_area 处理子区。
+     * @param kernel 卷积核。
+     *
+     * @see FilterImage
+     */
+    template <class T>
+    void CustomFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, const FilterKernel &kernel)
+    {
+      ImageDef<T> *src = DuplicateImage(image);
+      try
+      {
+        FilterImage(src, image, sub_area, kernel);
+      }
+      catch (...)
+      {
+        delete src;
+        throw;
+      }
+      delete src;
+    }
+
+    /**
+     * @brief 5×5自定义滤波。
+     *
+     * 该函数改写自许俊的IShop::UserFilter函数，现在由FilterImage完成，均值和可分解的卷积核会自动使用快速算法。
+     *
+     * @param image 源图像，处理后该图像会被更新。
+     * @param core 5×5卷积核。
+     * @param div 除数。
+     * @param bias 偏移量。
+     * @param sub_area 处理子区。
+     */
+    template <class T>
+    void CustomFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int core[5][5], int div, int bias)
+    {
+      CustomFilterImage(image, sub_area, FilterKernel(core, div, bias));
     }
 
     /**
@@ -152,6 +550,8 @@ namespace MBL
      * @param sub_area 子区，为0表示处理全图。
      * @param block 窗口块大小（象素）。
      * @param type true 表示取灰度最小值，即膨胀深色区域，false 表示取灰度最大值，即腐蚀深色区域。
+     *
+     * @see MorphologyImage
      */
     template <class T>
     void ErodeExpandImage(MBL::Image2D::ImageDef<T> *image, ImageSubArea *sub_area, int block, bool type)
@@ -222,12 +622,382 @@ namespace MBL
       delete nimage;
     }
 
+    /**
+     * 形态学运算的种类。
+     */
+    typedef enum
+    {
+      MORPHOLOGY_ERODE,  /**< 腐蚀，取结构元素覆盖范围内的最小值。 */
+      MORPHOLOGY_DILATE, /**< 膨胀，取结构元素覆盖范围内的最大值。 */
+      MORPHOLOGY_OPEN,   /**< 开运算，先腐蚀再膨胀，去除比结构元素小的亮点。 */
+      MORPHOLOGY_CLOSE   /**< 闭运算，先膨胀再腐蚀，填充比结构元素小的暗洞。 */
+    } MorphologyOperation;
+
+    /**
+     * 形态学运算比较象素的方式。
+     */
+    typedef enum
+    {
+      MORPHOLOGY_CHANNEL,  /**< 各分量分别比较，适用于各种交错存放分量的图像格式。 */
+      MORPHOLOGY_LUMINANCE /**< 按象素灰度比较，输出整个象素的颜色。腐蚀和膨胀的结果与ErodeExpandImage相同。目前只处理RGB格式图像。 */
+    } MorphologyMode;
+
+    // 取两者中较小者或较大者的函数对象。
+    struct _SelectMin
+    {
+      template <class K>
+      K operator ()(K a, K b) const { return b < a ? b : a; }
+    };
+    struct _SelectMax
+    {
+      template <class K>
+      K operator ()(K a, K b) const { return a < b ? b : a; }
+    };
+
+    /**
+     * @brief van Herk/Gil-Werman滑动最小值或最大值。
+     *
+     * 对n个向量（每个向量有m个单元）逐单元计算长度为size的滑动窗口中的最值，第i个输出对应输入位置[i + offset, i + offset +
+     * size)，超出[0, n)的位置不参与计算。输入按size个一组分块，每块计算前缀最值g和后缀最值h，任一窗口的结果都是一个h和一个g
+     * 的最值，因此每个单元只需3次比较，与窗口长度无关。向量可以是一行图像（计算纵向最值），也可以是一个象素（计算横向最值）。
+     *
+     * @param n 向量个数。
+     * @param m 每个向量的单元数。
+     * @param size 窗口长度。
+     * @param offset 窗口起点相对于输出位置的偏移，通常为-size / 2。
+     * @param select 取最值的函数对象。
+     * @param source 形如const K *source(int p)，返回第p个输入向量。
+     * @param sink 形如K *sink(int i)，返回第i个输出向量。
+     * @param g 工作缓冲区，会被调整为size * m个单元。
+     * @param h 工作缓冲区，会被调整为size * m个单元。
+     */
+    template <class K, class Select, class Source, class Sink>
+    void _VanHerkGilWerman(int n, int m, int size, int offset, Select select, Source source, Sink sink, std::vector<K> &g, std::vector<K> &h)
+    {
+      const int k = size;
+      g.resize(static_cast<size_t>(k) * m);
+      h.resize(static_cast<size_t>(k) * m);
+
+      // 扩展序列的第e项对应输入位置e + offset，共有n + k - 1项。
+      const int extended = n + k - 1;
+      auto input = [&](int e) -> const K * { int p = e + offset; return (e < extended && p >= 0 && p < n) ? source(p) : 0; };
+
+      // 计算一块的后缀最值，返回块内最后一个有效项的序号，整块为空时返回-1。块首的空项沿用后一项。
+      auto suffix = [&](int start) -> int
+      {
+        int last = -1;
+        for (int r = k - 1; r >= 0; r--)
+        {
+          K *d = &h[static_cast<size_t>(r) * m];
+          const K *s = input(start + r);
+          if (s == 0)
+          {
+            if (last >= 0) memcpy(d, d + m, m * sizeof(K));
+          }
+          else if (last < 0)
+          {
+            last = r;
+            memcpy(d, s, m * sizeof(K));
+          }
+          else
+          {
+            const K *e = d + m;
+            for (int u = 0; u < m; u++) d[u] = select(s[u], e[u]);
+          }
+        }
+        return last;
+      };
+
+      int h_last = suffix(0);
+      for (int j = 0; j * k < n; j++)
+      {
+        // 下一块的前缀最值，g_first是第一个有效项的序号，其后的空项沿用前一项。
+        const int next = (j + 1) * k;
+        int g_first = -1;
+        for (int r = 0; r < k - 1; r++)
+        {
+          K *d = &g[static_cast<size_t>(r) * m];
+          const K *s = input(next + r);
+          if (s == 0)
+          {
+            if (g_first >= 0) memcpy(d, d - m, m * sizeof(K));
+          }
+          else if (g_first < 0)
+          {
+            g_first = r;
+            memcpy(d, s, m * sizeof(K));
+          }
+          else
+          {
+            const K *e = d - m;
+            for (int u = 0; u < m; u++) d[u] = select(e[u], s[u]);
+          }
+        }
+
+        // 第i个输出的窗口是本块的第r项到末尾，加上下一块的开头到第r - 1项。
+        for (int r = 0; r < k; r++)
+        {
+          const int i = j * k + r;
+          if (i >= n) break;
+
+          K *out = sink(i);
+          const bool use_h = r <= h_last;
+          const bool use_g = g_first >= 0 && r - 1 >= g_first;
+          const K *a = &h[static_cast<size_t>(r) * m];
+          const K *b = use_g ? &g[static_cast<size_t>(r - 1) * m] : 0;
+          if (use_h && use_g)
+          {
+            for (int u = 0; u < m; u++) out[u] = select(a[u], b[u]);
+          }
+          else
+          {
+            memcpy(out, use_h ? a : b, m * sizeof(K));
+          }
+        }
+
+        h_last = suffix(next);
+      }
+    }
+
+    // 对一块键值缓冲区先横向、再纵向求最值，结果保存在src中。
+    template <class K, class Select>
+    void _MorphologyPass(std::vector<K> &src, std::vector<K> &dst, int width, int height, int m, int element_width, int element_height,
+                         Select select)
+    {
+      if (element_width > 1)
+      {
+        MBL::Utility::ParallelRun(height, [&](MBL::Utility::ParallelTasks &tasks)
+        {
+          std::vector<K> g, h;
+          int y;
+          while (tasks.Next(&y))
+          {
+            const K *row = &src[static_cast<size_t>(y) * width * m];
+            K *out = &dst[static_cast<size_t>(y) * width * m];
+            _VanHerkGilWerman<K>(width, m, element_width, -element_width / 2, select,
+                                 [=](int p) -> const K * { return row + static_cast<size_t>(p) * m; },
+                                 [=](int i) -> K * { return out + static_cast<size_t>(i) * m; }, g, h);
+          }
+        });
+        src.swap(dst);
+      }
+
+      if (element_height > 1)
+      {
+        // 纵向处理时以整行中的一段为一个向量，各段互不相关，可以并行处理，每段的工作缓冲区也不大。
+        const int units = width * m;
+        const int strip = 1024;
+        const int strips = (units + strip - 1) / strip;
+        K *s = &src[0], *d = &dst[0];
+
+        MBL::Utility::ParallelRun(strips, [&](MBL::Utility::ParallelTasks &tasks)
+        {
+          std::vector<K> g, h;
+          int t;
+          while (tasks.Next(&t))
+          {
+            const int u0 = t * strip;
+            _VanHerkGilWerman<K>(height, MBL::Utility::GetMin(strip, units - u0), element_height, -element_height / 2, select,
+                                 [=](int p) -> const K * { return s + static_cast<size_t>(p) * units + u0; },
+                                 [=](int i) -> K * { return d + static_cast<size_t>(i) * units + u0; }, g, h);
+          }
+        });
+        src.swap(dst);
+      }
+    }
+
+    // 形态学运算所处理的矩形，按灰度比较时用它从键值中的象素序号找回象素。
+    template <class T>
+    struct _MorphologyRegionInfo
+    {
+      const ImageDef<T> *Image;
+      int Left, Top, Width;
+
+      const T *GetPixel(size_t index) const
+      {
+        return GetRowPointer(Image, Top + static_cast<int>(index / Width)) + (Left + index % Width) * GetUnitsPerPixel(Image);
+      }
+    };
+
+    // 在包括边缘的矩形中做形态学运算，再把处理区域内的结果写回图像。encode(p, index, k)把矩形中第index个象素p编码为键值k，
+    // decode(k, p, out, region)把键值k解码为象素p的结果out。staged为true时decode可以读取矩形中的任意象素，结果先全部解码
+    // 再写回图像。
+    template <class K, class T, class Encode, class Decode>
+    void _MorphologyRegion(ImageDef<T> *image, ImageSubArea *sub_area, int left, int top, int right, int bottom, int halo, int m,
+                           MorphologyOperation operation, int element_width, int element_height, Encode encode, Decode decode,
+                           bool staged)
+    {
+      const int b = GetUnitsPerPixel(image);
+      const int cl = MBL::Utility::GetMax(left - halo, 0), ct = MBL::Utility::GetMax(top - halo, 0);
+      const int cr = MBL::Utility::GetMin(right + halo, image->Width), cb = MBL::Utility::GetMin(bottom + halo, image->Height);
+      const int w = cr - cl, h = cb - ct;
+      const _MorphologyRegionInfo<T> region = { image, cl, ct, w };
+
+      std::vector<K> src(static_cast<size_t>(w) * h * m), dst(src.size());
+      MBL::Utility::ParallelFor(0, h, [&](int y)
+      {
+        const T *p = GetRowPointer(image, ct + y) + static_cast<size_t>(cl) * b;
+        K *q = &src[static_cast<size_t>(y) * w * m];
+        for (int x = 0; x < w; x++)
+        {
+          encode(p + static_cast<size_t>(x) * b, static_cast<size_t>(y) * w + x, q + static_cast<size_t>(x) * m);
+        }
+      });
+
+      switch (operation)
+      {
+        case MORPHOLOGY_ERODE:
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMin());
+          break;
+        case MORPHOLOGY_DILATE:
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMax());
+          break;
+        case MORPHOLOGY_OPEN:
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMin());
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMax());
+          break;
+        case MORPHOLOGY_CLOSE:
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMax());
+          _MorphologyPass(src, dst, w, h, m, element_width, element_height, _SelectMin());
+          break;
+        default:
+          throw IllegalArgumentException();
+      }
+
+      const int ow = right - left;
+      std::vector<T> out(staged ? static_cast<size_t>(ow) * (bottom - top) * b : 0);
+
+      MBL::Utility::ParallelFor(top, bottom, [&](int y)
+      {
+        T *p = GetRowPointer(image, y);
+        const K *q = &src[static_cast<size_t>(y - ct) * w * m];
+        T *o = staged ? &out[static_cast<size_t>(y - top) * ow * b] : 0;
+        for (int x = left; x < right; x++)
+        {
+          if (sub_area == 0 || sub_area->IsFill(x, y))
+          {
+            T *r = staged ? o + static_cast<size_t>(x - left) * b : p + static_cast<size_t>(x) * b;
+            decode(q + static_cast<size_t>(x - cl) * m, p + static_cast<size_t>(x) * b, r, region);
+          }
+        }
+      });
+
+      if (staged)
+      {
+        MBL::Utility::ParallelFor(top, bottom, [&](int y)
+        {
+          T *p = GetRowPointer(image, y);
+          const T *o = &out[static_cast<size_t>(y - top) * ow * b];
+          for (int x = left; x < right; x++)
+          {
+            if (sub_area == 0 || sub_area->IsFill(x, y))
+            {
+              memcpy(p + static_cast<size_t>(x) * b, o + static_cast<size_t>(x - left) * b, b * sizeof(T));
+            }
+          }
+        });
+      }
+    }
+
+    /**
+     * @brief 用van Herk/Gil-Werman算法做形态学运算。
+     *
+     * 矩形结构元素可以分解为一条横线和一条竖线，先横向、再纵向求滑动最值即可。每个方向上的滑动最值用van Herk/Gil-Werman
+     * 算法计算，每个象素的计算量是常数，与结构元素的大小无关，因此15～31象素的大结构元素也很快。8bit图像按分量比较时，
+     * 最值运算在连续的单元上进行，编译器可以生成SIMD指令。超出图像的部分不参与计算，与坐标截断到边上的结果相同。
+     *
+     * 结构元素的宽度或高度为1时就是竖线或横线结构元素。结构元素在当前象素上的位置与ErodeExpandImage相同，即覆盖
+     * [-size / 2, size - size / 2)。
+     *
+     * @param image 欲处理的图像，处理后该图像会被更新。适用于8bit和16bit图像。
+     * @param sub_area 子区，为0表示处理全图。
+     * @param operation 运算种类。
+     * @param element_width 矩形结构元素的宽度（象素）。
+     * @param element_height 矩形结构元素的高度（象素）。
+     * @param mode 比较象素的方式。
+     *
+     * @see ErodeExpandImage
+     */
+    template <class T>
+    void MorphologyImage(ImageDef<T> *image, ImageSubArea *sub_area, MorphologyOperation operation, int element_width, int element_height,
+                         MorphologyMode mode = MORPHOLOGY_CHANNEL)
+    {
+      if (image == 0) throw NullPointerException();
+      if (element_width <= 0 || element_height <= 0) throw IllegalArgumentException();
+      switch (image->Format)
+      {
+        case IMAGE_FORMAT_RGB:
+          break;
+        case IMAGE_FORMAT_INDEX:
+        case IMAGE_FORMAT_BGR:
+        case IMAGE_FORMAT_RGBA:
+        case IMAGE_FORMAT_ARGB:
+        case IMAGE_FORMAT_INDEX_ALPHA:
+          if (mode != MORPHOLOGY_CHANNEL) throw UnsupportedFormatException();
+          break;
+        default:
+          throw UnsupportedFormatException();
+      }
+
+      int left = 0, top = 0, right = image->Width, bottom = image->Height;
+      if (sub_area != 0)
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+      }
+      if (right <= left || bottom <= top) return;
+
+      // 开、闭运算要做两次，边缘要够两次运算使用。
+      const int passes = (operation == MORPHOLOGY_OPEN || operation == MORPHOLOGY_CLOSE) ? 2 : 1;
+      const int halo = passes * MBL::Utility::GetMax(element_width, element_height);
+
+      if (mode == MORPHOLOGY_CHANNEL)
+      {
+        const int b = GetUnitsPerPixel(image);
+        _MorphologyRegion<T>(image, sub_area, left, top, right, bottom, halo, b, operation, element_width, element_height,
+                             [=](const T *p, size_t, T *k) { for (int c = 0; c < b; c++) k[c] = p[c]; },
+                             [=](const T *k, const T *, T *out, const _MorphologyRegionInfo<T> &) { for (int c = 0; c < b; c++) out[c] = k[c]; },
+                             false);
+      }
+      else
+      {
+        // 键值的高位是灰度，低位是象素在矩形中按行排列的序号。灰度相同时取序号最小的象素，即ErodeExpandImage按行扫描窗口
+        // 时遇到的第一个象素。先取最大值的运算把序号反过来存放，最大的键值也就是序号最小的象素。
+        typedef unsigned long long K;
+        const int bits = 64 - sizeof(T) * 8;
+        const K last = (static_cast<K>(1) << bits) - 1;
+        const bool reverse = operation == MORPHOLOGY_DILATE || operation == MORPHOLOGY_CLOSE;
+        _MorphologyRegion<K>(image, sub_area, left, top, right, bottom, halo, 1, operation, element_width, element_height,
+                             [=](const T *p, size_t index, K *k)
+                             {
+                               const K gray = (299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000;
+                               *k = (gray << bits) | (reverse ? last - index : index);
+                             },
+                             [=](const K *k, const T *p, T *out, const _MorphologyRegionInfo<T> &region)
+                             {
+                               // ErodeExpandImage取最大值时，窗口中的灰度都是0则保留原象素。
+                               const K index = reverse ? last - (*k & last) : (*k & last);
+                               const T *q = (operation == MORPHOLOGY_DILATE && (*k >> bits) == 0) ? p : region.GetPixel(index);
+                               out[0] = q[0];
+                               out[1] = q[1];
+                               out[2] = q[2];
+                             },
+                             true);
+      }
+    }
+
     /**
      * @brief 取窗口中灰度值中间值象素填充当前象素，可以起到平滑去噪的作用。
      *
+     * 该函数对每个象素都排序整个窗口，速度很慢，只作为MedianFilterImage的参考实现保留。
+     *
      * @param image 欲处理的图像。目前只处理RGB格式图像。
      * @param sub_area 子区，为0表示处理全图。
      * @param block 窗口块大小（象素）。
+     *
+     * @see MedianFilterImage
      */
     template <class T>
     void MiddleValueFilterImage(MBL::Image2D::ImageDef<T> *image, ImageSubArea *sub_area, int block)
@@ -300,97 +1070,346 @@ namespace MBL
     }
 
     /**
-     * @brief 对图像进行平滑或锐化处理。
+     * 中值滤波的模式。
+     */
+    typedef enum
+    {
+      MEDIAN_FILTER_CHANNEL,   /**< 各分量分别取中值，适用于各种交错存放分量的图像格式。 */
+      MEDIAN_FILTER_LUMINANCE  /**< 按象素灰度取中值，输出窗口中一个灰度等于中值的象素的颜色。目前只处理RGB格式图像。 */
+    } MedianFilterMode;
+
+    // 中值滤波使用的滑动直方图。
+    //
+    // 直方图分为细、粗两级，粗直方图的每一格是2^Shift个细格的和。中值位置随窗口的滑动逐格移动，遇到整段为空或整段都在中值
+    // 一侧的粗格时一次跳过，因此16bit图像也不需要逐个扫描65536个细格。
+    template <class T>
+    class _MedianHistogram
+    {
+      public:
+        static const int Bins = ImageDefTraits<T>::LengthOfLUT;
+        static const int Shift = sizeof(T) * 4;
+
+        std::vector<unsigned int> Fine;
+        std::vector<unsigned int> Coarse;
+        int Median; // 当前中值。
+        int Below;  // 小于Median的数据个数。
+
+        _MedianHistogram() : Fine(Bins), Coarse(Bins >> Shift), Median(0), Below(0)
+        {
+        }
+
+        void Clear()
+        {
+          std::fill(Fine.begin(), Fine.end(), 0U);
+          std::fill(Coarse.begin(), Coarse.end(), 0U);
+          Median = 0;
+          Below = 0;
+        }
+
+        void Add(int v)
+        {
+          Fine[v]++;
+          Coarse[v >> Shift]++;
+          if (v < Median) Below++;
+        }
+
+        void Remove(int v)
+        {
+          Fine[v]--;
+          Coarse[v >> Shift]--;
+          if (v < Median) Below--;
+        }
+
+        // 移动中值，使得按升序排列后第rank个数据（从0开始）等于Median。
+        int Find(int rank)
+        {
+          const int mask = (1 << Shift) - 1;
+          while (Below > rank)
+          {
+            if ((Median & mask) == 0 && static_cast<int>(Below - Coarse[(Median >> Shift) - 1]) > rank)
+            {
+              Below -= Coarse[(Median >> Shift) - 1];
+              Median -= mask + 1;
+            }
+            else
+            {
+              Median--;
+              Below -= Fine[Median];
+            }
+          }
+          while (Below + static_cast<int>(Fine[Median]) <= rank)
+          {
+            if ((Median & mask) == 0 && Below + static_cast<int>(Coarse[Median >> Shift]) <= rank)
+            {
+              Below += Coarse[Median >> Shift];
+              Median += mask + 1;
+            }
+            else
+            {
+              Below += Fine[Median];
+              Median++;
+            }
+          }
+
+          return Median;
+        }
+    };
+
+    /**
+     * @brief 用滑动直方图做中值滤波。
      *
-     * 该函数移植自MVideo中的算法。
+     * 窗口在每一行上从左向右滑动，每移动一个象素只需从直方图中减去移出的一列、加上移入的一列，中值位置也只是在上一个中值附近
+     * 移动，每个象素的计算量与窗口边长成正比，而MiddleValueFilterImage对每个象素都要排序整个窗口。窗口的位置和边界处理
+     * （超出图像的坐标截断到边上）与MiddleValueFilterImage相同。MEDIAN_FILTER_LUMINANCE模式下输出的总是窗口中某个象素的颜色，
+     * 中值灰度的象素不唯一时取其中最左一列、最上面的一个，可能与MiddleValueFilterImage选中的象素不同。
      *
-     * @param image 欲处理的图像。目前只处理RGB格式图像。
-     * @param sharpness 处理效果，为-10~10的整数。负数表示平滑图像，正数表示锐化图像，0表示不做任何处理。
+     * @param image 欲处理的图像，处理后该图像会被更新。适用于8bit和16bit图像。
+     * @param sub_area 子区，为0表示处理全图。
+     * @param block 窗口块大小（象素）。
+     * @param mode 取中值的模式。
      *
-     * @author 陈进
+     * @see MiddleValueFilterImage
+     * @see ParallelMedianFilterImage
      */
     template <class T>
-    void SharpenImage(MBL::Image2D::ImageDef<T> *image, int sharpness)
+    void MedianFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int block, MedianFilterMode mode = MEDIAN_FILTER_LUMINANCE)
     {
-      T *lpImageData = image->Pixels;
-      int xsize = image->Width;
-      int ysize = image->Height;
-
-      int i,j,k;
-      int i1,i2,i3,j1;
-      int itemp;
-      int s1,s2,s3;
-      int modein,modeout;
+      if (image == 0) throw NullPointerException();
+      if (block <= 0) throw IllegalArgumentException();
+      switch (image->Format)
+      {
+        case IMAGE_FORMAT_RGB:
+          break;
+        case IMAGE_FORMAT_INDEX:
+        case IMAGE_FORMAT_BGR:
+        case IMAGE_FORMAT_RGBA:
+        case IMAGE_FORMAT_ARGB:
+        case IMAGE_FORMAT_INDEX_ALPHA:
+          if (mode != MEDIAN_FILTER_CHANNEL) throw UnsupportedFormatException();
+          break;
+        default:
+          throw UnsupportedFormatException();
+      }
 
-      //if (bits != 24) return; // currently only deal with 24 bits image
-      if (sharpness == 0) return; // no sharpeness
-      //if ( sharpeness < -10 || sharpeness > 10) return; // range -10 ~ 10
+      int left, top, right, bottom;
+      if (sub_area == 0)
+      {
+        left = 0;
+        top = 0;
+        right = image->Width;
+        bottom = image->Height;
+      }
+      else
+      {
+        left = sub_area->Left;
+        top = sub_area->Top;
+        right = sub_area->Left + sub_area->Width;
+        bottom = sub_area->Top + sub_area->Height;
+      }
+      if (right <= left || bottom <= top) return;
 
-      if (xsize < 4 || xsize > 8196) return; // range of image resolution
-      if (ysize < 5 || ysize > 8196) return; // range of image resolution
-      //if (lpImageData == NULL) return;  // image data pointer
+      const int b = GetUnitsPerPixel(image);
+      const int ld = -block / 2, rd = ld + block;
+      const int rank = block * block / 2;
+      const bool luminance = mode == MEDIAN_FILTER_LUMINANCE;
 
-      if (sharpness > 0) // sharpen
+      ImageDef<T> *src = DuplicateImage(image);
+      try
       {
-        s1 = -sharpness;
-        s2 = -s1*4+8;
-        s3 = 3;
+        std::vector<_MedianHistogram<T> > hist(luminance ? 1 : b);
+        // 窗口中每个灰度的象素按移入的先后（先按列、同一列再按行）串成队列，窗口中的列也是先移入的先移出，所以移出的象素总在
+        // 队首。中值落在某个灰度时输出队首的象素，即窗口中最左一列、最上面的那个，结果只取决于窗口的内容。队列的结点按
+        // 窗口列号对block取余和行号存放，移出的列的结点正好被移入的列使用。
+        std::vector<int> heads(luminance ? _MedianHistogram<T>::Bins : 0), tails(heads.size());
+        std::vector<int> links(luminance ? block * block : 0);
+        std::vector<const T *> pixels(links.size());
+        std::vector<const T *> rows(block);
+
+        for (int y = top; y < bottom; y++)
+        {
+          for (int dy = ld; dy < rd; dy++)
+          {
+            rows[dy - ld] = GetRowPointer(src, MBL::Utility::Clamp(y + dy, 0, src->Height - 1));
+          }
+          for (size_t c = 0; c < hist.size(); c++) hist[c].Clear();
+          std::fill(heads.begin(), heads.end(), -1);
+
+          // 把第x列加入（sign为1）或移出（sign为-1）窗口。
+          auto column = [&](int x, int sign)
+          {
+            const size_t offset = static_cast<size_t>(MBL::Utility::Clamp(x, 0, src->Width - 1)) * b;
+            for (int i = 0; i < block; i++)
+            {
+              const T *p = rows[i] + offset;
+              if (luminance)
+              {
+                const int g = (299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000;
+                if (sign > 0)
+                {
+                  const int e = ((x % block + block) % block) * block + i;
+                  hist[0].Add(g);
+                  pixels[e] = p;
+                  links[e] = -1;
+                  if (heads[g] < 0) heads[g] = e; else links[tails[g]] = e;
+                  tails[g] = e;
+                }
+                else
+                {
+                  hist[0].Remove(g);
+                  heads[g] = links[heads[g]];
+                }
+              }
+              else
+              {
+                for (int c = 0; c < b; c++)
+                {
+                  if (sign > 0) hist[c].Add(p[c]); else hist[c].Remove(p[c]);
+                }
+              }
+            }
+          };
+
+          for (int dx = ld; dx < rd; dx++) column(left + dx, 1);
+
+          T *out = GetRowPointer(image, y);
+          for (int x = left; x < right; x++)
+          {
+            if (x > left)
+            {
+              column(x - 1 + ld, -1);
+              column(x - 1 + rd, 1);
+            }
+            if (sub_area != 0 && !sub_area->IsFill(x, y)) continue;
+
+            T *p = out + static_cast<size_t>(x) * b;
+            if (luminance)
+            {
+              const T *q = pixels[heads[hist[0].Find(rank)]];
+              for (int c = 0; c < 3; c++) p[c] = q[c];
+            }
+            else
+            {
+              for (int c = 0; c < b; c++) p[c] = static_cast<T>(hist[c].Find(rank));
+            }
+          }
+        }
       }
-      else // smooth
+      catch (...)
       {
-        s1 = -sharpness;
-        if (s1 > 8) s1 = 8;
-        s2 = 32-4*s1;
-        s3 = 5;
+        delete src;
+        throw;
       }
 
-      static thread_local T *line = nullptr;
-      static thread_local int xsize_3 = -1;
+      delete src;
+    }
 
-      if (xsize_3 != xsize * 3)
+    // 计算平滑或锐化后的一行RGB象素。上下邻居取up和down行的同一象素，左右邻居取center行中相隔两个象素的象素，
+    // 最左和最右两个象素缺少的水平邻居取其自身。中间部分是无分支的连续循环，可以由编译器向量化。
+    template <class T>
+    void _SharpenRow(const T *up, const T *center, const T *down, T *out, int width, int s1, int s2, int s3)
+    {
+      const int n = width * 3;
+      auto edge = [&](int u)
+      {
+        const int l = u >= 6 ? center[u - 6] : center[u];
+        const int r = u < n - 6 ? center[u + 6] : center[u];
+        const int v = (center[u] * s2 + (up[u] + down[u] + l + r) * s1) >> s3;
+        out[u] = static_cast<T>(MBL::Utility::ClampFast(v, 0, 255));
+      };
+      for (int u = 0; u < 6; u++) edge(u);
+      for (int u = n - 6; u < n; u++) edge(u);
+      for (int u = 6; u < n - 6; u++)
       {
-        MBL::Utility::SafeRelease(&line); // Lost some memory trades for fast process
-        xsize_3 = xsize * 3;
-        line = new T[xsize_3 * 5]; // temp results
+        const int v = (center[u] * s2 + (up[u] + down[u] + center[u - 6] + center[u + 6]) * s1) >> s3;
+        out[u] = static_cast<T>(MBL::Utility::ClampFast(v, 0, 255));
       }
-      memcpy(line, lpImageData, xsize_3 * 5); // init line, at least 5px height
+    }
 
-      int i2_l, i2_r;
-      T *pi1, *pi2, *pi3, *pi2_l, *pi2_r, *pj1;
+    // 对[y0, y1)行做平滑或锐化。rows为7行的缓冲区：前两行是y0上面两行的原始数据，接着两行是y1及其下一行的原始数据，
+    // 最后三行轮流保存正在处理的行被改写前的原始数据。
+    template <class T>
+    void _SharpenRows(ImageDef<T> *image, int y0, int y1, int s1, int s2, int s3, T *rows)
+    {
+      const int h = image->Height;
+      const size_t wb = static_cast<size_t>(image->Width) * 3 * sizeof(T);
+      const size_t rn = static_cast<size_t>(image->Width) * 3;
 
-      for(i=0;i<ysize+2;i++)
+      // 取第r行的原始数据，当前行为y。
+      auto source = [&](int r, int y) -> const T *
       {
-        modein = (MBL::Utility::GetMin(i, ysize - 1) % 5) * xsize_3;
-        modeout = (MBL::Utility::GetMax(i - 2, 0) % 5) * xsize_3;
+        if (r < y0) return rows + (r - y0 + 2) * rn;
+        if (r >= y1) return rows + (2 + r - y1) * rn;
+        if (r <= y) return rows + (4 + r % 3) * rn;
+        return GetRowPointer(image, r);
+      };
 
-        i1 = MBL::Utility::GetMax(i - 2, 0)*xsize_3;
-        i2 = MBL::Utility::GetMin(i, ysize - 1)*xsize_3;
-        i3 = MBL::Utility::GetMin(i + 2, ysize - 1)*xsize_3;
-        j1 = modein;
+      for (int y = y0; y < y1; y++)
+      {
+        T *out = GetRowPointer(image, y);
+        T *center = rows + (4 + y % 3) * rn;
+        memcpy(center, out, wb);
 
-        pi1 = lpImageData + i1;
-        pi2 = lpImageData + i2;
-        pi3 = lpImageData + i3;
-        pj1 = line + j1;
+        // 与原算法一致：第1、2行的上邻居是已经处理过的第0行，最后一行的上邻居是其自身。
+        const T *up;
+        if (y == 0 || y == h - 1)
+          up = center;
+        else if (y < 3)
+          up = GetRowPointer(image, 0);
+        else
+          up = source(y - 2, y);
+        const T *down = source(MBL::Utility::GetMin(y + 2, h - 1), y);
 
-        for(j=0;j<xsize;j++)
-        {
-          i2_l = j >= 2 ? i2 - 6 : i2;
-          i2_r = j < xsize -2 ? i2 + 6 : i2;
+        _SharpenRow(up, center, down, out, image->Width, s1, s2, s3);
+      }
+    }
 
-          pi2_l = lpImageData + i2_l;
-          pi2_r = lpImageData + i2_r;
+    // 计算平滑或锐化的系数，sharpness为0时返回false。
+    inline bool _GetSharpenFactors(int sharpness, int *s1, int *s2, int *s3)
+    {
+      if (sharpness == 0) return false;
 
-          for (k = 0; k < 3; ++k)
-          {
-              itemp = ((*pi2++) * s2 + ((*pi1++) + (*pi3++) + (*pi2_l++) + (*pi2_r++)) * s1) >> s3;
-              *pj1++ = MBL::Utility::ClampFast(itemp, 0, 255);
+      if (sharpness > 0) // sharpen
+      {
+        *s1 = -sharpness;
+        *s2 = -*s1 * 4 + 8;
+        *s3 = 3;
+      }
+      else // smooth
+      {
+        *s1 = MBL::Utility::GetMin(-sharpness, 8);
+        *s2 = 32 - 4 * *s1;
+        *s3 = 5;
+      }
+      return true;
+    }
 
-              i2++;
-          }
-        } // end of j
-        memcpy(&lpImageData[MBL::Utility::GetMax(i - 2, 0)*xsize_3], &line[modeout], xsize_3);
-      } // end of i
+    /**
+     * @brief 对图像进行平滑或锐化处理。
+     *
+     * 该函数移植自MVideo中的算法。处理结果逐行写回图像，只需要几行的临时缓冲区，由调用者提供时可以在多次调用间重复使用，
+     * 不必每次分配。
+     *
+     * @param image 欲处理的图像。目前只处理RGB格式图像。
+     * @param sharpness 处理效果，为-10~10的整数。负数表示平滑图像，正数表示锐化图像，0表示不做任何处理。
+     * @param scratch 临时缓冲区，大小不足时会被扩大。为0时使用函数内部的缓冲区。
+     *
+     * @author 陈进
+     */
+    template <class T>
+    void SharpenImage(MBL::Image2D::ImageDef<T> *image, int sharpness, std::vector<T> *scratch = 0)
+    {
+      int s1, s2, s3;
+      if (!_GetSharpenFactors(sharpness, &s1, &s2, &s3)) return; // no sharpeness
+
+      if (image->Width < 4 || image->Width > 8196) return; // range of image resolution
+      if (image->Height < 5 || image->Height > 8196) return; // range of image resolution
+
+      std::vector<T> local;
+      if (scratch == 0) scratch = &local;
+      const size_t rn = static_cast<size_t>(image->Width) * 3;
+      if (scratch->size() < 7 * rn) scratch->resize(7 * rn);
+
+      _SharpenRows(image, 0, image->Height, s1, s2, s3, &(*scratch)[0]);
     }
 
     /**
@@ -408,9 +1427,10 @@ namespace MBL
       if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
 
       T grey, grey2, diff;
-      T *p = image->Pixels;
+      T *p = 0;
       for (int y = 0, h = image->Height; y < h; ++y)
       {
+        p = GetRowPointer(image, y);
         grey2 = (*p) / 2 + (*(p + 1)) / 2;
         *p++ = ImageDefTraits<T>::MidValueRoundUp;
         *p++ = ImageDefTraits<T>::MidValueRoundUp;
@@ -437,6 +1457,110 @@ namespace MBL
         }
       }
     }
+
+    /**
+     * @brief 5×5自定义滤波的分块并行版本。
+     *
+     * 结果与CustomFilterImage相同，图像被划分为分块后在多个线程上同时处理。
+     *
+     * @param image 源图像，处理后该图像会被更新。
+     * @param sub_area 图像子区，为0表示全图。
+     * @param core 5×5卷积核。
+     * @param div 卷积核的除数。
+     * @param bias 卷积结果的偏移量。
+     *
+     * @see ProcessImageTiles
+     */
+    template <class T>
+    void ParallelCustomFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int core[5][5], int div, int bias)
+    {
+      ProcessImageTiles(image, sub_area, 2, [=](ImageDef<T> *tile) { CustomFilterImage(tile, 0, core, div, bias); });
+    }
+
+    /**
+     * @brief 中值滤波的分块并行版本。
+     *
+     * 结果与MiddleValueFilterImage相同，图像被划分为分块后在多个线程上同时处理。
+     *
+     * @param image 欲处理的图像。目前只处理RGB格式图像。
+     * @param sub_area 子区，为0表示处理全图。
+     * @param block 窗口块大小（象素）。
+     *
+     * @see ProcessImageTiles
+     */
+    template <class T>
+    void ParallelMiddleValueFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int block)
+    {
+      if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
+
+      ProcessImageTiles(image, sub_area, block / 2, [=](ImageDef<T> *tile) { MiddleValueFilterImage(tile, 0, block); });
+    }
+
+    /**
+     * @brief 滑动直方图中值滤波的分块并行版本。
+     *
+     * 结果与MedianFilterImage相同，图像被划分为分块后在多个线程上同时处理。
+     *
+     * @param image 欲处理的图像，处理后该图像会被更新。
+     * @param sub_area 子区，为0表示处理全图。
+     * @param block 窗口块大小（象素）。
+     * @param mode 取中值的模式。
+     *
+     * @see ProcessImageTiles
+     */
+    template <class T>
+    void ParallelMedianFilterImage(ImageDef<T> *image, ImageSubArea *sub_area, int block, MedianFilterMode mode = MEDIAN_FILTER_LUMINANCE)
+    {
+      if (block <= 0) throw IllegalArgumentException();
+
+      ProcessImageTiles(image, sub_area, block / 2, [=](ImageDef<T> *tile) { MedianFilterImage(tile, 0, block, mode); });
+    }
+
+    /**
+     * @brief 平滑或锐化处理的并行版本。
+     *
+     * 结果与SharpenImage相同。图像按行划分为条带，各条带在多个线程上同时原地处理，处理前先保存条带上下相邻的两行原始数据，
+     * 因此不需要复制整幅图像。SharpenImage对图像尺寸的上限不限制这个函数。
+     *
+     * @param image 欲处理的图像。目前只处理RGB格式图像。
+     * @param sharpness 处理效果，为-10~10的整数。负数表示平滑图像，正数表示锐化图像，0表示不做任何处理。
+     * @param scratch 临时缓冲区，大小不足时会被扩大。为0时使用函数内部的缓冲区。
+     */
+    template <class T>
+    void ParallelSharpenImage(ImageDef<T> *image, int sharpness, std::vector<T> *scratch = 0)
+    {
+      int s1, s2, s3;
+      if (!_GetSharpenFactors(sharpness, &s1, &s2, &s3)) return;
+      if (image->Width < 4 || image->Height < 5) return;
+
+      // 条带至少有3行，保证第1、2行与第0行在同一条带中。
+      const int h = image->Height;
+      const int strip = MBL::Utility::GetMax(64, (h + 63) / 64);
+      const int strips = (h + strip - 1) / strip;
+      const size_t rn = static_cast<size_t>(image->Width) * 3;
+      const size_t wb = rn * sizeof(T);
+
+      std::vector<T> local;
+      if (scratch == 0) scratch = &local;
+      if (scratch->size() < 7 * rn * strips) scratch->resize(7 * rn * strips);
+      T *rows = &(*scratch)[0];
+
+      for (int s = 0; s < strips; s++)
+      {
+        const int y0 = s * strip, y1 = MBL::Utility::GetMin(y0 + strip, h);
+        T *r = rows + 7 * rn * s;
+        for (int k = 0; k < 2; k++)
+        {
+          if (y0 > 0) memcpy(r + k * rn, GetRowPointer(image, y0 - 2 + k), wb);
+          if (y1 < h) memcpy(r + (2 + k) * rn, GetRowPointer(image, MBL::Utility::GetMin(y1 + k, h - 1)), wb);
+        }
+      }
+
+      MBL::Utility::ParallelFor(0, strips, [&](int s)
+      {
+        _SharpenRows(image, s * strip, MBL::Utility::GetMin((s + 1) * strip, h), s1, s2, s3, rows + 7 * rn * s);
+      });
+    }
   }
 }
 
@@ -206,7 +206,7 @@ namespace MBL
       bool ScanMode = false;
       int m, n, b = 0;
       int xsize = image->Width, ysize = image->Height;
-      int li;
+      size_t li;
       T ivalue;
       T t = object;
 
@@ -224,7 +224,7 @@ namespace MBL
             if ( (xold+fx(m)) > (ysize-1) ) continue ;
             if ( (xold+fx(m)) < 1 ) continue ;
 
-            li = (int)yold+(int)fy(m)+((int)xold+(int)fx(m))*(int)xsize ;
+            li = (int)yold+(int)fy(m)+(size_t)((int)xold+(int)fx(m))*(size_t)xsize ;
           }
           else { // horizontal scan
             if ( (yold+fy(m)) > (ysize-1) ) continue ;
@@ -232,7 +232,7 @@ namespace MBL
             if ( (xold+fx(m)) > (xsize-1) ) continue ;
             if ( (xold+fx(m)) < 1 ) continue ;
 
-            li = ((int)yold+(int)fy(m))*(int)xsize+(int)xold+(int)fx(m) ;
+            li = (size_t)((int)yold+(int)fy(m))*(size_t)xsize+(int)xold+(int)fx(m) ;
           }
 
           ivalue = image->Pixels[li] ;
@@ -295,7 +295,6 @@ namespace MBL
      *
      * @author 姜志国 赵宇
      *
-     * @bug 输入图像宽度不能超过2048。
      * @bug 如果不跟踪边界，并将边界填充新的颜色，则有时会导致死循环。
      */
     template <class T>
@@ -308,15 +307,20 @@ namespace MBL
     	int Zh_L,Zh_P;
     	int L_S,P_S,L_E,P_E;
     	int Pop_Up,Pop_Down;
-    	static int Up_Seed[2048][2],Down_Seed[2048][2];
     	int ImageSizeX = image->Width, ImageSizeY = image->Height;
+    	// 种子栈和行缓冲区都是局部的，多个线程可以同时处理不同的图像。
+    	std::vector<int> seed_buf(2048 * 2 * 2);
+    	int (*Up_Seed)[2] = reinterpret_cast<int (*)[2]>(&seed_buf[0]);
+    	int (*Down_Seed)[2] = Up_Seed + 2048;
 
     	int Seed_Line,Seed_Pixel;
       int S_Raw;
       int Hang,vab;
       int detect_i,detect_j;
       int Right,Left;
-    	static T Up_Buf[2048], Down_Buf[2048];
+    	// 边界检测时会访问到Right + 1，因此每行多留一个单元。
+    	std::vector<T> line_buf(2 * (static_cast<size_t>(ImageSizeX) + 1));
+    	T *Up_Buf = &line_buf[0], *Down_Buf = Up_Buf + ImageSizeX + 1;
 
     	Zh_L=0;
     	Zh_P=0;
@@ -679,6 +683,8 @@ namespace MBL
      * @param image 源图像。
      * @param sub_area 子区对象，如果为0则表示处理全图。
      * @param v Vector对象指针。所有分割目标将存储在其中。
+     *
+     * @deprecated 种子填充对目标大小有限制，也不能并行处理，建议先分割图像再使用LabelObjects函数。
      */
     template <class T>
     void SegmentAllObject(ImageDef<T> *image, ImageSubArea *sub_area, std::vector<ObjectProperty> *v)
@@ -751,6 +757,252 @@ namespace MBL
         delete gray_image;
       }
     }
+
+    /// 连通目标的几何参数。
+    typedef struct
+    {
+      int label;                   /**< 目标标号，从1开始，按目标第一个象素的光栅顺序编号。 */
+      int area;                    /**< 目标象素面积。 */
+      double gravity_center_line;  /**< 目标重心在图中的Y坐标（象素）。 */
+      double gravity_center_pixel; /**< 目标重心在图中的X坐标（象素）。 */
+      int perimeter;               /**< 目标周长，即目标象素与背景象素（包括图像以外）之间相邻边的数目。 */
+      int start_line;              /**< 目标外接矩形上边在图中的Y坐标（象素）。 */
+      int start_pixel;             /**< 目标外接矩形左边在图中的X坐标（象素）。 */
+      int end_line;                /**< 目标外接矩形下边在图中的Y坐标（象素），包含在目标内。 */
+      int end_pixel;               /**< 目标外接矩形右边在图中的X坐标（象素），包含在目标内。 */
+      int seed_line;               /**< 目标按光栅顺序的第一个象素的Y坐标，是边界点，可以作为FollowBoundary2的种子点。 */
+      int seed_pixel;              /**< 目标按光栅顺序的第一个象素的X坐标。 */
+    } ObjectMeasurement;
+
+    // 一行中连续的目标象素[Left, Right)。
+    struct _ObjectRun
+    {
+      int Line;
+      int Left;
+      int Right;
+      int Perimeter;
+    };
+
+    // 并查集中的查找，同时压缩路径。
+    inline int _FindObjectRun(std::vector<int> &parent, int i)
+    {
+      while (parent[i] != i)
+      {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+      }
+      return i;
+    }
+
+    // 合并两个段所在的集合。总是以序号小的根为新根，因此每个集合的根都是其光栅顺序的第一个段。
+    inline void _UniteObjectRuns(std::vector<int> &parent, int a, int b)
+    {
+      a = _FindObjectRun(parent, a);
+      b = _FindObjectRun(parent, b);
+      if (a < b)
+        parent[b] = a;
+      else if (b < a)
+        parent[a] = b;
+    }
+
+    // 合并上一行的段[a0, a1)与当前行的段[b0, b1)中相互接触的段，reach为1时斜向相邻也算接触。
+    inline void _UniteObjectRows(const std::vector<_ObjectRun> &runs, std::vector<int> &parent, int a0, int a1, int b0, int b1,
+                                 int reach)
+    {
+      while (a0 < a1 && b0 < b1)
+      {
+        const _ObjectRun &p = runs[a0], &q = runs[b0];
+        if (p.Left < q.Right + reach && q.Left < p.Right + reach) _UniteObjectRuns(parent, a0, b0);
+        if (p.Right < q.Right)
+          a0++;
+        else
+          b0++;
+      }
+    }
+
+    /**
+     * @brief 标记图像中的连通目标，同时测量每个目标的几何参数。
+     *
+     * 函数把每一行的目标象素编码为段，用并查集合并相邻行中相互接触的段，然后一次遍历所有的段累加面积、重心、外接矩形和
+     * 周长。处理区域按行划分为条带，各条带在多个线程上同时编码和合并，最后再合并条带交界处的段。与GetSegmentedObjectProperty
+     * 的种子填充不同，这个函数不修改源图像，对目标的大小和数目也没有限制，目标的编号和参数与条带的划分无关。
+     *
+     * @param image 源图像，必须是索引图像，不能是彩色图像。
+     * @param sub_area 处理子区，为0表示全图。子区外的象素都作为背景。
+     * @param object 目标颜色，等于该值的象素为目标象素，其他象素为背景。
+     * @param objects 返回的目标，按编号排列，objects[i]的编号为i + 1。
+     * @param labels 返回的标记图，按行存放图像每个象素所属目标的编号，背景为0。为0时不返回标记图。
+     * @param connectivity 连通方式，4表示只有上下左右相邻的象素连通，8表示斜向相邻的象素也连通。
+     *
+     * @exception UnsupportedFormatException 源图像不是索引图像。
+     * @exception IllegalArgumentException 连通方式不是4或8。
+     *
+     * @see SegmentAllObject
+     */
+    template <class T>
+    void LabelObjects(const ImageDef<T> *image, ImageSubArea *sub_area, T object, std::vector<ObjectMeasurement> *objects,
+                      std::vector<int> *labels = 0, int connectivity = 8)
+    {
+      if (image == 0 || objects == 0) throw NullPointerException();
+      if (image->Format != IMAGE_FORMAT_INDEX) throw UnsupportedFormatException();
+      if (connectivity != 4 && connectivity != 8) throw IllegalArgumentException();
+
+      int left = 0, top = 0, right = image->Width, bottom = image->Height;
+      if (sub_area != 0)
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+      }
+      const bool masked = sub_area != 0 && sub_area->Pixels != 0;
+      const int reach = connectivity == 8 ? 1 : 0;
+
+      objects->clear();
+      if (labels != 0) labels->assign(static_cast<size_t>(image->Width) * image->Height, 0);
+      if (right <= left || bottom <= top) return;
+
+      const int n = right - left;
+      const int strip = 256;
+      const int strips = (bottom - top + strip - 1) / strip;
+      std::vector<std::vector<_ObjectRun> > strip_runs(strips);
+      std::vector<std::vector<int> > strip_rows(strips);
+
+      // 第一步：各条带把目标象素编码为段，并计算每个段对周长的贡献。
+      MBL::Utility::ParallelFor(0, strips, [&](int s)
+      {
+        const int y0 = top + s * strip, y1 = MBL::Utility::GetMin(y0 + strip, bottom);
+        std::vector<unsigned char> mask(3 * static_cast<size_t>(n + 2), 0);
+        unsigned char *rows[3] = { &mask[0], &mask[n + 2], &mask[2 * (n + 2)] };
+
+        // 把第y行的目标象素标为1，前后各留一个背景单元。
+        auto load = [&](int y, unsigned char *m)
+        {
+          memset(m, 0, n + 2);
+          if (y < top || y >= bottom) return;
+          const T *p = GetRowPointer(image, y) + left;
+          for (int x = 0; x < n; x++) m[x + 1] = p[x] == object;
+          if (masked)
+          {
+            for (int x = 0; x < n; x++) m[x + 1] &= sub_area->IsFill(left + x, y) ? 1 : 0;
+          }
+        };
+
+        std::vector<_ObjectRun> &runs = strip_runs[s];
+        std::vector<int> &row_start = strip_rows[s];
+        row_start.reserve(y1 - y0 + 1);
+        load(y0 - 1, rows[0]);
+        load(y0, rows[1]);
+        for (int y = y0; y < y1; y++)
+        {
+          load(y + 1, rows[2]);
+          const unsigned char *up = rows[0] + 1, *cur = rows[1] + 1, *down = rows[2] + 1;
+          row_start.push_back(static_cast<int>(runs.size()));
+          for (int x = 0; x < n; x++)
+          {
+            if (!cur[x]) continue;
+
+            _ObjectRun run;
+            run.Line = y;
+            run.Left = x;
+            run.Perimeter = 2;
+            for (; x < n && cur[x]; x++) run.Perimeter += 2 - up[x] - down[x];
+            run.Right = x;
+            runs.push_back(run);
+          }
+          std::swap(rows[0], rows[1]);
+          std::swap(rows[1], rows[2]);
+        }
+        row_start.push_back(static_cast<int>(runs.size()));
+      });
+
+      // 所有段连成一个数组，记下每个条带的起点。
+      std::vector<int> offset(strips + 1, 0);
+      for (int s = 0; s < strips; s++) offset[s + 1] = offset[s] + static_cast<int>(strip_runs[s].size());
+      std::vector<_ObjectRun> runs;
+      runs.reserve(offset[strips]);
+      for (int s = 0; s < strips; s++)
+      {
+        runs.insert(runs.end(), strip_runs[s].begin(), strip_runs[s].end());
+        std::vector<_ObjectRun>().swap(strip_runs[s]);
+        for (size_t k = 0; k < strip_rows[s].size(); k++) strip_rows[s][k] += offset[s];
+      }
+      std::vector<int> parent(runs.size());
+      for (size_t i = 0; i < parent.size(); i++) parent[i] = static_cast<int>(i);
+
+      // 第二步：各条带合并内部相邻行的段，只会改动本条带的段，可以同时进行。
+      MBL::Utility::ParallelFor(0, strips, [&](int s)
+      {
+        const std::vector<int> &row_start = strip_rows[s];
+        for (size_t k = 1; k + 1 < row_start.size(); k++)
+        {
+          _UniteObjectRows(runs, parent, row_start[k - 1], row_start[k], row_start[k], row_start[k + 1], reach);
+        }
+      });
+
+      // 第三步：合并条带交界处的段。
+      for (int s = 1; s < strips; s++)
+      {
+        const std::vector<int> &a = strip_rows[s - 1], &b = strip_rows[s];
+        _UniteObjectRows(runs, parent, a[a.size() - 2], a[a.size() - 1], b[0], b[1], reach);
+      }
+
+      // 第四步：按光栅顺序编号并累加参数。根是集合中的第一个段，遇到根时目标才出现。
+      std::vector<int> label(runs.size());
+      std::vector<long long> sum_x, sum_y;
+      for (size_t i = 0; i < runs.size(); i++)
+      {
+        const _ObjectRun &run = runs[i];
+        const int root = _FindObjectRun(parent, static_cast<int>(i));
+        const int length = run.Right - run.Left;
+        const int x0 = left + run.Left, x1 = left + run.Right - 1;
+        if (root == static_cast<int>(i))
+        {
+          ObjectMeasurement obj;
+          obj.label = static_cast<int>(objects->size()) + 1;
+          obj.area = 0;
+          obj.perimeter = 0;
+          obj.start_line = obj.end_line = obj.seed_line = run.Line;
+          obj.start_pixel = obj.seed_pixel = x0;
+          obj.end_pixel = x1;
+          objects->push_back(obj);
+          sum_x.push_back(0);
+          sum_y.push_back(0);
+          label[i] = obj.label;
+        }
+        else
+        {
+          label[i] = label[root];
+        }
+
+        ObjectMeasurement &obj = (*objects)[label[i] - 1];
+        obj.area += length;
+        obj.perimeter += run.Perimeter;
+        obj.end_line = run.Line;
+        obj.start_pixel = MBL::Utility::GetMin(obj.start_pixel, x0);
+        obj.end_pixel = MBL::Utility::GetMax(obj.end_pixel, x1);
+        sum_x[label[i] - 1] += static_cast<long long>(x0 + x1) * length;
+        sum_y[label[i] - 1] += static_cast<long long>(run.Line) * length;
+      }
+      for (size_t k = 0; k < objects->size(); k++)
+      {
+        ObjectMeasurement &obj = (*objects)[k];
+        obj.gravity_center_pixel = sum_x[k] / (2.0 * obj.area);
+        obj.gravity_center_line = static_cast<double>(sum_y[k]) / obj.area;
+      }
+
+      // 第五步：写出标记图。
+      if (labels != 0)
+      {
+        const int w = image->Width;
+        MBL::Utility::ParallelFor(0, static_cast<int>(runs.size()), [&](int i)
+        {
+          const _ObjectRun &run = runs[i];
+          int *p = &(*labels)[static_cast<size_t>(run.Line) * w + left];
+          for (int x = run.Left; x < run.Right; x++) p[x] = label[i];
+        });
+      }
+    }
   }
 }
 
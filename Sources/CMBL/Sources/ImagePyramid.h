@@ -0,0 +1,327 @@
+#ifndef __IMAGEPYRAMID_H__
+#define __IMAGEPYRAMID_H__
+
+#include <functional>
+#include <memory.h>
+#include <vector>
+
+/**
+ * @file
+ *
+ * @brief 包含以流方式生成多分辨率图像金字塔的类。
+ */
+
+namespace MBL
+{
+  namespace Image2D
+  {
+    /// 以流方式生成多分辨率图像金字塔的类。
+    /**
+     * 全切片图像的基础层通常按分块逐行读取，整层放入内存或者对整层反复缩放都很浪费。这个类按分块行的顺序接收基础层分块，
+     * 每凑齐一个分块行就把其中的各行依次送入下一层：相邻两行按2×2平均缩小为下一层的一行，新产生的行再立即送入更下一层。
+     * 因此所有缩小层只需要遍历一次基础层就全部生成，每一层只保留一个待配对的行和一个分块高度的条带，内存用量与图像高度无关。
+     *
+     * 某一层的条带填满一个分块高度后，其中的分块通过回调函数依次交出。宽度或高度为奇数时，最后一列或一行与自身平均。
+     * 例如从SVS文件的基础层生成金字塔：
+     * @code
+     * ImagePyramidBuilder<unsigned char> builder(IMAGE_FORMAT_RGB, width, height, 256, 256, 0,
+     *   [&](int level, int column, int row, ImageDef<unsigned char> *tile) { SaveTile(level, column, row, tile); });
+     * for (int row = 0; row < rows; row++)
+     *   for (int column = 0; column < columns; column++)
+     *     builder.PushTile(column, row, ReadTile(column, row));
+     * builder.Finish();
+     * @endcode
+     *
+     * @see ScaleImageArea
+     */
+    template <class T>
+    class ImagePyramidBuilder
+    {
+      public:
+        /**
+         * @brief 分块回调函数类型。
+         *
+         * 参数依次为层号（从1开始，基础层不回调）、分块列号、分块行号和分块图像。分块图像是指向内部条带的ImageView，只在
+         * 回调期间有效，需要保留时请复制。右边和下边的分块可能小于分块尺寸。
+         */
+        typedef std::function<void (int level, int column, int row, ImageDef<T> *tile)> TileCallback;
+
+      private:
+        // 金字塔中的一层。
+        struct _Level
+        {
+          int Width;
+          int Height;
+          ImageDef<T> *Strip;     // 一个分块高度的条带。
+          int Rows;               // 条带中已经填充的行数。
+          int StripRow;           // 条带对应的分块行号。
+          std::vector<T> Pending; // 等待与下一行配对的上一层行。
+          bool HasPending;
+        };
+
+        int m_TileWidth;
+        int m_TileHeight;
+        int m_Units;
+        ImageFormat m_Format;
+        TileCallback m_Callback;
+        std::vector<_Level> m_Levels;
+        std::vector<bool> m_Arrived;
+        int m_Received;
+
+      public:
+        /**
+         * @brief 构造函数。
+         *
+         * @param format 图像格式，各分量必须交错存放，如索引、RGB、RGBA等格式。
+         * @param width 基础层宽度（象素）。
+         * @param height 基础层高度（象素）。
+         * @param tile_width 分块宽度（象素），基础层和各缩小层使用同样的分块尺寸。
+         * @param tile_height 分块高度（象素）。
+         * @param levels 生成的缩小层数，为0表示一直缩小到一层可以放入一个分块为止。
+         * @param callback 分块回调函数。
+         */
+        ImagePyramidBuilder(ImageFormat format, int width, int height, int tile_width, int tile_height, int levels, TileCallback callback)
+          : m_TileWidth(tile_width),
+            m_TileHeight(tile_height),
+            m_Units(0),
+            m_Format(format),
+            m_Callback(callback),
+            m_Received(0)
+        {
+          if (width <= 0 || height <= 0 || tile_width <= 0 || tile_height <= 0 || levels < 0) throw IllegalArgumentException();
+          switch (format)
+          {
+            case IMAGE_FORMAT_INDEX:
+            case IMAGE_FORMAT_RGB:
+            case IMAGE_FORMAT_BGR:
+            case IMAGE_FORMAT_RGBA:
+            case IMAGE_FORMAT_ARGB:
+            case IMAGE_FORMAT_INDEX_ALPHA:
+              break;
+            default:
+              throw UnsupportedFormatException();
+          }
+
+          if (levels == 0)
+          {
+            for (int w = width, h = height; w > tile_width || h > tile_height; w = (w + 1) / 2, h = (h + 1) / 2) levels++;
+          }
+
+          try
+          {
+            m_Levels.resize(levels + 1);
+            for (int k = 0; k <= levels; k++)
+            {
+              _Level &level = m_Levels[k];
+              level.Width = (k == 0) ? width : (m_Levels[k - 1].Width + 1) / 2;
+              level.Height = (k == 0) ? height : (m_Levels[k - 1].Height + 1) / 2;
+              level.Strip = 0;
+              level.Rows = 0;
+              level.StripRow = 0;
+              level.HasPending = false;
+            }
+            for (int k = 0; k <= levels; k++)
+            {
+              _Level &level = m_Levels[k];
+              level.Strip = ImageDef<T>::CreateInstance(format, level.Width, MBL::Utility::GetMin(tile_height, level.Height));
+              if (k > 0) level.Pending.resize(GetUnitsPerRow(m_Levels[k - 1].Strip));
+            }
+          }
+          catch (...)
+          {
+            _Release();
+            throw;
+          }
+
+          m_Units = GetUnitsPerPixel(m_Levels[0].Strip);
+          m_Arrived.assign(GetColumnCount(0), false);
+        }
+
+        /// 析构函数。
+        ~ImagePyramidBuilder()
+        {
+          _Release();
+        }
+
+        /**
+         * @brief 取得生成的缩小层数，不包括基础层。
+         *
+         * @return 缩小层数。
+         */
+        int GetLevelCount() const
+        {
+          return static_cast<int>(m_Levels.size()) - 1;
+        }
+
+        /**
+         * @brief 取得某一层的宽度。
+         *
+         * @param level 层号，0表示基础层。
+         * @return 该层的宽度（象素）。
+         */
+        int GetLevelWidth(int level) const
+        {
+          if (level < 0 || level > GetLevelCount()) throw IndexOutOfBoundsException();
+          return m_Levels[level].Width;
+        }
+
+        /**
+         * @brief 取得某一层的高度。
+         *
+         * @param level 层号，0表示基础层。
+         * @return 该层的高度（象素）。
+         */
+        int GetLevelHeight(int level) const
+        {
+          if (level < 0 || level > GetLevelCount()) throw IndexOutOfBoundsException();
+          return m_Levels[level].Height;
+        }
+
+        /**
+         * @brief 取得某一层的分块列数。
+         *
+         * @param level 层号，0表示基础层。
+         * @return 该层的分块列数。
+         */
+        int GetColumnCount(int level) const
+        {
+          return (GetLevelWidth(level) + m_TileWidth - 1) / m_TileWidth;
+        }
+
+        /**
+         * @brief 取得某一层的分块行数。
+         *
+         * @param level 层号，0表示基础层。
+         * @return 该层的分块行数。
+         */
+        int GetRowCount(int level) const
+        {
+          return (GetLevelHeight(level) + m_TileHeight - 1) / m_TileHeight;
+        }
+
+        /**
+         * @brief 送入一个基础层分块。
+         *
+         * 分块必须按分块行的顺序送入，同一分块行中的各分块可以是任意顺序。一个分块行的全部分块都送入后，缩小层的数据随即
+         * 生成，可能引起若干次回调。
+         *
+         * @param column 分块列号。
+         * @param row 分块行号，必须是当前正在接收的分块行。
+         * @param tile 分块图像，格式必须与基础层相同，尺寸必须等于该位置的分块尺寸，可以是ImageView。
+         *
+         * @exception IllegalArgumentException 分块位置不正确或者重复送入。
+         * @exception UnmatchedImageException 分块的格式或者尺寸不正确。
+         */
+        void PushTile(int column, int row, ImageDef<T> *tile)
+        {
+          if (tile == 0) throw NullPointerException();
+
+          _Level &base = m_Levels[0];
+          if (row != base.StripRow || column < 0 || column >= GetColumnCount(0) || m_Arrived[column]) throw IllegalArgumentException();
+
+          const int x = column * m_TileWidth;
+          const int w = MBL::Utility::GetMin(m_TileWidth, base.Width - x);
+          const int h = MBL::Utility::GetMin(m_TileHeight, base.Height - row * m_TileHeight);
+          if (tile->Format != m_Format || tile->Width != w || tile->Height != h) throw UnmatchedImageException();
+
+          const size_t wb = static_cast<size_t>(w) * GetBytesPerPixel(tile);
+          for (int y = 0; y < h; y++)
+          {
+            memcpy(GetRowPointer(base.Strip, y) + static_cast<size_t>(x) * m_Units, GetRowPointer(tile, y), wb);
+          }
+
+          m_Arrived[column] = true;
+          if (++m_Received < GetColumnCount(0)) return;
+
+          m_Received = 0;
+          m_Arrived.assign(m_Arrived.size(), false);
+          base.StripRow++;
+          for (int y = 0; y < h; y++)
+          {
+            _AddRow(1, GetRowPointer(base.Strip, y));
+          }
+        }
+
+        /**
+         * @brief 结束生成过程。
+         *
+         * 高度为奇数的层的最后一行与自身平均，各层剩余的分块通过回调交出。
+         *
+         * @exception IllegalArgumentException 基础层的分块还没有全部送入。
+         */
+        void Finish()
+        {
+          if (m_Levels[0].StripRow != GetRowCount(0)) throw IllegalArgumentException();
+
+          for (int k = 1; k <= GetLevelCount(); k++)
+          {
+            if (m_Levels[k].HasPending) _AddRow(k, &m_Levels[k].Pending[0]);
+          }
+        }
+
+      private:
+        ImagePyramidBuilder(const ImagePyramidBuilder &);
+        ImagePyramidBuilder & operator =(const ImagePyramidBuilder &);
+
+        void _Release()
+        {
+          for (size_t k = 0; k < m_Levels.size(); k++)
+          {
+            delete m_Levels[k].Strip;
+            m_Levels[k].Strip = 0;
+          }
+        }
+
+        // 把上一层的一行送入第k层，凑成一对时生成第k层的一行。
+        void _AddRow(int k, const T *src)
+        {
+          if (k > GetLevelCount()) return;
+
+          _Level &level = m_Levels[k];
+          const int sw = m_Levels[k - 1].Width;
+          if (!level.HasPending)
+          {
+            memcpy(&level.Pending[0], src, static_cast<size_t>(sw) * m_Units * sizeof(T));
+            level.HasPending = true;
+            return;
+          }
+
+          const T *a = &level.Pending[0];
+          T *out = GetRowPointer(level.Strip, level.Rows);
+          const int b = m_Units;
+          for (int j = 0; j < level.Width; j++)
+          {
+            const int x0 = 2 * j * b;
+            const int x1 = MBL::Utility::GetMin(2 * j + 1, sw - 1) * b;
+            for (int c = 0; c < b; c++)
+            {
+              unsigned int v = a[x0 + c] + a[x1 + c] + src[x0 + c] + src[x1 + c];
+              out[j * b + c] = static_cast<T>((v + 2) >> 2);
+            }
+          }
+          level.HasPending = false;
+          level.Rows++;
+
+          _AddRow(k + 1, out);
+
+          if (level.Rows == MBL::Utility::GetMin(m_TileHeight, level.Height - level.StripRow * m_TileHeight)) _EmitStrip(k);
+        }
+
+        // 交出第k层条带中的全部分块。
+        void _EmitStrip(int k)
+        {
+          _Level &level = m_Levels[k];
+          for (int column = 0; column < GetColumnCount(k); column++)
+          {
+            const int x = column * m_TileWidth;
+            ImageView<T> tile(level.Strip, x, 0, MBL::Utility::GetMin(m_TileWidth, level.Width - x), level.Rows);
+            m_Callback(k, column, level.StripRow, &tile);
+          }
+          level.Rows = 0;
+          level.StripRow++;
+        }
+    };
+  }
+}
+
+#endif // __IMAGEPYRAMID_H__
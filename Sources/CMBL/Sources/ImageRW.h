@@ -128,7 +128,8 @@ namespace MBL
 
     /// 取得图像中每行所占的存储单元数。
     /**
-     * 该函数取得图像中每行的存储单元数。
+     * 该函数取得图像中每行的存储单元数，即行跨度。对于紧密排列的图像，它等于Width × 每象素单元数；对于图像视图，它等于
+     * RowPitch，可能包含不属于该图像的行尾数据。计算行偏移时应使用该返回值，如 y * GetUnitsPerRow(image)，以免大图像溢出。
      *
      * @param image 欲处理的图像，必须是有效的图像。
      * @return 该图像每行所占的单元数。
@@ -136,21 +137,73 @@ namespace MBL
      * @author 赵宇
      */
     template <class T>
-    int GetUnitsPerRow(const ImageDef<T> *image)
+    size_t GetUnitsPerRow(const ImageDef<T> *image)
     {
-      return image->Width * GetUnitsPerPixel(image);
+      if (image->RowPitch != 0) return image->RowPitch;
+
+      return static_cast<size_t>(image->Width) * GetUnitsPerPixel(image);
+    }
+
+    /**
+     * @brief 判断图像的各行是否紧密排列。
+     *
+     * 紧密排列的图像可以把全部象素数据当作一个连续的数组处理，否则必须逐行处理，不能触及行尾不属于该图像的数据。
+     *
+     * @param image 欲处理的图像。
+     * @return 各行紧密排列时返回true。
+     */
+    template <class T>
+    bool IsPackedImage(const ImageDef<T> *image)
+    {
+      return image->RowPitch == 0 || image->RowPitch == static_cast<size_t>(image->Width) * GetUnitsPerPixel(image);
     }
 
     /**
      * @brief 取得该图像对象的实际象素数据所占的存储单元数。
      *
+     * 对于非紧密排列的图像视图，该值为从第一行开头到最后一行末尾所跨越的存储单元数，其中包含了行尾不属于该图像的数据。
+     *
      * @param image 欲处理的图像。
      * @return 图像数据所占的存储单元数，不包括调色板的数据。
      */
     template <class T>
-    int GetUnitsOfPixelData(const ImageDef<T> *image)
+    size_t GetUnitsOfPixelData(const ImageDef<T> *image)
+    {
+      if (image->Height <= 0) return 0;
+
+      return static_cast<size_t>(image->Height - 1) * GetUnitsPerRow(image)
+             + static_cast<size_t>(image->Width) * GetUnitsPerPixel(image);
+    }
+
+    /**
+     * @brief 取得图像中指定象素的第一个存储单元相对于Pixels的偏移。
+     *
+     * 偏移用size_t计算，对于超过2G个存储单元的大图像也不会溢出。
+     *
+     * @param image 欲处理的图像。
+     * @param x 象素的x坐标（象素），即列数。
+     * @param y 象素的y坐标（象素），即行数。
+     * @return 存储单元偏移。
+     */
+    template <class T>
+    size_t GetUnitsOffset(const ImageDef<T> *image, int x, int y)
+    {
+      return static_cast<size_t>(y) * GetUnitsPerRow(image) + static_cast<size_t>(x) * GetUnitsPerPixel(image);
+    }
+
+    /**
+     * @brief 取得图像中指定行的数据指针。
+     *
+     * 逐行处理图像时应使用该函数取得每行的开头，而不是假定各行紧密排列，这样函数才能同样处理图像视图。
+     *
+     * @param image 欲处理的图像。
+     * @param y 行数，必须在0 ～ Height - 1之间。
+     * @return 该行第一个象素的数据指针。
+     */
+    template <class T>
+    T * GetRowPointer(const ImageDef<T> *image, int y)
     {
-      return image->Height * GetUnitsPerRow(image);
+      return image->Pixels + static_cast<size_t>(y) * GetUnitsPerRow(image);
     }
 
     /**
@@ -172,13 +225,15 @@ namespace MBL
     /**
      * @brief 取得该图像对象每行象素的数据所占的内存大小（字节）。
      *
+     * 与GetUnitsPerRow一样，该值是行跨度。每行实际象素数据的大小为Width × GetBytesPerPixel。
+     *
      * @param image 欲处理的图像。
      * @return 每行象素内存大小。
      */
     template <class T>
-    int GetBytesPerRow(const ImageDef<T> *image)
+    size_t GetBytesPerRow(const ImageDef<T> *image)
     {
-      return image->Width * GetBytesPerPixel(image);
+      return GetUnitsPerRow(image) * sizeof(T);
     }
 
     /**
@@ -186,11 +241,13 @@ namespace MBL
      *
      * @param image 欲处理的图像。
      * @return 图像数据所占的内存大小，不包括调色板的数据。
+     *
+     * @see GetUnitsOfPixelData
      */
     template <class T>
     size_t GetBytesOfPixelData(const ImageDef<T> *image)
     {
-      return static_cast<size_t>(image->Height) * GetBytesPerRow(image);
+      return GetUnitsOfPixelData(image) * sizeof(T);
     }
 
     /// 从图像中读取一个象素到缓冲区。
@@ -207,7 +264,7 @@ namespace MBL
     template <class T>
     void ReadPixel(ImageDef<T> *image, int x, int y, T *buf)
     {
-      memcpy(buf, image->Pixels + (x + y * image->Width) * GetUnitsPerPixel(image), GetBytesPerPixel(image));
+      memcpy(buf, image->Pixels + GetUnitsOffset(image, x, y), GetBytesPerPixel(image));
     }
 
     /// 将缓冲区的数据复制到图像中的一个象素。
@@ -223,7 +280,7 @@ namespace MBL
     template <class T>
     void WritePixel(ImageDef<T> *image, int x, int y, T *buf)
     {
-      memcpy(image->Pixels + (x + y * image->Width) * GetUnitsPerPixel(image), buf, GetBytesPerPixel(image));
+      memcpy(image->Pixels + GetUnitsOffset(image, x, y), buf, GetBytesPerPixel(image));
     }
 
     /// 从图像中读取一行数据到缓冲区。
@@ -237,8 +294,8 @@ namespace MBL
     template <class T>
     void ReadRow(ImageDef<T> *image, int start_pixel, int end_pixel, int row, T *buf)
     {
-      memcpy(buf, image->Pixels + (start_pixel + row * image->Width)* GetUnitsPerPixel(image),
-             (end_pixel - start_pixel + 1) * GetBytesPerPixel(image));
+      memcpy(buf, image->Pixels + GetUnitsOffset(image, start_pixel, row),
+             static_cast<size_t>(end_pixel - start_pixel + 1) * GetBytesPerPixel(image));
     }
 
     /// 将缓冲区的数据写到图像中。
@@ -252,8 +309,8 @@ namespace MBL
     template <class T>
     void WriteRow(ImageDef<T> *image, int start_pixel, int end_pixel, int row, T *buf)
     {
-      memcpy(image->Pixels + (start_pixel + row * image->Width)* GetUnitsPerPixel(image), buf,
-             (end_pixel - start_pixel + 1) * GetBytesPerPixel(image));
+      memcpy(image->Pixels + GetUnitsOffset(image, start_pixel, row), buf,
+             static_cast<size_t>(end_pixel - start_pixel + 1) * GetBytesPerPixel(image));
     }
 
     /// 从图像中读取一个窗口的数据到缓冲区。
@@ -268,10 +325,10 @@ namespace MBL
     template <class T>
     void ReadWindow(ImageDef<T> *image, int start_pixel, int start_row, int end_pixel, int end_row, T *buf)
     {
-      int n = (end_pixel - start_pixel + 1) * GetBytesPerPixel(image),
-          l = (end_pixel - start_pixel + 1) * GetUnitsPerPixel(image),
-          m = GetUnitsPerRow(image);
-      T *p = image->Pixels + (start_pixel + start_row * image->Width) * GetUnitsPerPixel(image);
+      size_t n = static_cast<size_t>(end_pixel - start_pixel + 1) * GetBytesPerPixel(image),
+             l = static_cast<size_t>(end_pixel - start_pixel + 1) * GetUnitsPerPixel(image),
+             m = GetUnitsPerRow(image);
+      T *p = image->Pixels + GetUnitsOffset(image, start_pixel, start_row);
       for (int i = start_row; i <= end_row; i++)
       {
         memcpy(buf, p, n);
@@ -292,10 +349,10 @@ namespace MBL
     template <class T>
     void WriteWindow(ImageDef<T> *image, int start_pixel, int start_row, int end_pixel, int end_row, T *buf)
     {
-      int n = (end_pixel - start_pixel + 1) * GetBytesPerPixel(image),
-          l = (end_pixel - start_pixel + 1) * GetUnitsPerPixel(image),
-          m = GetUnitsPerRow(image);
-      T *p = image->Pixels + (start_pixel + start_row * image->Width) * GetUnitsPerPixel(image);
+      size_t n = static_cast<size_t>(end_pixel - start_pixel + 1) * GetBytesPerPixel(image),
+             l = static_cast<size_t>(end_pixel - start_pixel + 1) * GetUnitsPerPixel(image),
+             m = GetUnitsPerRow(image);
+      T *p = image->Pixels + GetUnitsOffset(image, start_pixel, start_row);
       for (int i = start_row; i <= end_row; i++)
       {
         memcpy(p, buf, n);
@@ -316,6 +373,8 @@ namespace MBL
      * @param height 子图像的高度（象素）。
      * @return 剪裁出的子图像。该图像在堆上分配，使用完毕后请用delete删除。
      *
+     * @see ImageView 只需要读写子区域而不需要独立的复本时，可以用图像视图避免复制数据。
+     *
      * @author 赵宇
      */
     template <class T>
@@ -339,6 +398,8 @@ namespace MBL
      * @param right 子图像的右边（象素）,从0开始。
      * @return 剪裁出的 ROI图像。该图像在堆上分配，使用完毕后请用delete删除。
      *
+     * @see ImageView
+     *
      * @author 陈伟卿
      */
     template <class T>
@@ -405,11 +466,11 @@ namespace MBL
 
       int w = Utility::GetMin(src->Width, dest->Width - left);
       int h = Utility::GetMin(src->Height, dest->Height - top);
-      int wb = w * GetBytesPerPixel(src);
-      int src_step = GetUnitsPerRow(src);
-      int dest_step = GetUnitsPerRow(dest);
+      size_t wb = static_cast<size_t>(w) * GetBytesPerPixel(src);
+      size_t src_step = GetUnitsPerRow(src);
+      size_t dest_step = GetUnitsPerRow(dest);
       T *buf1 = src->Pixels;
-      T *buf2 = dest->Pixels + top * dest_step + left * GetUnitsPerPixel(dest);
+      T *buf2 = dest->Pixels + GetUnitsOffset(dest, left, top);
       
       for (int y = 0; y < h; ++y)
       {
@@ -467,7 +528,18 @@ namespace MBL
         throw UnmatchedImageException();
       }
 
-      memcpy(dest->Pixels, src->Pixels, GetBytesOfPixelData(src));
+      if (IsPackedImage(dest) && IsPackedImage(src))
+      {
+        memcpy(dest->Pixels, src->Pixels, GetBytesOfPixelData(src));
+      }
+      else
+      {
+        size_t wb = static_cast<size_t>(src->Width) * GetBytesPerPixel(src);
+        for (int y = 0; y < src->Height; ++y)
+        {
+          memcpy(GetRowPointer(dest, y), GetRowPointer(src, y), wb);
+        }
+      }
       if (src->UsedColor != 0) memcpy(dest->Palette, src->Palette, src->UsedColor * sizeof(ImageRGBQUAD));
     }
 
@@ -483,21 +555,27 @@ namespace MBL
     template <class T>
     void FillImage(ImageDef<T> *image, T *buf)
     {
-      unsigned char *p = image->Pixels;
-      size_t n = GetBytesOfPixelData(image);
       int b = GetBytesPerPixel(image);
+      // 紧密排列的图像作为一整行处理。
+      bool packed = IsPackedImage(image);
+      int rows = packed ? 1 : image->Height;
+      size_t n = packed ? GetBytesOfPixelData(image) : static_cast<size_t>(image->Width) * b;
 
-      if (b == 1)
-      {
-        memset(p, buf[0], n);
-      }
-      else
+      for (int y = 0; y < rows; ++y)
       {
-        unsigned char *e = p + n;
-        while (p != e)
+        unsigned char *p = reinterpret_cast<unsigned char *>(GetRowPointer(image, y));
+        if (b == 1)
         {
-          memcpy(p, buf, b);
-          p += b;
+          memset(p, buf[0], n);
+        }
+        else
+        {
+          unsigned char *e = p + n;
+          while (p != e)
+          {
+            memcpy(p, buf, b);
+            p += b;
+          }
         }
       }
     }
@@ -520,16 +598,17 @@ namespace MBL
 
       if (*buf == 0)
       {
-        *buf = new T[image->Width * image->Height];
+        *buf = new T[static_cast<size_t>(image->Width) * image->Height];
         if (*buf == 0) throw OutOfMemoryException();
       }
       T *p = *buf;
 
-      for (int i = 0; i < image->Height; i++)
+      for (int y = 0; y < image->Height; ++y)
       {
-        for (int j = 0; j < image->Width; j++)
+        const T *s = GetRowPointer(image, y) + band;
+        for (int x = 0; x < image->Width; ++x, s += b)
         {
-          *p++ = image->Pixels[(i * image->Width + j) * b + band];
+          *p++ = *s;
         }
       }
     }
@@ -551,11 +630,12 @@ namespace MBL
       int b = GetUnitsPerPixel(image);
       if (band >= b) throw IndexOutOfBoundsException();
 
-      for (int i = 0; i < image->Height; i++)
+      for (int y = 0; y < image->Height; ++y)
       {
-        for (int j = 0; j < image->Width; j++)
+        T *d = GetRowPointer(image, y) + band;
+        for (int x = 0; x < image->Width; ++x, d += b)
         {
-          image->Pixels[(i * image->Width + j) * b + band] = *buf++;
+          *d = *buf++;
         }
       }
     }
@@ -579,13 +659,16 @@ namespace MBL
       if (band1 >= b || band2 >= b) throw IndexOutOfBoundsException();
 
       T tmp;
-      T *p1 = image->Pixels + band1;
-      T *p2 = image->Pixels + band2;
-      for (int i = 0, n = image->Width * image->Height; i < n; ++i, p1 += b, p2 += b)
+      for (int y = 0; y < image->Height; ++y)
       {
-        tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
+        T *p1 = GetRowPointer(image, y) + band1;
+        T *p2 = GetRowPointer(image, y) + band2;
+        for (int x = 0; x < image->Width; ++x, p1 += b, p2 += b)
+        {
+          tmp = *p1;
+          *p1 = *p2;
+          *p2 = tmp;
+        }
       }
     }
 
@@ -604,9 +687,9 @@ namespace MBL
       if (image->Format != IMAGE_FORMAT_RGB) throw UnsupportedFormatException();
 
       ImageDef<T> *image1 = ImageDef<T>::CreateInstance(fmt, image->Width, image->Height);
-      int len = image->Width * image->Height;
+      size_t len = static_cast<size_t>(image->Width) * image->Height;
       T *buf = new T[len];
-      for (int i = 0; i < len; i++)
+      for (size_t i = 0; i < len; i++)
       {
         buf[i] = v;
       }
@@ -652,7 +735,7 @@ namespace MBL
         throw UnsupportedFormatException();
 
       ImageDef<T> *image1 = ImageDef<T>::CreateInstance(IMAGE_FORMAT_RGB, image->Width, image->Height);
-      T *buf = new T[image->Width * image->Height];
+      T *buf = new T[static_cast<size_t>(image->Width) * image->Height];
 
       if (image->Format == IMAGE_FORMAT_RGBA)
       {
@@ -140,26 +140,33 @@ namespace MBL
       ImageSequenceDef<T> *image = new ImageSequenceDef<T>();
       if (image == 0) throw OutOfMemoryException();
 
-      // 计算需要分配的调色板内存和图像数据内存。
-      int pal = 0, data = 0;
+      if (width < 0 || height < 0)
+      {
+        delete image;
+        throw IllegalArgumentException();
+      }
+
+      // 计算需要分配的调色板内存和图像数据内存，每帧的数据量用size_t计算。
+      int pal = 0;
+      size_t data = 0, area = static_cast<size_t>(width) * static_cast<size_t>(height);
       switch (format)
       {
         case IMAGE_FORMAT_INDEX:
           pal = used_color;
-          data = width * height;
+          data = area;
           break;
         case IMAGE_FORMAT_RGB:
         case IMAGE_FORMAT_BGR:
           pal = 0;
-          data = 3 * width * height;
+          data = 3 * area;
           break;
         case IMAGE_FORMAT_RGBA:
           pal = 0;
-          data = 4 * width * height;
+          data = 4 * area;
           break;
         case IMAGE_FORMAT_INDEX_ALPHA:
           pal = used_color;
-          data = 2 * width * height;
+          data = 2 * area;
           break;
         default:
           throw UnsupportedFormatException();
@@ -282,6 +289,7 @@ namespace MBL
     void ImageSequenceDef<T>::AppendFrame(T *data)
     {
       if (Format == IMAGE_FORMAT_UNKNOWN) throw UninitializedImageException();
+      if (Width < 0 || Height < 0) throw IllegalArgumentException();
 
       T **p = Pixels;
       Pixels = new T* [SequenceNumber + 1];
@@ -289,21 +297,21 @@ namespace MBL
       if (p != 0) memcpy(Pixels, p, sizeof(T*) * SequenceNumber);
       delete [] p;
 
-      int len = 0;
+      size_t len = 0, area = static_cast<size_t>(Width) * static_cast<size_t>(Height);
       switch (Format)
       {
         case IMAGE_FORMAT_INDEX:
-          len = Width * Height;
+          len = area;
           break;
         case IMAGE_FORMAT_RGB:
         case IMAGE_FORMAT_BGR:
-          len = 3 * Width * Height;
+          len = 3 * area;
           break;
         case IMAGE_FORMAT_RGBA:
-          len = 4 * Width * Height;
+          len = 4 * area;
           break;
         case IMAGE_FORMAT_INDEX_ALPHA:
-          len = 2 * Width * Height;
+          len = 2 * area;
           break;
         default:
           throw UnsupportedFormatException();
@@ -121,7 +121,7 @@ namespace MBL
         {
           ImageSubArea *area = CreateInstance(left, top, width, height);
 
-          area->Pixels = new unsigned char[image_width * image_height];
+          area->Pixels = new unsigned char[static_cast<size_t>(image_width) * image_height];
           if (area->Pixels == 0)
           {
             delete area;
@@ -135,7 +135,7 @@ namespace MBL
             {
               for (int x = left; x < left + width; x++)
               {
-                area->Pixels[x + y * image_width] = 1;
+                area->Pixels[x + static_cast<size_t>(y) * image_width] = 1;
               }
             }
           }
@@ -153,7 +153,7 @@ namespace MBL
         {
           if (Pixels != 0)
           {
-            return (Pixels[x + y * ImageWidth] > 0);
+            return (Pixels[x + static_cast<size_t>(y) * ImageWidth] > 0);
           }
           else if (Left <= x && x <= Left + Width && Top <= y && y <= Top + Height)
           {
@@ -172,7 +172,7 @@ namespace MBL
         {
           if (Pixels != 0)
           {
-            memset(Pixels, 0, ImageWidth * ImageHeight);
+            memset(Pixels, 0, static_cast<size_t>(ImageWidth) * ImageHeight);
             Left = 0;
             Top = 0;
             Width = 0;
@@ -0,0 +1,320 @@
+#ifndef __IMAGETILE_H__
+#define __IMAGETILE_H__
+
+#include <mutex>
+#include <vector>
+
+/**
+ * @file
+ *
+ * @brief 包含将图像分块并行处理的函数。
+ */
+
+namespace MBL
+{
+  namespace Image2D
+  {
+    /// 图像中的一个处理分块。
+    /**
+     * 分块由有效区域和外扩的边缘（halo）组成。邻域滤波在有效区域边上的象素需要读取边缘中的象素，处理完毕后只有有效区域
+     * 的结果被写回原图像。
+     */
+    class ImageTile
+    {
+      public:
+        /// 有效区域的左边坐标（象素）。
+        int Left;
+        /// 有效区域的上边坐标（象素）。
+        int Top;
+        /// 有效区域的宽度（象素）。
+        int Width;
+        /// 有效区域的高度（象素）。
+        int Height;
+        /// 包括边缘在内的分块左边坐标（象素），不会超出图像范围。
+        int OuterLeft;
+        /// 包括边缘在内的分块上边坐标（象素）。
+        int OuterTop;
+        /// 包括边缘在内的分块宽度（象素）。
+        int OuterWidth;
+        /// 包括边缘在内的分块高度（象素）。
+        int OuterHeight;
+    };
+
+    /**
+     * @brief 取得缺省的分块尺寸。
+     *
+     * 缺省分块为整行宽度的条带，每个条带连同边缘约占256KB，可以放入大多数处理器的二级缓存。行很长的图像会再按列分块。
+     *
+     * @param image 欲处理的图像。
+     * @param halo 邻域处理需要的边缘宽度（象素）。
+     * @param tile_width 返回分块宽度（象素）。
+     * @param tile_height 返回分块高度（象素）。
+     */
+    template <class T>
+    void GetDefaultTileSize(const ImageDef<T> *image, int halo, int *tile_width, int *tile_height)
+    {
+      const size_t cache_bytes = 256 * 1024;
+      const size_t pixel_bytes = GetBytesPerPixel(image);
+
+      int w = image->Width;
+      if (static_cast<size_t>(w) * pixel_bytes > cache_bytes / 16)
+      {
+        w = static_cast<int>(cache_bytes / 16 / pixel_bytes);
+      }
+      w = MBL::Utility::GetMax(w, 4 * halo + 16);
+
+      size_t row_bytes = static_cast<size_t>(w + 2 * halo) * pixel_bytes;
+      int h = static_cast<int>(cache_bytes / row_bytes) - 2 * halo;
+      h = MBL::Utility::GetMax(h, 4 * halo + 16);
+
+      *tile_width = w;
+      *tile_height = h;
+    }
+
+    /**
+     * @brief 将图像的处理区域划分为分块。
+     *
+     * 处理区域按分块尺寸均匀划分，每个分块的有效区域都不小于分块尺寸（区域本身更小时除外），以免邻域滤波遇到过窄的分块。
+     *
+     * @param image 欲处理的图像。
+     * @param sub_area 处理子区，为0表示全图。只使用其外接矩形。
+     * @param halo 分块边缘宽度（象素）。
+     * @param tile_width 分块宽度（象素）。
+     * @param tile_height 分块高度（象素）。
+     * @param tiles 返回的分块。
+     */
+    template <class T>
+    void SplitImageTiles(const ImageDef<T> *image, const ImageSubArea *sub_area, int halo, int tile_width, int tile_height,
+                         std::vector<ImageTile> *tiles)
+    {
+      if (halo < 0 || tile_width <= 0 || tile_height <= 0) throw IllegalArgumentException();
+
+      int left, top, right, bottom;
+      if (sub_area == 0)
+      {
+        left = 0;
+        top = 0;
+        right = image->Width;
+        bottom = image->Height;
+      }
+      else
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, image->Width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, image->Height);
+      }
+
+      tiles->clear();
+      if (right <= left || bottom <= top) return;
+
+      int nx = MBL::Utility::GetMax((right - left) / tile_width, 1);
+      int ny = MBL::Utility::GetMax((bottom - top) / tile_height, 1);
+      tiles->reserve(static_cast<size_t>(nx) * ny);
+      for (int j = 0; j < ny; j++)
+      {
+        int y0 = top + static_cast<int>(static_cast<long long>(bottom - top) * j / ny);
+        int y1 = top + static_cast<int>(static_cast<long long>(bottom - top) * (j + 1) / ny);
+        for (int i = 0; i < nx; i++)
+        {
+          int x0 = left + static_cast<int>(static_cast<long long>(right - left) * i / nx);
+          int x1 = left + static_cast<int>(static_cast<long long>(right - left) * (i + 1) / nx);
+
+          ImageTile tile;
+          tile.Left = x0;
+          tile.Top = y0;
+          tile.Width = x1 - x0;
+          tile.Height = y1 - y0;
+          tile.OuterLeft = MBL::Utility::GetMax(x0 - halo, 0);
+          tile.OuterTop = MBL::Utility::GetMax(y0 - halo, 0);
+          tile.OuterWidth = MBL::Utility::GetMin(x1 + halo, image->Width) - tile.OuterLeft;
+          tile.OuterHeight = MBL::Utility::GetMin(y1 + halo, image->Height) - tile.OuterTop;
+          tiles->push_back(tile);
+        }
+      }
+    }
+
+    /**
+     * @brief 将图像分块并行处理。
+     *
+     * 该函数把处理区域划分为分块，用ParallelFor在多个线程上处理各个分块，空闲的线程会自动领取剩下的分块。
+     *
+     * 当halo为0时，处理函数直接得到指向原图像的ImageView，不复制任何数据，适用于逐点处理。当halo大于0时，每个分块连同
+     * 边缘从原图像复制出来交给处理函数，处理后只把有效区域写回原图像。分块的结果要等边缘伸入其有效区域的相邻分块都复制
+     * 完毕后才写回，因此分块之间不会互相影响，结果与整图处理相同，也不需要保留整幅源图像。处理函数在分块边上按照整图的
+     * 边界规则（如坐标截断）处理即可。
+     *
+     * 例如并行地对一幅图像做5×5滤波：
+     * @code
+     * ProcessImageTiles(image, 0, 2, [&](ImageDef<unsigned char> *tile) { CustomFilterImage(tile, 0, core, div, bias); });
+     * @endcode
+     *
+     * @param image 欲处理的图像，处理后该图像会被更新。
+     * @param sub_area 处理子区，为0表示全图。子区外的象素保持不变。
+     * @param halo 处理函数需要的邻域半径（象素）。
+     * @param kernel 处理函数，形如void(ImageDef<T> *tile)，会在多个线程中同时被调用，必须是可重入的。
+     * @param tile_width 分块宽度（象素），为0时使用GetDefaultTileSize的结果。
+     * @param tile_height 分块高度（象素），为0时使用GetDefaultTileSize的结果。
+     *
+     * @see SplitImageTiles
+     */
+    template <class T, class Kernel>
+    void ProcessImageTiles(ImageDef<T> *image, ImageSubArea *sub_area, int halo, Kernel kernel, int tile_width = 0, int tile_height = 0)
+    {
+      if (image == 0) throw NullPointerException();
+
+      if (tile_width <= 0 || tile_height <= 0)
+      {
+        GetDefaultTileSize(image, halo, &tile_width, &tile_height);
+      }
+
+      std::vector<ImageTile> tiles;
+      SplitImageTiles(image, sub_area, halo, tile_width, tile_height, &tiles);
+      if (tiles.empty()) return;
+
+      // 只有矩形子区可以直接按行写回，任意形状的子区需要逐点判断。
+      const bool masked = sub_area != 0 && sub_area->Pixels != 0;
+      const bool copied = halo > 0 || masked;
+      const int n = static_cast<int>(tiles.size());
+
+      // 分块按行排列，每行的列划分都相同。第i列分块的边缘伸入[cols[2i], cols[2i + 1]]列的有效区域，行也是一样。
+      int nx = 1;
+      while (nx < n && tiles[nx].Top == tiles[0].Top) nx++;
+      const int ny = n / nx;
+      std::vector<int> cols(2 * nx), rows(2 * ny);
+      for (int i = 0; i < nx; i++)
+      {
+        int a = i, b = i;
+        while (a > 0 && tiles[a - 1].Left + tiles[a - 1].Width > tiles[i].OuterLeft) a--;
+        while (b < nx - 1 && tiles[b + 1].Left < tiles[i].OuterLeft + tiles[i].OuterWidth) b++;
+        cols[2 * i] = a;
+        cols[2 * i + 1] = b;
+      }
+      for (int j = 0; j < ny; j++)
+      {
+        const ImageTile &tile = tiles[static_cast<size_t>(j) * nx];
+        int a = j, b = j;
+        while (a > 0 && tiles[static_cast<size_t>(a - 1) * nx].Top + tiles[static_cast<size_t>(a - 1) * nx].Height > tile.OuterTop) a--;
+        while (b < ny - 1 && tiles[static_cast<size_t>(b + 1) * nx].Top < tile.OuterTop + tile.OuterHeight) b++;
+        rows[2 * j] = a;
+        rows[2 * j + 1] = b;
+      }
+
+      // readers[k]是还没有复制的、边缘伸入第k个分块的其他分块数，results[k]是处理完毕但还不能写回的结果。
+      std::vector<int> readers(copied ? n : 0);
+      std::vector<ImageDef<T> *> results(copied ? n : 0);
+      for (int k = 0; k < static_cast<int>(readers.size()); k++)
+      {
+        const int i = k % nx, j = k / nx;
+        int cx = 0, cy = 0;
+        for (int t = 0; t < nx; t++) if (cols[2 * t] <= i && i <= cols[2 * t + 1]) cx++;
+        for (int t = 0; t < ny; t++) if (rows[2 * t] <= j && j <= rows[2 * t + 1]) cy++;
+        readers[k] = cx * cy - 1;
+      }
+      std::mutex lock;
+
+      // 把第k个分块的结果写回原图像。
+      auto write = [&](int k, ImageDef<T> *part)
+      {
+        const ImageTile &tile = tiles[k];
+        const int ox = tile.Left - tile.OuterLeft, oy = tile.Top - tile.OuterTop;
+        if (!masked)
+        {
+          const size_t wb = static_cast<size_t>(tile.Width) * GetBytesPerPixel(image);
+          for (int y = 0; y < tile.Height; y++)
+          {
+            memcpy(image->Pixels + GetUnitsOffset(image, tile.Left, tile.Top + y),
+                   part->Pixels + GetUnitsOffset(part, ox, oy + y), wb);
+          }
+        }
+        else
+        {
+          T buf[8]; //足够任何图像类型数据的缓冲区。
+          for (int y = 0; y < tile.Height; y++)
+          {
+            for (int x = 0; x < tile.Width; x++)
+            {
+              if (sub_area->IsFill(tile.Left + x, tile.Top + y))
+              {
+                ReadPixel(part, ox + x, oy + y, buf);
+                WritePixel(image, tile.Left + x, tile.Top + y, buf);
+              }
+            }
+          }
+        }
+      };
+
+      try
+      {
+        MBL::Utility::ParallelFor(0, n, [&](int k)
+        {
+          ImageDef<T> *part = 0;
+          std::vector<std::pair<int, ImageDef<T> *> > ready;
+          try
+          {
+            const ImageTile &tile = tiles[k];
+            if (!copied)
+            {
+              ImageView<T> view(image, tile.Left, tile.Top, tile.Width, tile.Height);
+              kernel(static_cast<ImageDef<T> *>(&view));
+              return;
+            }
+
+            part = CutImage(image, tile.OuterLeft, tile.OuterTop, tile.OuterWidth, tile.OuterHeight);
+
+            // 本分块的边缘已经复制，相邻分块中不再等待其他分块复制的结果可以写回了。
+            {
+              std::lock_guard<std::mutex> guard(lock);
+              const int i = k % nx, j = k / nx;
+              for (int v = rows[2 * j]; v <= rows[2 * j + 1]; v++)
+              {
+                for (int u = cols[2 * i]; u <= cols[2 * i + 1]; u++)
+                {
+                  const int t = v * nx + u;
+                  if (t != k && --readers[t] == 0 && results[t] != 0)
+                  {
+                    ready.push_back(std::make_pair(t, results[t]));
+                    results[t] = 0;
+                  }
+                }
+              }
+            }
+            for (size_t r = 0; r < ready.size(); r++)
+            {
+              write(ready[r].first, ready[r].second);
+              delete ready[r].second;
+              ready[r].second = 0;
+            }
+
+            kernel(part);
+
+            {
+              std::lock_guard<std::mutex> guard(lock);
+              if (readers[k] > 0)
+              {
+                results[k] = part;
+                part = 0;
+              }
+            }
+            if (part != 0) write(k, part);
+          }
+          catch (...)
+          {
+            for (size_t r = 0; r < ready.size(); r++) delete ready[r].second;
+            delete part;
+            throw;
+          }
+          delete part;
+        });
+      }
+      catch (...)
+      {
+        // 出错时可能有分块的结果还没有写回。
+        for (size_t k = 0; k < results.size(); k++) delete results[k];
+        throw;
+      }
+    }
+  }
+}
+
+#endif // __IMAGETILE_H__
@@ -0,0 +1,87 @@
+#ifndef __IMAGEVIEW_H__
+#define __IMAGEVIEW_H__
+
+/**
+ * @file
+ *
+ * @brief 包含不拥有数据的二维图像视图定义。
+ */
+
+namespace MBL
+{
+  namespace Image2D
+  {
+    /// 不拥有数据缓冲区的图像视图。
+    /**
+     * 图像视图直接引用已有的图像数据，可以是父图像中的一块矩形区域，也可以是行跨度大于每行数据量的外部缓冲区（如libtiff的
+     * 条带缓冲区或者按4字节对齐的位图数据）。视图对象析构时不会释放数据和调色板，调用者必须保证在视图使用期间被引用的数据有效。
+     *
+     * 视图是ImageDef的派生类，可以直接传递给接受ImageDef指针的处理函数，这些函数都按照GetUnitsPerRow返回的行跨度访问各行
+     * 数据。例如不复制数据直接处理父图像中的一块区域：
+     * @code
+     * ImageView<unsigned char> roi(image, 100, 100, 256, 256);
+     * ImageDef<unsigned char> *gray = CreateGrayImage(&roi);
+     * @endcode
+     *
+     * @see CutImage
+     * @see GetUnitsPerRow
+     */
+    template <class T>
+    class ImageView : public ImageDef<T>
+    {
+      public:
+        /**
+         * @brief 包裹外部缓冲区的构造函数。
+         *
+         * @param format 图像格式。
+         * @param data 图像数据指针。
+         * @param width 图像宽度（象素）。
+         * @param height 图像高度（象素）。
+         * @param pitch 相邻两行之间相隔的存储单元数，为0表示各行紧密排列。
+         */
+        ImageView(ImageFormat format, T *data, int width, int height, size_t pitch = 0)
+          : ImageDef<T>(format, data, width, height)
+        {
+          if (width < 0 || height < 0) throw IllegalArgumentException();
+
+          this->RowPitch = pitch;
+          if (pitch != 0 && pitch < static_cast<size_t>(width) * GetUnitsPerPixel(this)) throw IllegalArgumentException();
+        }
+
+        /**
+         * @brief 引用父图像中一块矩形区域的构造函数。
+         *
+         * 视图与父图像共享数据和调色板，对视图的修改会直接反映到父图像中。
+         *
+         * @param parent 父图像，可以是另一个视图。
+         * @param left 区域在父图像中的左边坐标（象素）。
+         * @param top 区域在父图像中的上边坐标（象素）。
+         * @param width 区域宽度（象素）。
+         * @param height 区域高度（象素）。
+         */
+        ImageView(ImageDef<T> *parent, int left, int top, int width, int height)
+          : ImageDef<T>(IMAGE_FORMAT_UNKNOWN, 0, 0, 0)
+        {
+          if (parent == 0) throw NullPointerException();
+          if (width < 0 || height < 0) throw IllegalArgumentException();
+          if (left < 0 || top < 0 || left + width > parent->Width || top + height > parent->Height)
+            throw IndexOutOfBoundsException();
+
+          this->Format = parent->Format;
+          this->Width = width;
+          this->Height = height;
+          this->UsedColor = parent->UsedColor;
+          this->Palette = parent->Palette;
+          this->Pixels = parent->Pixels + GetUnitsOffset(parent, left, top);
+          this->RowPitch = GetUnitsPerRow(parent);
+        }
+    };
+
+    /**
+     * @brief 简化声明用的8位图像视图类型定义。
+     */
+    typedef ImageView<unsigned char> ImageView8b;
+  }
+}
+
+#endif // __IMAGEVIEW_H__
@@ -24,10 +24,11 @@ namespace MBL
     template <class T>
     double RMSEEvaluation(ImageDef<T> *sourceimage, ImageDef<T> *fusionimage)
     {
-      int i, j, setof;
+      int i, j;
+      ptrdiff_t setof;
       double difference = 0;
       int nr = sourceimage->Height;
-      int nc = sourceimage->Width;
+      ptrdiff_t nc = sourceimage->Width;
       T *psourcedata, *pfusiondata, outdatas,outdataf;
       psourcedata = sourceimage->Pixels;
       pfusiondata = fusionimage->Pixels;
@@ -93,10 +94,11 @@ namespace MBL
 	template <class T>
     double EntropyEvaluation(ImageDef<T> *sourceimage)
     {
-      int i, j, k, setof;
+      int i, j, k;
+      ptrdiff_t setof;
       double entropy = 0, p[256];
       int nr = sourceimage->Height;
-      int nc = sourceimage->Width;
+      ptrdiff_t nc = sourceimage->Width;
       T *psourcedata, outdata;
       psourcedata = sourceimage->Pixels;
 
@@ -156,10 +158,11 @@ namespace MBL
     template <class T>
     double CERFEvaluation(ImageDef<T> *sourceimage, ImageDef<T> *fusionimage)
     {
-      int i, j, k, setof;
+      int i, j, k;
+      ptrdiff_t setof;
       double crossentropy = 0, ps[256], pf[256];
       int nr = sourceimage->Height;
-      int nc = sourceimage->Width;
+      ptrdiff_t nc = sourceimage->Width;
       T *psourcedata, *pfusiondata, outdatas, outdataf;
       psourcedata = sourceimage->Pixels;
       pfusiondata = fusionimage->Pixels;
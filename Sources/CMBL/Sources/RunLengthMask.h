@@ -0,0 +1,365 @@
+#ifndef __RUNLENGTHMASK_H__
+#define __RUNLENGTHMASK_H__
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * @file
+ *
+ * @brief 包含以行程编码表示的二值掩模，以及按行内连续段遍历处理子区的函数。
+ */
+
+namespace MBL
+{
+  namespace Image2D
+  {
+    /// 一行中连续的一段象素，范围为[Left, Right)。
+    class ImageSpan
+    {
+      public:
+        /// 段的左边坐标（象素），包含在段内。
+        int Left;
+        /// 段的右边坐标（象素），不包含在段内。
+        int Right;
+    };
+
+    /**
+     * @brief 按行从上到下、行内从左到右遍历处理子区中的连续段。
+     *
+     * 矩形子区每行只有一段；任意子区逐行扫描其数据，把连续的非0象素合并为一段。处理函数在段内不需要再调用IsFill。
+     * 子区超出图像的部分被舍去。
+     *
+     * @param sub_area 处理子区，为0表示全图。
+     * @param width 图像宽度（象素）。
+     * @param height 图像高度（象素）。
+     * @param f 处理函数，形如void(int y, int left, int right)，处理第y行的[left, right)。
+     */
+    template <class F>
+    void ForEachSubAreaSpan(ImageSubArea *sub_area, int width, int height, F f)
+    {
+      int left = 0, top = 0, right = width, bottom = height;
+      if (sub_area != 0)
+      {
+        left = MBL::Utility::GetMax(sub_area->Left, 0);
+        top = MBL::Utility::GetMax(sub_area->Top, 0);
+        right = MBL::Utility::GetMin(sub_area->Left + sub_area->Width, width);
+        bottom = MBL::Utility::GetMin(sub_area->Top + sub_area->Height, height);
+      }
+      if (right <= left) return;
+
+      if (sub_area == 0 || sub_area->Pixels == 0)
+      {
+        for (int y = top; y < bottom; y++) f(y, left, right);
+        return;
+      }
+
+      for (int y = top; y < bottom; y++)
+      {
+        const unsigned char *p = sub_area->Pixels + static_cast<size_t>(y) * sub_area->ImageWidth;
+        for (int x = left; x < right; x++)
+        {
+          if (p[x] == 0) continue;
+
+          const int l = x;
+          while (x < right && p[x] != 0) x++;
+          f(y, l, x);
+        }
+      }
+    }
+
+    /// 以行程编码表示的二值掩模。
+    /**
+     * 掩模按行存放若干互不重叠、从左到右排列的段，只记录被选中的象素，内存用量与段数成正比而与图像面积无关，适合表示
+     * 全切片图像上稀疏的组织区域或分割结果。掩模之间的交、并、差按行归并两组有序的段，不需要逐点计算。
+     *
+     * 处理函数用ForEachSpan逐段处理，段内没有逐点判断的分支。需要ImageSubArea的旧函数可以用CreateSubArea转换。
+     *
+     * @see ImageSubArea
+     */
+    class RunLengthMask
+    {
+      public:
+        /// 掩模对应图像的宽度（象素）。
+        int Width;
+        /// 掩模对应图像的高度（象素）。
+        int Height;
+
+      private:
+        std::vector<int> m_RowStart;    // 每行第一个段在m_Spans中的序号，共Height + 1个。
+        std::vector<ImageSpan> m_Spans;
+
+      public:
+        /**
+         * @brief 构造空掩模。
+         *
+         * @param width 图像宽度（象素）。
+         * @param height 图像高度（象素）。
+         */
+        RunLengthMask(int width, int height)
+          : Width(width),
+            Height(height),
+            m_RowStart(static_cast<size_t>(MBL::Utility::GetMax(height, 0)) + 1, 0)
+        {
+          if (width < 0 || height < 0) throw IllegalArgumentException();
+        }
+
+        /**
+         * @brief 由处理子区构造掩模。
+         *
+         * @param sub_area 处理子区，为0表示全图。子区超出图像的部分被舍去。
+         * @param width 图像宽度（象素）。
+         * @param height 图像高度（象素）。
+         */
+        RunLengthMask(ImageSubArea *sub_area, int width, int height)
+          : Width(width),
+            Height(height)
+        {
+          if (width < 0 || height < 0) throw IllegalArgumentException();
+
+          m_RowStart.reserve(static_cast<size_t>(height) + 1);
+          int y = 0;
+          ForEachSubAreaSpan(sub_area, width, height, [&](int line, int left, int right)
+          {
+            for (; y <= line; y++) m_RowStart.push_back(static_cast<int>(m_Spans.size()));
+            ImageSpan span = { left, right };
+            m_Spans.push_back(span);
+          });
+          for (; y <= height; y++) m_RowStart.push_back(static_cast<int>(m_Spans.size()));
+        }
+
+        /**
+         * @brief 由分割后的图像构造掩模，颜色等于object的象素被选中。
+         *
+         * @param image 源图像，必须是索引图像。
+         * @param object 目标颜色。
+         */
+        template <class T>
+        RunLengthMask(const ImageDef<T> *image, T object)
+          : Width(image->Width),
+            Height(image->Height)
+        {
+          if (image->Format != IMAGE_FORMAT_INDEX) throw UnsupportedFormatException();
+
+          m_RowStart.reserve(static_cast<size_t>(Height) + 1);
+          for (int y = 0; y < Height; y++)
+          {
+            m_RowStart.push_back(static_cast<int>(m_Spans.size()));
+            const T *p = GetRowPointer(image, y);
+            for (int x = 0; x < Width; x++)
+            {
+              if (p[x] != object) continue;
+
+              ImageSpan span;
+              span.Left = x;
+              while (x < Width && p[x] == object) x++;
+              span.Right = x;
+              m_Spans.push_back(span);
+            }
+          }
+          m_RowStart.push_back(static_cast<int>(m_Spans.size()));
+        }
+
+        /**
+         * @brief 取得段数。
+         *
+         * @return 所有行的段数之和。
+         */
+        int GetSpanCount() const
+        {
+          return static_cast<int>(m_Spans.size());
+        }
+
+        /**
+         * @brief 取得被选中的象素数。
+         *
+         * @return 象素数。
+         */
+        long long GetArea() const
+        {
+          long long area = 0;
+          for (size_t i = 0; i < m_Spans.size(); i++) area += m_Spans[i].Right - m_Spans[i].Left;
+          return area;
+        }
+
+        /**
+         * @brief 取得一行中的段。
+         *
+         * @param y 行号。
+         * @param count 返回该行的段数。
+         * @return 指向该行第一个段的指针。
+         */
+        const ImageSpan * GetRowSpans(int y, int *count) const
+        {
+          if (y < 0 || y >= Height) throw IndexOutOfBoundsException();
+
+          *count = m_RowStart[y + 1] - m_RowStart[y];
+          return m_Spans.data() + m_RowStart[y];
+        }
+
+        /**
+         * @brief 判断一个象素点是否被选中，在该行的段中二分查找。
+         *
+         * @return 返回true表示该点被选中，否则返回false。
+         */
+        bool IsFill(int x, int y) const
+        {
+          if (y < 0 || y >= Height) return false;
+
+          const ImageSpan *first = m_Spans.data() + m_RowStart[y], *last = m_Spans.data() + m_RowStart[y + 1];
+          const ImageSpan *p = std::upper_bound(first, last, x, [](int v, const ImageSpan &s) { return v < s.Left; });
+          return p != first && x < (p - 1)->Right;
+        }
+
+        /**
+         * @brief 按行从上到下、行内从左到右遍历所有的段。
+         *
+         * @param f 处理函数，形如void(int y, int left, int right)，处理第y行的[left, right)。
+         */
+        template <class F>
+        void ForEachSpan(F f) const
+        {
+          for (int y = 0; y < Height; y++)
+          {
+            for (int i = m_RowStart[y]; i < m_RowStart[y + 1]; i++) f(y, m_Spans[i].Left, m_Spans[i].Right);
+          }
+        }
+
+        /**
+         * @brief 取得掩模的外接矩形。
+         *
+         * @param left 返回外接矩形的左边坐标（象素）。
+         * @param top 返回外接矩形的上边坐标（象素）。
+         * @param width 返回外接矩形的宽度（象素），掩模为空时为0。
+         * @param height 返回外接矩形的高度（象素），掩模为空时为0。
+         */
+        void GetBounds(int *left, int *top, int *width, int *height) const
+        {
+          int l = Width, t = Height, r = 0, b = 0;
+          for (int y = 0; y < Height; y++)
+          {
+            if (m_RowStart[y] == m_RowStart[y + 1]) continue;
+            t = MBL::Utility::GetMin(t, y);
+            b = y + 1;
+            l = MBL::Utility::GetMin(l, m_Spans[m_RowStart[y]].Left);
+            r = MBL::Utility::GetMax(r, m_Spans[m_RowStart[y + 1] - 1].Right);
+          }
+          if (r <= l) l = t = r = b = 0;
+
+          *left = l;
+          *top = t;
+          *width = r - l;
+          *height = b - t;
+        }
+
+        /**
+         * @brief 创建与掩模相同的任意处理子区，供只接受ImageSubArea的函数使用。
+         *
+         * @return 子区对象，外接矩形为掩模的外接矩形，由调用者删除。
+         */
+        ImageSubArea * CreateSubArea() const
+        {
+          int left, top, width, height;
+          GetBounds(&left, &top, &width, &height);
+
+          ImageSubArea *area = ImageSubArea::CreateInstance(left, top, width, height, Width, Height, false);
+          memset(area->Pixels, 0, static_cast<size_t>(Width) * Height);
+          ForEachSpan([&](int y, int l, int r) { memset(area->Pixels + static_cast<size_t>(y) * Width + l, 1, r - l); });
+          return area;
+        }
+
+        /**
+         * @brief 求两个掩模的交集。
+         *
+         * @param a 掩模。
+         * @param b 掩模，尺寸必须与a相同。
+         * @return 两个掩模都选中的象素。
+         */
+        static RunLengthMask Intersect(const RunLengthMask &a, const RunLengthMask &b)
+        {
+          return _Combine(a, b, [](bool x, bool y) { return x && y; });
+        }
+
+        /**
+         * @brief 求两个掩模的并集。
+         *
+         * @param a 掩模。
+         * @param b 掩模，尺寸必须与a相同。
+         * @return 至少一个掩模选中的象素。
+         */
+        static RunLengthMask Unite(const RunLengthMask &a, const RunLengthMask &b)
+        {
+          return _Combine(a, b, [](bool x, bool y) { return x || y; });
+        }
+
+        /**
+         * @brief 求两个掩模的差集。
+         *
+         * @param a 掩模。
+         * @param b 掩模，尺寸必须与a相同。
+         * @return 被a选中而没有被b选中的象素。
+         */
+        static RunLengthMask Subtract(const RunLengthMask &a, const RunLengthMask &b)
+        {
+          return _Combine(a, b, [](bool x, bool y) { return x && !y; });
+        }
+
+      private:
+        // 逐行归并两组段的端点，op决定两个掩模的选中状态组合后是否选中。
+        template <class Op>
+        static RunLengthMask _Combine(const RunLengthMask &a, const RunLengthMask &b, Op op)
+        {
+          if (a.Width != b.Width || a.Height != b.Height) throw IllegalArgumentException();
+
+          RunLengthMask c(a.Width, a.Height);
+          c.m_Spans.reserve(a.m_Spans.size() + b.m_Spans.size());
+          for (int y = 0; y < a.Height; y++)
+          {
+            c.m_RowStart[y] = static_cast<int>(c.m_Spans.size());
+            int i = a.m_RowStart[y], j = b.m_RowStart[y];
+            const int ie = a.m_RowStart[y + 1], je = b.m_RowStart[y + 1];
+            bool in_a = false, in_b = false, in_c = false;
+            int left = 0;
+            while (i < ie || j < je)
+            {
+              // 下一个端点：段的起点或终点，取两个掩模中较小的一个。
+              const int xa = i < ie ? (in_a ? a.m_Spans[i].Right : a.m_Spans[i].Left) : a.Width + 1;
+              const int xb = j < je ? (in_b ? b.m_Spans[j].Right : b.m_Spans[j].Left) : b.Width + 1;
+              const int x = MBL::Utility::GetMin(xa, xb);
+              if (xa == x)
+              {
+                if (in_a) i++;
+                in_a = !in_a;
+              }
+              if (xb == x)
+              {
+                if (in_b) j++;
+                in_b = !in_b;
+              }
+
+              const bool now = op(in_a, in_b);
+              if (now && !in_c)
+              {
+                left = x;
+              }
+              else if (!now && in_c && x > left)
+              {
+                ImageSpan span = { left, x };
+                if (static_cast<int>(c.m_Spans.size()) > c.m_RowStart[y] && c.m_Spans.back().Right == left)
+                  c.m_Spans.back().Right = x;
+                else
+                  c.m_Spans.push_back(span);
+              }
+              in_c = now;
+            }
+          }
+          c.m_RowStart[a.Height] = static_cast<int>(c.m_Spans.size());
+          return c;
+        }
+
+    };
+
+  }
+}
+
+#endif // __RUNLENGTHMASK_H__
@@ -10,6 +10,7 @@
 
 #include "AutofocusOperator.h"
 #include <math.h>
+#include <vector>
 
 namespace MBL
 {
@@ -31,7 +32,7 @@ namespace MBL
       int k, position = 0;
       int num = image->SequenceNumber;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       long int focusoperator, operator_max;
       double mp, d1, d2, d3;
       long int *outarray = new long int [num];
@@ -267,6 +268,273 @@ namespace MBL
       return position;
     }
 
+    /**
+     * @brief 并行计算序列图像各帧的各种聚焦评价值。
+     *
+     * 各帧在多个线程上同时计算，每帧只遍历一次就得到全部评价值，见GetImageFocusMeasurement。需要比较几种算子或者同时
+     * 用几种算子判断时，比分别调用各个自动聚焦函数快得多。例如：
+     * @code
+     * std::vector<FocusMeasurement> measurements;
+     * GetSequenceFocusMeasurements(sequence, &measurements);
+     * int position = FindFocusFrame(measurements, FOCUS_METRIC_TENENGRAD);
+     * @endcode
+     *
+     * @param image 序列图像结构指针，必须是索引、RGB或BGR格式。
+     * @param measurements 返回各帧的聚焦评价值。
+     * @param step 拉普拉斯算子的步长，见LaplacianAutoFocusOperator。
+     * @param laplacian_threshold 拉普拉斯算子的阈值。
+     * @param tenengrad_threshold Tenengrad函数的阈值。
+     */
+    template <class T>
+    void GetSequenceFocusMeasurements(const ImageSequenceDef<T> *image, std::vector<FocusMeasurement> *measurements,
+                                      int step = 5, int laplacian_threshold = 0, int tenengrad_threshold = 0)
+    {
+      if (image == 0 || image->Pixels == 0 || measurements == 0) throw NullPointerException();
+
+      const int num = image->SequenceNumber;
+      measurements->resize(num);
+
+      MBL::Utility::ParallelFor(0, num, [&](int k)
+      {
+        ImageDef<T> *frame = ImageDef<T>::CreateWrapperInstance(image->Format, image->Pixels[k], image->Width, image->Height);
+        try
+        {
+          (*measurements)[k] = GetImageFocusMeasurement(frame, step, laplacian_threshold, tenengrad_threshold);
+        }
+        catch (...)
+        {
+          frame->Pixels = 0;
+          delete frame;
+          throw;
+        }
+        // 帧数据属于序列图像，不能随包装对象删除。
+        frame->Pixels = 0;
+        delete frame;
+      });
+    }
+
+    /**
+     * @brief 按某一种聚焦评价值找出聚焦层面。
+     *
+     * @param measurements 各帧的聚焦评价值。
+     * @param metric 评价值的种类。
+     * @return 评价值最大的帧号，有多个最大值时取第一个。
+     */
+    inline int FindFocusFrame(const std::vector<FocusMeasurement> &measurements, FocusMetric metric)
+    {
+      int position = 0;
+      for (int k = 1; k < static_cast<int>(measurements.size()); k++)
+      {
+        if (measurements[k].GetValue(metric) > measurements[position].GetValue(metric)) position = k;
+      }
+      return position;
+    }
+
+    /// 聚焦峰值位置的插值方法。
+    enum FocusInterpolation
+    {
+      /// 对最大值及其前后两帧的评价值拟合抛物线。
+      FOCUS_INTERPOLATION_PARABOLIC,
+      /// 对评价值的对数拟合抛物线，即高斯插值，与LaplacianAutoFocus中的mp相同。评价值不全为正时改用抛物线插值。
+      FOCUS_INTERPOLATION_GAUSSIAN
+    };
+
+    /// 在z方向扫描过程中逐帧进行自动聚焦的类。
+    /**
+     * 实时扫描时图像一帧一帧地从相机送来，不必像LaplacianAutoFocus那样先凑齐整个序列。每送入一帧就计算其聚焦评价值，
+     * 更新当前的最佳帧和插值得到的峰值位置。帧数据不被保留，只记录最佳帧及其前后两帧的评价值，内存用量与扫描的帧数
+     * 无关。越过峰值以后评价值持续下降，IsPeakPassed返回true，扫描可以提前结束。例如：
+     * @code
+     * AutofocusTracker tracker(FOCUS_METRIC_TENENGRAD);
+     * for (double z = z0; z < z1 && !tracker.IsPeakPassed(); z += dz)
+     * {
+     *   MoveStage(z);
+     *   tracker.PushFrame(Capture());
+     * }
+     * MoveStage(z0 + tracker.GetPeakPosition() * dz);
+     * @endcode
+     *
+     * @see GetImageFocusMeasurement
+     */
+    class AutofocusTracker
+    {
+      public:
+        /// 拉普拉斯算子的步长，见LaplacianAutoFocusOperator。
+        int Step;
+        /// 拉普拉斯算子的阈值。
+        int LaplacianThreshold;
+        /// Tenengrad函数的阈值。
+        int TenengradThreshold;
+
+      private:
+        FocusMetric m_Metric;
+        FocusInterpolation m_Interpolation;
+        double m_StopRatio;
+        int m_StopFrames;
+        int m_Count;
+        double m_LastScore;
+        int m_BestFrame;
+        double m_BestScore;
+        double m_BestPrevious;    // 最佳帧前一帧的评价值。
+        double m_BestNext;        // 最佳帧后一帧的评价值。
+        bool m_HasBestNext;
+        int m_Falling;            // 最佳帧之后连续低于m_StopRatio倍最大值的帧数。
+
+      public:
+        /**
+         * @brief 构造函数。
+         *
+         * @param metric 使用的聚焦评价值。
+         * @param interpolation 峰值位置的插值方法。
+         * @param stop_ratio 评价值低于最大值的该倍数时认为正在远离峰值，取值范围(0, 1)。
+         * @param stop_frames 连续有这么多帧远离峰值时认为已经越过峰值。
+         */
+        AutofocusTracker(FocusMetric metric = FOCUS_METRIC_LAPLACIAN, FocusInterpolation interpolation = FOCUS_INTERPOLATION_GAUSSIAN,
+                         double stop_ratio = 0.8, int stop_frames = 2)
+          : Step(5),
+            LaplacianThreshold(0),
+            TenengradThreshold(0),
+            m_Metric(metric),
+            m_Interpolation(interpolation),
+            m_StopRatio(stop_ratio),
+            m_StopFrames(stop_frames)
+        {
+          if (stop_ratio <= 0 || stop_ratio >= 1 || stop_frames < 1) throw IllegalArgumentException();
+          Reset();
+        }
+
+        /// 清除已送入的帧，开始新的扫描。
+        void Reset()
+        {
+          m_Count = 0;
+          m_LastScore = 0;
+          m_BestFrame = 0;
+          m_BestScore = 0;
+          m_BestPrevious = 0;
+          m_BestNext = 0;
+          m_HasBestNext = false;
+          m_Falling = 0;
+        }
+
+        /**
+         * @brief 送入一帧图像。
+         *
+         * @param frame 单幅图像，必须是索引、RGB或BGR图像，函数返回后不再使用。
+         * @return 该帧的聚焦评价值。
+         */
+        template <class T>
+        double PushFrame(const ImageDef<T> *frame)
+        {
+          FocusMeasurement m = GetImageFocusMeasurement(frame, Step, LaplacianThreshold, TenengradThreshold);
+          return PushScore(m.GetValue(m_Metric));
+        }
+
+        /**
+         * @brief 送入一帧的聚焦评价值，供用其它方法计算评价值的场合使用。
+         *
+         * @param score 聚焦评价值，越大表示聚焦越好。
+         * @return score。
+         */
+        double PushScore(double score)
+        {
+          const int k = m_Count++;
+          if (k == 0 || score > m_BestScore)
+          {
+            m_BestPrevious = m_LastScore;
+            m_BestFrame = k;
+            m_BestScore = score;
+            m_HasBestNext = false;
+            m_Falling = 0;
+          }
+          else
+          {
+            if (k == m_BestFrame + 1)
+            {
+              m_BestNext = score;
+              m_HasBestNext = true;
+            }
+            m_Falling = (score < m_BestScore * m_StopRatio) ? m_Falling + 1 : 0;
+          }
+          m_LastScore = score;
+          return score;
+        }
+
+        /**
+         * @brief 取得已送入的帧数。
+         *
+         * @return 帧数。
+         */
+        int GetFrameCount() const
+        {
+          return m_Count;
+        }
+
+        /**
+         * @brief 取得最后一帧的聚焦评价值。
+         *
+         * @return 评价值，还没有送入帧时为0。
+         */
+        double GetLastScore() const
+        {
+          return m_LastScore;
+        }
+
+        /**
+         * @brief 取得评价值最大的帧。
+         *
+         * @return 帧号，从0开始。
+         */
+        int GetBestFrame() const
+        {
+          return m_BestFrame;
+        }
+
+        /**
+         * @brief 取得最大的聚焦评价值。
+         *
+         * @return 评价值，还没有送入帧时为0。
+         */
+        double GetBestScore() const
+        {
+          return m_BestScore;
+        }
+
+        /**
+         * @brief 取得插值得到的峰值位置。
+         *
+         * 用最佳帧及其前后两帧的评价值插值。最佳帧是第一帧或者最后一帧时无法插值，返回最佳帧的帧号。
+         *
+         * @return 以帧号为单位的峰值位置，可以是小数。
+         */
+        double GetPeakPosition() const
+        {
+          if (m_BestFrame == 0 || !m_HasBestNext) return m_BestFrame;
+
+          double a = m_BestPrevious, b = m_BestScore, c = m_BestNext;
+          if (m_Interpolation == FOCUS_INTERPOLATION_GAUSSIAN && a > 0 && c > 0)
+          {
+            a = log(a);
+            b = log(b);
+            c = log(c);
+          }
+
+          // 过三点的抛物线的顶点，b最大，所以偏移量在[-0.5, 0.5]之间。
+          const double d = a - 2 * b + c;
+          if (d >= 0) return m_BestFrame;
+          return m_BestFrame + (a - c) / (2 * d);
+        }
+
+        /**
+         * @brief 判断是否已经越过峰值。
+         *
+         * @return 最佳帧之后已经连续有stop_frames帧的评价值低于最大值的stop_ratio倍时返回true。
+         */
+        bool IsPeakPassed() const
+        {
+          return m_Falling >= m_StopFrames;
+        }
+    };
+
   }// Image2D namespace
 }// MBL namespace
 
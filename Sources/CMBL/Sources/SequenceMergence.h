@@ -1,6 +1,9 @@
 #ifndef __SEQUENCEMERGENCE_H__
 #define __SEQUENCEMERGENCE_H__
 
+#include <type_traits>
+#include <vector>
+
 /**
  * @file
  *
@@ -23,10 +26,10 @@ namespace MBL
     ImageDef<T> * MinMergeSequenceIntoDEM(ImageSequenceDef<T> *image)
     {
       int i, j, k, kmark;
-      int setof;
+      ptrdiff_t setof;
       T outdata = 0, *pdata, *pDEM, min;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
@@ -104,10 +107,10 @@ namespace MBL
     ImageDef<T> * MaxMergeSequenceIntoDEM(ImageSequenceDef<T> *image)
     {
       int i, j, k, kmark;
-      int setof;
+      ptrdiff_t setof;
       T outdata = 0, *pdata, *pDEM, max;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
@@ -186,11 +189,11 @@ namespace MBL
     ImageDef<T> * ContrastMergeSequenceIntoDEM(ImageSequenceDef<T> *image)
     {
       int i, j, k, kmark,kmark1,kmark2;
-      double average, diff_max, diff;
-      int setof;
+      double average, diff;
+      ptrdiff_t setof;
       T outdata = 0, *pdata, *pDEM, min, max, sum;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
@@ -262,15 +265,9 @@ namespace MBL
           diff = fabs(max - average) - fabs(min - average);
 
           if (diff > 0)
-          {
-            diff_max = max;
             kmark = kmark2;
-          }
           else
-          {
-            diff_max = min;
             kmark = kmark1;
-          }
 
           if (kmark > 255)
             kmark = 255;
@@ -297,10 +294,10 @@ namespace MBL
     {
       int i, j, k, m, n, kmark;
       double average, cova_max, cova, cova_sum;
-      int setof;
+      ptrdiff_t setof;
       T outdata = 0, *pdata, *pDEM;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
@@ -416,10 +413,147 @@ namespace MBL
       heightscale = int(totalheight / proport);
       return heightscale;
     }
+    // 计算一帧中第y行的改进拉普拉斯值，RGB图像只取绿色分量。不大于阈值的值记为0，[step, width - step)以外也记为0。
+    template <int UNITS, class T>
+    void _GetMergeLaplacianRow(const T *pixels, int width, int y, int step, int threshold, int *out)
+    {
+      const int G = UNITS == 1 ? 0 : 1;
+      const T *c = pixels + static_cast<size_t>(y) * width * UNITS + G;
+      const T *u = c - static_cast<ptrdiff_t>(step) * width * UNITS;
+      const T *d = c + static_cast<ptrdiff_t>(step) * width * UNITS;
+      const int s = step * UNITS;
+
+      for (int x = 0; x < step && x < width; x++) out[x] = 0;
+      for (int x = step; x < width - step; x++)
+      {
+        const int k = x * UNITS;
+        const int v = abs(2 * c[k] - c[k - s] - c[k + s]) + abs(2 * c[k] - u[k] - d[k]);
+        out[x] = v > threshold ? v : 0;
+      }
+      for (int x = MBL::Utility::GetMax(width - step, step); x < width; x++) out[x] = 0;
+    }
+
+    // 融合[top, bottom)行。每帧保存窗口内各行的拉普拉斯值和按列累加的窗口和，换行时只加入新行、减去旧行，再沿行滑动
+    // 求出各点的窗口和，最后逐点取窗口和最大的帧。
+    template <int UNITS, class T>
+    void _LaplacianMergeBand(const ImageSequenceDef<T> *image, int top, int bottom, int window_size, int step, int threshold,
+                             int heightscale, ImageDef<T> *DEM, ImageDef<T> *GAUSS)
+    {
+      const int nc = image->Width, num = image->SequenceNumber;
+      const int margin = window_size + step;
+      const int window_length = window_size * 2 + 1;
+      const size_t frame_rows = static_cast<size_t>(window_length) * nc;
+
+      std::vector<int> rows(frame_rows * num);               // 各帧窗口内各行的拉普拉斯值，按行号循环存放。
+      std::vector<int> columns(static_cast<size_t>(num) * nc); // 各帧按列累加的窗口和。
+      std::vector<int> energy(static_cast<size_t>(num) * nc);  // 各帧当前行各点的窗口和。
+      std::vector<int> line(nc), best(nc), mark(nc);
+
+      for (int i = top; i < bottom; i++)
+      {
+        for (int k = 0; k < num; k++)
+        {
+          int *ring = &rows[frame_rows * k];
+          int *col = &columns[static_cast<size_t>(k) * nc];
+          if (i == top)
+          {
+            for (int x = 0; x < nc; x++) col[x] = 0;
+            for (int m = -window_size; m <= window_size; m++)
+            {
+              int *r = ring + static_cast<size_t>((i + m) % window_length) * nc;
+              _GetMergeLaplacianRow<UNITS>(image->Pixels[k], nc, i + m, step, threshold, r);
+              for (int x = 0; x < nc; x++) col[x] += r[x];
+            }
+          }
+          else
+          {
+            // 第i + window_size行替换循环缓冲区中的第i - window_size - 1行。
+            int *r = ring + static_cast<size_t>((i + window_size) % window_length) * nc;
+            _GetMergeLaplacianRow<UNITS>(image->Pixels[k], nc, i + window_size, step, threshold, &line[0]);
+            for (int x = 0; x < nc; x++)
+            {
+              col[x] += line[x] - r[x];
+              r[x] = line[x];
+            }
+          }
+
+          int *e = &energy[static_cast<size_t>(k) * nc];
+          int sum = 0;
+          for (int x = margin - window_size; x <= margin + window_size; x++) sum += col[x];
+          e[margin] = sum;
+          for (int j = margin + 1; j < nc - margin; j++)
+          {
+            sum += col[j + window_size] - col[j - window_size - 1];
+            e[j] = sum;
+          }
+        }
+
+        for (int j = margin; j < nc - margin; j++)
+        {
+          best[j] = 0;
+          mark[j] = 0;
+        }
+        for (int k = 0; k < num; k++)
+        {
+          const int *e = &energy[static_cast<size_t>(k) * nc];
+          for (int j = margin; j < nc - margin; j++)
+          {
+            const bool larger = e[j] > best[j];
+            best[j] = larger ? e[j] : best[j];
+            mark[j] = larger ? k : mark[j];
+          }
+        }
+
+        T *pDEM = GetRowPointer(DEM, i);
+        for (int j = margin; j < nc - margin; j++) pDEM[j] = (T)MBL::Utility::GetMin(mark[j], 255);
+
+        if (GAUSS == 0) continue;
+
+        T *pGuss = GetRowPointer(GAUSS, i);
+        for (int j = margin; j < nc - margin; j++)
+        {
+          const int kmark = mark[j];
+          double mp = kmark;
+          if (kmark != 0 && kmark != num - 1)
+          {
+            const double f0 = energy[static_cast<size_t>(kmark - 1) * nc + j];
+            const double f1 = energy[static_cast<size_t>(kmark) * nc + j];
+            const double f2 = energy[static_cast<size_t>(kmark + 1) * nc + j];
+            if (f0 > 0 && f2 > 0)
+            {
+              const double d1 = (log(f1) - log(f2)) * (2 * kmark - 1);
+              const double d2 = (log(f1) - log(f0)) * (- 2 * kmark - 1);
+              const double d3 = 2 * (2 * log(f1) - log(f2) - log(f0));
+              mp = d1/d3 - d2/d3;
+            }
+          }
+          pGuss[j] = (T)(heightscale - (mp * heightscale / MBL::Utility::GetMax(num - 1, 1) + 0.5));
+        }
+      }
+    }
+
+    // 边缘处理：图像边上margin宽的象素取最近的已计算象素的值。
+    template <class T>
+    void _FillMergeMargin(ImageDef<T> *image, int margin)
+    {
+      const int nr = image->Height, nc = image->Width;
+      for (int i = 0; i < nr; i++)
+      {
+        T *p = GetRowPointer(image, i);
+        const int si = MBL::Utility::Clamp(i, margin, nr - margin - 1);
+        if (si != i) memcpy(p + margin, GetRowPointer(image, si) + margin, (nc - 2 * margin) * sizeof(T));
+        for (int j = 0; j < margin; j++) p[j] = p[margin];
+        for (int j = nc - margin; j < nc; j++) p[j] = p[nc - margin - 1];
+      }
+    }
+
     /// 序列图像深度聚焦的一种方法——改进拉普拉斯算法。
     /**
      * 使用改进拉普拉斯算子，找到序列中各点聚焦算子最大值所在的层。函数生成DEM高度索引图结构并返回。
      *
+     * 各帧的窗口和用滑动窗口求出：每行只计算新进入窗口的一行拉普拉斯值，按列累加后再沿行滑动，计算量与窗口大小无关。
+     * 图像按行分成条带在多个线程上并行处理。
+     *
      * @param image 序列图像结构指针，必须是有效的内存中的序列图像。
      * @param DEM 高度索引图像结构指针，若为有效的内存中的图像并在外部已分配好图像数据内存，其格式必须是灰度索引图，尺寸
      *            必须与序列图像一致。若不是有效的内存中的图像，则分配相应的内存，并按上述格式与大小填写相应数据成员的内容。
@@ -436,18 +570,13 @@ namespace MBL
     template <class T>
     void  LaplacianMergeSequenceIntoDEM(ImageSequenceDef<T> *image, ImageDef<T> *DEM, ImageDef<T> *GAUSS, int window_size, int step, int threshold, int heightscale = 255)
     {
-      int i, j, k, m, n, ii, jj, kmark, sum;
-      int lap_max, lap_sum;
-      T cendata = 0, leftdata = 0, rightdata = 0, updata = 0, downdata = 0, *pdata, *pDEM, *pGuss;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
       int margin = window_size + step;
-      int window_length = window_size * 2 + 1;
-      int array_length = window_length * window_length;
-      double mp, d1, d2, d3;
 
       if(heightscale < 1 || heightscale > 255) throw IllegalArgumentException();
+      if (window_size < 0 || step < 0) throw IllegalArgumentException();
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
       switch (image->Format)
@@ -470,7 +599,6 @@ namespace MBL
         DEM->Height = nr;
         DEM->Pixels = new T[nc * nr];
       }
-      pDEM = DEM->Pixels;
 
       if (GAUSS != 0)
       {
@@ -482,262 +610,37 @@ namespace MBL
           GAUSS->Height = nr;
           GAUSS->Pixels = new T[nc * nr];
         }
-        pGuss = GAUSS->Pixels;
-      }
-      else
-      {
-        pGuss = 0;
-      }
-
-      int **Warray = new int *[num];
-      for (i = 0; i < num; i++)
-      {
-        Warray[i] = new int[array_length];
-      }
-
-      //Create the lapcacion image from source images
-      for (i = margin; i < nr - margin; i++)
-      {
-        for (k = 0; k < num; k++)
-        {
-          for (m = -window_size; m <= window_size; m++)
-          {
-            for (n = -window_size; n <= window_size; n++)
-            {
-              pdata = image->Pixels[k];
-              switch (image->Format)
-              {
-                case IMAGE_FORMAT_INDEX:
-                  cendata = *(pdata + (i + m) * nc + (margin + n));
-                  leftdata = *(pdata + (i + m) * nc + (margin + n) - step);
-                  rightdata = *(pdata + (i + m) * nc + (margin + n) + step);
-                  updata = *(pdata + ((i + m) - step) * nc + (margin + n));
-                  downdata = *(pdata + ((i + m) + step) * nc + (margin + n));
-
-                  break;
-
-                case IMAGE_FORMAT_RGB:
-                case IMAGE_FORMAT_BGR:
-                  cendata = *(pdata + ((i + m) * nc + (margin + n)) * 3 + 1);
-                  leftdata = *(pdata + ((i + m) * nc + (margin + n - step)) * 3 + 1);
-                  rightdata = *(pdata + ((i + m) * nc + (margin + n + step)) * 3 + 1);
-                  updata = *(pdata + ((i + m - step) * nc + (margin + n)) * 3 + 1);
-                  downdata = *(pdata + ((i + m + step) * nc + (margin + n)) * 3 + 1);
-
-                  break;
-
-                default:
-                  break;
-              }
-              sum = abs(2 * cendata - leftdata - rightdata) + abs(2 * cendata - updata - downdata);
-              Warray[k][(n + window_size) * window_length + (m + window_size)] = sum;
-            }
-          }
-        }
-
-        for (j = margin; j < nc - margin; j++)
-        {
-          lap_max = 0;
-          kmark = 0;
-          int *f = new int [num];
-
-          for (k = 0; k < num; k++)
-          {
-            lap_sum = 0;
-
-            if (j != margin)
-            {
-              for (jj = 0; jj < array_length - window_length; jj++)
-              {
-                Warray[k][jj] = Warray[k][jj + window_length];
-              }
-
-              for (m = -window_size; m <= window_size; m++)
-              {
-                pdata = image->Pixels[k];
-                switch (image->Format)
-                {
-                  case IMAGE_FORMAT_INDEX:
-                    cendata = *(pdata + (i + m) * nc + (j + window_size));
-                    leftdata = *(pdata + (i + m) * nc + (j + window_size) - step);
-                    rightdata = *(pdata + (i + m) * nc + (j + window_size) + step);
-                    updata = *(pdata + ((i + m) - step) * nc + (j + window_size));
-                    downdata = *(pdata + ((i + m) + step) * nc + (j + window_size));
-
-                    break;
-
-                  case IMAGE_FORMAT_RGB:
-                  case IMAGE_FORMAT_BGR:
-                    cendata = *(pdata + ((i + m) * nc + (j + window_size)) * 3 + 1);
-
-                    jj = j + window_size - step;
-                    leftdata = *(pdata + ((i + m) * nc + jj) * 3 + 1);
-
-                    jj = j + window_size + step;
-                    rightdata = *(pdata + ((i + m) * nc + jj) * 3 + 1);
-
-                    jj = i + m - step;
-                    updata = *(pdata + (jj * nc + (j + window_size)) * 3 + 1);
-
-                    jj = i + m + step;
-                    downdata = *(pdata + (jj * nc + (j + window_size)) * 3 + 1);
-
-                    break;
-
-                  default:
-                    break;
-                }
-                sum = abs(2 * cendata - leftdata - rightdata) + abs(2 * cendata - updata - downdata);
-                Warray[k][m + window_size + array_length - window_length] = sum;
-              }
-            }
-
-            for (ii = 0; ii < array_length; ii++)
-            {
-              if (Warray[k][ii] > threshold)
-              {
-                lap_sum += Warray[k][ii];
-              }
-            }
-
-            f[k] = lap_sum;
-
-            if (lap_sum > lap_max)
-            {
-              lap_max = lap_sum;
-              kmark = k;
-            }
-          }//end of k
-
-          if (kmark > 255)
-            kmark = 255;
-          else if (kmark < 0)
-            kmark = 0;
-
-          *(pDEM + i * nc + j) = (T)kmark;
-
-          if (pGuss != 0)
-          {
-            if (kmark != 0 && kmark != num - 1)
-            {
-              d1 = (log((double)f[kmark]) - log((double)f[kmark + 1])) * (2 * kmark - 1);
-              d2 = (log((double)f[kmark]) - log((double)f[kmark - 1])) * (- 2 * kmark - 1);
-              d3 = 2 * (2 * log((double)f[kmark]) - log((double)f[kmark + 1]) -log((double)f[kmark - 1]));
-              mp = d1/d3 - d2/d3;
-            }
-            else mp = kmark;
-            delete f;
-            *(pGuss + i * nc + j) = (T)(heightscale - (mp * heightscale / (num - 1) + 0.5));
-          }
-        }
       }
 
-      //边缘处理
-      for (i = 0; i < margin; i++)
+      // 图像太小，没有可以计算的象素。
+      if (nr <= 2 * margin || nc <= 2 * margin)
       {
-        for (j = 0; j < nc; j++)
+        memset(DEM->Pixels, 0, GetUnitsOfPixelData(DEM) * sizeof(T));
+        if (GAUSS != 0)
         {
-          if (j < margin)
-          {
-            *(pDEM + i * nc + j) = *(pDEM + margin * nc + margin);
-          }
-          else
-          {
-            if (j >= (nc - margin))
-              *(pDEM + i * nc + j) = *(pDEM +  margin * nc + (nc - margin - 1));
-            else
-              *(pDEM + i * nc + j) = *(pDEM +  margin * nc + j);
-          }
+          T v = (T)(heightscale - 0.5);
+          FillImage(GAUSS, &v);
         }
+        return;
       }
 
-      for (i = nr - margin; i < nr; i++)
-      {
-        for (j = 0; j < nc; j++)
-        {
-          if (j < margin)
-          {
-            *(pDEM + i * nc + j) = *(pDEM + (nr - margin - 1) * nc + margin);
-          }
-          else
-          {
-            if (j >= (nc - margin))
-              *(pDEM + i * nc + j) = *(pDEM +  (nr - margin - 1) * nc + (nc - margin - 1));
-            else
-              *(pDEM + i * nc + j) = *(pDEM +  (nr - margin - 1) * nc + j);
-          }
-        }
-      }
+      // 按行分成条带并行处理，各条带只在开始时多计算窗口上方的几行。
+      const int BAND = 32;
+      const int bands = (nr - 2 * margin + BAND - 1) / BAND;
+      const bool indexed = image->Format == IMAGE_FORMAT_INDEX;
 
-      for (i = margin; i < nr - margin; i++)
+      MBL::Utility::ParallelFor(0, bands, [&](int b)
       {
-        for (j = 0; j < margin; j++)
-        {
-          *(pDEM + i * nc + j) = *(pDEM +  i * nc + margin);
-        }
+        const int top = margin + b * BAND, bottom = MBL::Utility::GetMin(top + BAND, nr - margin);
+        if (indexed)
+          _LaplacianMergeBand<1>(image, top, bottom, window_size, step, threshold, heightscale, DEM, GAUSS);
+        else
+          _LaplacianMergeBand<3>(image, top, bottom, window_size, step, threshold, heightscale, DEM, GAUSS);
+      });
 
-        for (j = nc - margin; j < nc; j++)
-        {
-          *(pDEM + i * nc + j) = *(pDEM +  i * nc + (nc - margin - 1));
-        }
-      }
       //边缘处理
-      if (pGuss != 0)
-      {
-        for (i = 0; i < margin; i++)
-        {
-          for (j = 0; j < nc; j++)
-          {
-            if (j < margin)
-            {
-              *(pGuss + i * nc + j) = *(pGuss + margin * nc + margin);
-            }
-            else
-            {
-              if (j >= (nc - margin))
-                *(pGuss + i * nc + j) = *(pGuss +  margin * nc + (nc - margin - 1));
-              else
-                *(pGuss + i * nc + j) = *(pGuss +  margin * nc + j);
-            }
-          }
-        }
-
-        for (i = nr - margin; i < nr; i++)
-        {
-          for (j = 0; j < nc; j++)
-          {
-            if (j < margin)
-            {
-              *(pGuss + i * nc + j) = *(pGuss + (nr - margin - 1) * nc + margin);
-            }
-            else
-            {
-              if (j >= (nc - margin))
-                *(pGuss + i * nc + j) = *(pGuss +  (nr - margin - 1) * nc + (nc - margin - 1));
-              else
-                *(pGuss + i * nc + j) = *(pGuss +  (nr - margin - 1) * nc + j);
-            }
-          }
-        }
-
-        for (i = margin; i < nr - margin; i++)
-        {
-          for (j = 0; j < margin; j++)
-          {
-            *(pGuss + i * nc + j) = *(pGuss +  i * nc + margin);
-          }
-          for (j = nc - margin; j < nc; j++)
-          {
-            *(pGuss + i * nc + j) = *(pGuss +  i * nc + (nc - margin - 1));
-          }
-        }
-      }
-
-      for (i = 0; i < num; i++)
-      {
-        delete [] Warray[i];
-      }
-      delete [] Warray;
+      _FillMergeMargin(DEM, margin);
+      if (GAUSS != 0) _FillMergeMargin(GAUSS, margin);
     }
 
     /// 序列图像深度聚焦的一种方法——tenengrad算法。
@@ -747,19 +650,21 @@ namespace MBL
      * @param image 序列图像结构指针，必须是有效的内存中的序列图像。
      * @param window_size 窗口的大小。计算拉普拉斯值的总和时使用的窗口。如window_size = 1时，窗口大小为
      *                    2 × window_size + 1 = 3， 即3×3窗口。一般选择经验值5。
-     * @param threshold 阈值。拉普拉斯算子大于阈值的才参与汇总，小于阈值的被忽略。一般选择经验值0。
+     * @param threshold 未使用，所有梯度都参与汇总，相当于阈值为0。保留这个参数只是为了兼容原有的调用。
      * @return 高度索引图的指针，使用完毕后必须将其释放。
      */
     template <class T>
     ImageDef<T> * TenengradMergeSequenceIntoDEM(ImageSequenceDef<T> *image, int window_size, int threshold)
     {
+      (void)threshold;
+
       int i, j, k, m, n, kmark;
       int ten_max, ten_sum, soblex, sobley, grad;
-      int setof;
+      ptrdiff_t setof;
       T r, g, b, *pdata, *pDEM, leftupdata = 0, leftcendata = 0, leftdowndata = 0, rightupdata = 0;
       T rightcendata = 0, rightdowndata = 0, cenupdata = 0, cendowndata = 0;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
       int margin = window_size + 1;
 
@@ -932,10 +837,10 @@ namespace MBL
     ImageDef<T> * MontageSequenceDEM(ImageSequenceDef<T> *image, ImageDef<T> *DEM)
     {
       int i, j, kmark;
-      int setof;
+      ptrdiff_t setof;
       T *pdata, *pout, *pDEM;
       int nr = image->Height;
-      int nc = image->Width;
+      ptrdiff_t nc = image->Width;
       int num = image->SequenceNumber;
 
       if (num < 1 || image->Pixels == 0 ) throw NullPointerException();
@@ -987,6 +892,464 @@ namespace MBL
       return imgout;
     }
 
+    /// 逐帧融合序列图像的方法。
+    enum SequenceMergeMethod
+    {
+      /// 最大灰度法，见MaxMergeSequenceIntoDEM。
+      SEQUENCE_MERGE_MAX,
+      /// 最大离差法，见ContrastMergeSequenceIntoDEM。
+      SEQUENCE_MERGE_CONTRAST,
+      /// tenengrad算法，见TenengradMergeSequenceIntoDEM。
+      SEQUENCE_MERGE_TENENGRAD
+    };
+
+    /// 逐帧接收图像进行序列图像融合的类。
+    /**
+     * MaxMergeSequenceIntoDEM等函数要求整个序列同时放在内存中，20幅4K的RGB图像就需要约1GB。这个类每次接收一帧，只保留
+     * 各点当前最好的评价值、高度索引图和聚焦图像，内存用量与帧数无关，相当于几帧图像。融合可以与采集同时进行，所有帧
+     * 送入后调用Finish得到结果。高度索引图和聚焦图像与对应的DEM函数加MontageSequenceDEM的结果相同，帧号超过255的与
+     * 那些函数一样记为255，聚焦图像也取自第255帧，为此超过256帧时要多保存一帧。tenengrad算法只在threshold为0时相同，
+     * TenengradMergeSequenceIntoDEM不使用threshold参数。例如：
+     * @code
+     * SequenceMerger<unsigned char> merger(IMAGE_FORMAT_RGB, width, height, SEQUENCE_MERGE_TENENGRAD, 2);
+     * for (int z = 0; z < frames; z++)
+     * {
+     *   ImageDef<unsigned char> *frame = Capture(z);
+     *   merger.PushFrame(frame);
+     *   delete frame;
+     * }
+     * merger.Finish();
+     * SaveImage(merger.GetMontage());
+     * @endcode
+     *
+     * @see MontageSequenceDEM
+     */
+    template <class T>
+    class SequenceMerger
+    {
+      private:
+        // 8位图像的窗口梯度平方和放得进int，与TenengradMergeSequenceIntoDEM相同。
+        typedef typename std::conditional<sizeof(T) == 1, int, long long>::type G;
+
+        ImageFormat m_Format;
+        int m_Width;
+        int m_Height;
+        int m_Units;
+        SequenceMergeMethod m_Method;
+        int m_WindowSize;
+        int m_Threshold;
+        int m_Count;
+        bool m_Finished;
+        ImageDef<T> *m_DEM;       // 最大值所在的帧。
+        ImageDef<T> *m_Montage;   // 最大值所在帧的象素。
+        ImageDef<T> *m_DEM2;      // 最大离差法中最小值所在的帧。
+        ImageDef<T> *m_Montage2;  // 最大离差法中最小值所在帧的象素。
+        ImageDef<T> *m_Frame255;  // 第255帧，之后的帧在高度索引图中都记为255，聚焦图像从这一帧取象素。
+        std::vector<T> m_Max;
+        std::vector<T> m_Min;
+        std::vector<unsigned int> m_Sum;
+        std::vector<G> m_Energy;
+
+      public:
+        /**
+         * @brief 构造函数。
+         *
+         * @param format 图像格式，必须是索引、RGB或BGR格式。
+         * @param width 图像宽度（象素）。
+         * @param height 图像高度（象素）。
+         * @param method 融合方法。
+         * @param window_size tenengrad算法的窗口大小，窗口为(2 × window_size + 1)×(2 × window_size + 1)。
+         * @param threshold tenengrad算法的阈值，各点梯度平方和大于阈值的才参与窗口汇总，0表示全部汇总。
+         */
+        SequenceMerger(ImageFormat format, int width, int height, SequenceMergeMethod method, int window_size = 2,
+                       int threshold = 0)
+          : m_Format(format),
+            m_Width(width),
+            m_Height(height),
+            m_Units(format == IMAGE_FORMAT_INDEX ? 1 : 3),
+            m_Method(method),
+            m_WindowSize(window_size),
+            m_Threshold(threshold),
+            m_Count(0),
+            m_Finished(false),
+            m_DEM(0),
+            m_Montage(0),
+            m_DEM2(0),
+            m_Montage2(0),
+            m_Frame255(0)
+        {
+          if (width <= 0 || height <= 0 || window_size < 0) throw IllegalArgumentException();
+          switch (format)
+          {
+            case IMAGE_FORMAT_INDEX:
+            case IMAGE_FORMAT_RGB:
+            case IMAGE_FORMAT_BGR:
+              break;
+            default:
+              throw UnsupportedFormatException();
+          }
+
+          const size_t n = static_cast<size_t>(width) * height;
+          const T max_value = ImageDefTraits<T>::MaxValue;
+          try
+          {
+            m_DEM = ImageDef<T>::CreateInstance(IMAGE_FORMAT_INDEX, width, height);
+            m_Montage = ImageDef<T>::CreateInstance(format, width, height);
+            switch (method)
+            {
+              case SEQUENCE_MERGE_MAX:
+                m_Max.assign(n, 0);
+                break;
+              case SEQUENCE_MERGE_CONTRAST:
+                m_DEM2 = ImageDef<T>::CreateInstance(IMAGE_FORMAT_INDEX, width, height);
+                m_Montage2 = ImageDef<T>::CreateInstance(format, width, height);
+                m_Max.assign(n, 0);
+                m_Min.assign(n, max_value);
+                m_Sum.assign(n, 0);
+                break;
+              case SEQUENCE_MERGE_TENENGRAD:
+                m_Energy.assign(n, 0);
+                break;
+              default:
+                throw IllegalArgumentException();
+            }
+          }
+          catch (...)
+          {
+            _Release();
+            throw;
+          }
+          memset(m_DEM->Pixels, 0, GetUnitsOfPixelData(m_DEM) * sizeof(T));
+          if (m_DEM2 != 0) memset(m_DEM2->Pixels, 0, GetUnitsOfPixelData(m_DEM2) * sizeof(T));
+        }
+
+        /// 析构函数。
+        ~SequenceMerger()
+        {
+          _Release();
+        }
+
+        /**
+         * @brief 取得已送入的帧数。
+         *
+         * @return 帧数。
+         */
+        int GetFrameCount() const
+        {
+          return m_Count;
+        }
+
+        /**
+         * @brief 送入一帧图像。
+         *
+         * 图像按行分成条带在多个线程上并行处理，函数返回后不再使用该帧。
+         *
+         * @param frame 单幅图像，格式和尺寸必须与构造时相同，可以是ImageView。
+         *
+         * @exception IllegalArgumentException 已经调用过Finish。
+         * @exception UnmatchedImageException 图像的格式或者尺寸不正确。
+         */
+        void PushFrame(const ImageDef<T> *frame)
+        {
+          if (frame == 0 || frame->Pixels == 0) throw NullPointerException();
+          if (m_Finished) throw IllegalArgumentException();
+          if (frame->Format != m_Format || frame->Width != m_Width || frame->Height != m_Height) throw UnmatchedImageException();
+
+          // 没有更好的帧时取第一帧，与MontageSequenceDEM中高度为0的象素相同。
+          const size_t wb = static_cast<size_t>(m_Width) * m_Units * sizeof(T);
+          if (m_Count == 0)
+          {
+            for (int y = 0; y < m_Height; y++)
+            {
+              memcpy(GetRowPointer(m_Montage, y), GetRowPointer(frame, y), wb);
+              if (m_Montage2 != 0) memcpy(GetRowPointer(m_Montage2, y), GetRowPointer(frame, y), wb);
+            }
+          }
+          else if (m_Count == 255)
+          {
+            m_Frame255 = ImageDef<T>::CreateInstance(m_Format, m_Width, m_Height);
+            for (int y = 0; y < m_Height; y++) memcpy(GetRowPointer(m_Frame255, y), GetRowPointer(frame, y), wb);
+          }
+          const ImageDef<T> *source = m_Count > 255 ? m_Frame255 : frame;
+
+          const int margin = m_WindowSize + 1;
+          const bool tenengrad = m_Method == SEQUENCE_MERGE_TENENGRAD;
+          const int first = tenengrad ? margin : 0, last = tenengrad ? m_Height - margin : m_Height;
+          const int BAND = 32;
+          const int bands = MBL::Utility::GetMax((last - first + BAND - 1) / BAND, 0);
+          const bool indexed = m_Format == IMAGE_FORMAT_INDEX;
+
+          MBL::Utility::ParallelFor(0, bands, [&](int b)
+          {
+            const int top = first + b * BAND, bottom = MBL::Utility::GetMin(top + BAND, last);
+            if (indexed)
+              _AddBand<1>(frame, source, top, bottom);
+            else
+              _AddBand<3>(frame, source, top, bottom);
+          });
+
+          m_Count++;
+        }
+
+        /**
+         * @brief 结束融合，生成高度索引图和聚焦图像。
+         *
+         * @exception IllegalArgumentException 还没有送入任何帧。
+         */
+        void Finish()
+        {
+          if (m_Count == 0) throw IllegalArgumentException();
+          if (m_Finished) return;
+
+          if (m_Method == SEQUENCE_MERGE_CONTRAST)
+          {
+            // 选择与平均值相差较大的一端，平均值相同时取最小值。
+            for (int i = 0; i < m_Height; i++)
+            {
+              T *dem = GetRowPointer(m_DEM, i), *out = GetRowPointer(m_Montage, i);
+              const T *dem2 = GetRowPointer(m_DEM2, i), *out2 = GetRowPointer(m_Montage2, i);
+              const size_t offset = static_cast<size_t>(i) * m_Width;
+              for (int j = 0; j < m_Width; j++)
+              {
+                const double average = static_cast<double>(m_Sum[offset + j]) / m_Count;
+                const double diff = fabs(m_Max[offset + j] - average) - fabs(m_Min[offset + j] - average);
+                if (diff > 0) continue;
+
+                dem[j] = dem2[j];
+                for (int c = 0; c < m_Units; c++) out[j * m_Units + c] = out2[j * m_Units + c];
+              }
+            }
+          }
+          else if (m_Method == SEQUENCE_MERGE_TENENGRAD)
+          {
+            const int margin = m_WindowSize + 1;
+            if (m_Height > 2 * margin && m_Width > 2 * margin) _FillMergeMargin(m_DEM, margin);
+          }
+          m_Finished = true;
+        }
+
+        /**
+         * @brief 取得高度索引图，即各点聚焦最好的帧号，超过255的记为255。
+         *
+         * @return 索引图像，由对象管理，不要删除。
+         *
+         * @exception IllegalArgumentException 还没有调用Finish。
+         */
+        const ImageDef<T> * GetDEM() const
+        {
+          if (!m_Finished) throw IllegalArgumentException();
+          return m_DEM;
+        }
+
+        /**
+         * @brief 取得聚焦图像，各点取自聚焦最好的帧。
+         *
+         * @return 与送入的帧格式相同的图像，由对象管理，不要删除。
+         *
+         * @exception IllegalArgumentException 还没有调用Finish。
+         */
+        const ImageDef<T> * GetMontage() const
+        {
+          if (!m_Finished) throw IllegalArgumentException();
+          return m_Montage;
+        }
+
+      private:
+        SequenceMerger(const SequenceMerger &);
+        SequenceMerger & operator =(const SequenceMerger &);
+
+        void _Release()
+        {
+          delete m_DEM;
+          delete m_Montage;
+          delete m_DEM2;
+          delete m_Montage2;
+          delete m_Frame255;
+          m_DEM = m_Montage = m_DEM2 = m_Montage2 = m_Frame255 = 0;
+        }
+
+        // 把一行象素转换为灰度，公式与各DEM函数相同。
+        template <int UNITS>
+        static void _GetGrayRow(const T *p, int width, T *gray)
+        {
+          if (UNITS == 1)
+          {
+            memcpy(gray, p, width * sizeof(T));
+            return;
+          }
+
+          // 分块解交错，使转换循环可以向量化。
+          const int BLOCK = 64;
+          int r[BLOCK], g[BLOCK], b[BLOCK];
+          for (int x0 = 0; x0 < width; x0 += BLOCK)
+          {
+            const int n = MBL::Utility::GetMin(BLOCK, width - x0);
+            const T *q = p + static_cast<size_t>(x0) * 3;
+            for (int x = 0; x < n; x++)
+            {
+              r[x] = q[3 * x];
+              g[x] = q[3 * x + 1];
+              b[x] = q[3 * x + 2];
+            }
+            for (int x = 0; x < n; x++) gray[x0 + x] = (T)(r[x] * 0.3 + g[x] * 0.59 + b[x] * 0.11);
+          }
+        }
+
+        // 把帧中第y行[left, right)内标记的象素复制到聚焦图像。
+        template <int UNITS>
+        static void _CopyMarked(const ImageDef<T> *frame, ImageDef<T> *montage, int y, int left, int right,
+                                const unsigned char *marked)
+        {
+          const T *p = GetRowPointer(frame, y) + static_cast<size_t>(left) * UNITS;
+          T *q = GetRowPointer(montage, y) + static_cast<size_t>(left) * UNITS;
+          marked += left;
+
+          // 标记按分量展开到局部数组，使逐个分量选择的循环可以向量化。
+          const int BLOCK = 64;
+          unsigned char m[BLOCK * UNITS];
+          for (int x0 = 0; x0 < right - left; x0 += BLOCK)
+          {
+            const int n = MBL::Utility::GetMin(BLOCK, right - left - x0);
+            for (int x = 0; x < n; x++)
+            {
+              for (int c = 0; c < UNITS; c++) m[x * UNITS + c] = marked[x0 + x];
+            }
+
+            const T *a = p + static_cast<size_t>(x0) * UNITS;
+            T *b = q + static_cast<size_t>(x0) * UNITS;
+            for (int u = 0; u < n * UNITS; u++)
+            {
+              const T x = a[u], y = b[u];
+              b[u] = m[u] ? x : y;
+            }
+          }
+        }
+
+        // frame用来计算评价值，source是聚焦图像取象素的帧。
+        template <int UNITS>
+        void _AddBand(const ImageDef<T> *frame, const ImageDef<T> *source, int top, int bottom)
+        {
+          if (m_Method == SEQUENCE_MERGE_TENENGRAD)
+            _AddTenengradBand<UNITS>(frame, source, top, bottom);
+          else
+            _AddGrayBand<UNITS>(frame, source, top, bottom);
+        }
+
+        // 最大灰度法和最大离差法：逐点比较灰度。
+        template <int UNITS>
+        void _AddGrayBand(const ImageDef<T> *frame, const ImageDef<T> *source, int top, int bottom)
+        {
+          const int nc = m_Width, k = m_Count;
+          const T mark = (T)MBL::Utility::GetMin(k, 255);
+          std::vector<T> gray(nc);
+          std::vector<unsigned char> larger(nc), smaller(nc);
+
+          for (int i = top; i < bottom; i++)
+          {
+            _GetGrayRow<UNITS>(GetRowPointer(frame, i), nc, &gray[0]);
+            const size_t offset = static_cast<size_t>(i) * nc;
+            T *max = &m_Max[offset], *dem = GetRowPointer(m_DEM, i);
+            for (int j = 0; j < nc; j++)
+            {
+              larger[j] = gray[j] > max[j];
+              max[j] = larger[j] ? gray[j] : max[j];
+              dem[j] = larger[j] ? mark : dem[j];
+            }
+            _CopyMarked<UNITS>(source, m_Montage, i, 0, nc, &larger[0]);
+
+            if (m_Method != SEQUENCE_MERGE_CONTRAST) continue;
+
+            T *min = &m_Min[offset], *dem2 = GetRowPointer(m_DEM2, i);
+            unsigned int *sum = &m_Sum[offset];
+            for (int j = 0; j < nc; j++)
+            {
+              smaller[j] = gray[j] < min[j];
+              min[j] = smaller[j] ? gray[j] : min[j];
+              dem2[j] = smaller[j] ? mark : dem2[j];
+              sum[j] += gray[j];
+            }
+            _CopyMarked<UNITS>(source, m_Montage2, i, 0, nc, &smaller[0]);
+          }
+        }
+
+        // tenengrad算法：与LaplacianMergeSequenceIntoDEM一样用滑动窗口求各点的窗口梯度平方和。
+        template <int UNITS>
+        void _AddTenengradBand(const ImageDef<T> *frame, const ImageDef<T> *source, int top, int bottom)
+        {
+          const int nc = m_Width, nr = m_Height, w = m_WindowSize, k = m_Count;
+          const int margin = w + 1, window_length = 2 * w + 1;
+          const T mark = (T)MBL::Utility::GetMin(k, 255);
+          if (nc <= 2 * margin) return;
+
+          // 条带用到的灰度行为[top - w - 1, bottom + w]。
+          const int first = top - w - 1;
+          const int rows = bottom + w + 1 - first;
+          std::vector<T> gray(static_cast<size_t>(rows) * nc);
+          for (int y = 0; y < rows; y++) _GetGrayRow<UNITS>(GetRowPointer(frame, first + y), nc, &gray[static_cast<size_t>(y) * nc]);
+
+          std::vector<G> ring(static_cast<size_t>(window_length) * nc), column(nc, 0), line(nc);
+          std::vector<unsigned char> larger(nc, 0);
+          auto gradient = [&](int y, G *out)
+          {
+            const T *u = &gray[static_cast<size_t>(y - 1 - first) * nc];
+            const T *c = u + nc, *d = c + nc;
+            out[0] = out[nc - 1] = 0;
+            for (int x = 1; x < nc - 1; x++)
+            {
+              const G gx = (d[x - 1] + 2 * d[x] + d[x + 1]) - (u[x - 1] + 2 * u[x] + u[x + 1]);
+              const G gy = (u[x - 1] + 2 * c[x - 1] + d[x - 1]) - (u[x + 1] + 2 * c[x + 1] + d[x + 1]);
+              const G v = gx * gx + gy * gy;
+              out[x] = v > m_Threshold ? v : 0;
+            }
+          };
+
+          for (int i = top; i < bottom; i++)
+          {
+            if (i == top)
+            {
+              for (int m = -w; m <= w; m++)
+              {
+                G *r = &ring[static_cast<size_t>((i + m) % window_length) * nc];
+                gradient(i + m, r);
+                for (int x = 0; x < nc; x++) column[x] += r[x];
+              }
+            }
+            else
+            {
+              // 第i + w行替换循环缓冲区中的第i - w - 1行。
+              G *r = &ring[static_cast<size_t>((i + w) % window_length) * nc];
+              gradient(i + w, &line[0]);
+              for (int x = 0; x < nc; x++)
+              {
+                column[x] += line[x] - r[x];
+                r[x] = line[x];
+              }
+            }
+
+            G *energy = &m_Energy[static_cast<size_t>(i) * nc];
+            T *dem = GetRowPointer(m_DEM, i);
+            G sum = 0;
+            for (int x = margin - w; x < margin + w; x++) sum += column[x];
+            for (int j = margin; j < nc - margin; j++)
+            {
+              sum += column[j + w];
+              larger[j] = sum > energy[j];
+              energy[j] = larger[j] ? sum : energy[j];
+              dem[j] = larger[j] ? mark : dem[j];
+              sum -= column[j - w];
+            }
+
+            // 边上margin宽的象素在Finish时取最近的已计算象素的高度，聚焦图像也随之取自同一帧。
+            for (int j = 0; j < margin; j++) larger[j] = larger[margin];
+            for (int j = nc - margin; j < nc; j++) larger[j] = larger[nc - margin - 1];
+
+            const int y0 = (i == margin) ? 0 : i;
+            const int y1 = (i == nr - margin - 1) ? nr : i + 1;
+            for (int y = y0; y < y1; y++) _CopyMarked<UNITS>(source, m_Montage, y, 0, nc, &larger[0]);
+          }
+        }
+    };
+
   }// Image2D namespace
 }// MBL namespace
 
@@ -11,6 +11,12 @@
 #include <algorithm>
 #include <string>
 #include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #pragma warning(disable : 4996)
 
@@ -226,6 +232,257 @@ namespace MBL
       return GetMin(GetMax(v, min), max);
     }
 
+    /// 并行任务的分配器。
+    /**
+     * ParallelRun把同一个分配器交给所有工作线程，每个线程反复调用Next领取下一个任务，先做完的线程会领取更多的任务。
+     * 有线程出错后不再分配新的任务。
+     *
+     * @see ParallelRun
+     */
+    class ParallelTasks
+    {
+      public:
+        /**
+         * @param count 任务个数。
+         */
+        explicit ParallelTasks(int count) : Count(count), Index(0), Failed(false)
+        {
+        }
+
+        /**
+         * @brief 领取下一个任务。
+         *
+         * @param k 返回任务序号。
+         * @return false表示没有任务了。
+         */
+        bool Next(int *k)
+        {
+          if (Failed.load(std::memory_order_relaxed)) return false;
+          *k = Index.fetch_add(1);
+          return *k < Count;
+        }
+
+        /// 任务个数。
+        const int Count;
+        /// 下一个未分配的任务序号。
+        std::atomic<int> Index;
+        /// 是否有线程出错。
+        std::atomic<bool> Failed;
+    };
+
+    // 用SetParallelThreads设置的线程数，为0表示使用处理器的逻辑核心数。
+    inline std::atomic<int> &_ParallelThreadsSetting()
+    {
+      static std::atomic<int> threads(0);
+      return threads;
+    }
+
+    /**
+     * @brief 设置并行处理使用的线程数。
+     *
+     * @param threads 线程数，为0表示使用处理器的逻辑核心数，为1表示只在调用线程上处理。
+     */
+    inline void SetParallelThreads(int threads)
+    {
+      _ParallelThreadsSetting() = threads > 0 ? threads : 0;
+    }
+
+    /**
+     * @brief 取得并行处理使用的线程数。
+     *
+     * @return 用SetParallelThreads设置的线程数，没有设置时为处理器的逻辑核心数，无法取得核心数时为1。
+     */
+    inline int GetParallelThreads()
+    {
+      const int threads = _ParallelThreadsSetting();
+      if (threads > 0) return threads;
+      const unsigned int n = std::thread::hardware_concurrency();
+      return n > 0 ? static_cast<int>(n) : 1;
+    }
+
+    // 当前线程是否正在执行ParallelRun的工作函数。
+    inline bool &_InParallelRun()
+    {
+      static thread_local bool inside = false;
+      return inside;
+    }
+
+    // ParallelRun交给线程池的一次调用。
+    struct _ParallelJob
+    {
+      // 工作线程执行的函数和它的参数。
+      void (*Run)(void *context);
+      void *Context;
+      // 还可以加入的工作线程数。
+      int Wanted;
+      // 正在执行Run的工作线程数。
+      int Active;
+    };
+
+    template <class F>
+    void _RunParallelJob(void *context)
+    {
+      (*static_cast<F *>(context))();
+    }
+
+    // ParallelRun使用的常驻线程池。工作线程在第一次需要时才创建，没有任务时在条件变量上等待，不随每次调用创建和销毁。
+    // 调用线程提交一个_ParallelJob，空闲的工作线程依次加入，直到加入的线程数达到Wanted；调用线程做完自己领到的任务后用
+    // Wait撤销还没有线程加入的名额，并等待已经加入的线程结束。多个线程可以同时提交。
+    class _ParallelPool
+    {
+      public:
+        static _ParallelPool &Instance()
+        {
+          // 线程池故意不销毁。退出时工作线程还在等待，在静态对象的析构中停止它们可能与其它静态对象的析构顺序冲突。
+          static _ParallelPool *pool = new _ParallelPool();
+          return *pool;
+        }
+
+        void Submit(_ParallelJob *job)
+        {
+          std::lock_guard<std::mutex> guard(m_Lock);
+          try
+          {
+            while (m_Threads < job->Wanted)
+            {
+              std::thread(&_ParallelPool::Work, this).detach();
+              m_Threads++;
+            }
+          }
+          catch (...)
+          {
+            // 不能创建更多的线程时只用已有的线程。
+          }
+          job->Wanted = GetMin(job->Wanted, m_Threads);
+          if (job->Wanted <= 0) return;
+          try
+          {
+            m_Jobs.push_back(job);
+          }
+          catch (...)
+          {
+            job->Wanted = 0;
+            return;
+          }
+          m_Wake.notify_all();
+        }
+
+        void Wait(_ParallelJob *job)
+        {
+          std::unique_lock<std::mutex> guard(m_Lock);
+          std::deque<_ParallelJob *>::iterator it = std::find(m_Jobs.begin(), m_Jobs.end(), job);
+          if (it != m_Jobs.end()) m_Jobs.erase(it);
+          while (job->Active > 0) m_Done.wait(guard);
+        }
+
+      private:
+        _ParallelPool() : m_Threads(0)
+        {
+        }
+
+        void Work()
+        {
+          std::unique_lock<std::mutex> guard(m_Lock);
+          for (;;)
+          {
+            while (m_Jobs.empty()) m_Wake.wait(guard);
+
+            _ParallelJob *job = m_Jobs.front();
+            job->Active++;
+            if (--job->Wanted == 0) m_Jobs.pop_front();
+
+            guard.unlock();
+            job->Run(job->Context);
+            guard.lock();
+
+            if (--job->Active == 0) m_Done.notify_all();
+          }
+        }
+
+        std::mutex m_Lock;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        std::deque<_ParallelJob *> m_Jobs;
+        int m_Threads;
+    };
+
+    /**
+     * @brief 在多个线程上执行一组任务。
+     *
+     * 调用线程和常驻线程池中另外最多GetParallelThreads() - 1个线程同时执行worker，worker从分配器中领取任务直到领完，可以
+     * 在领取任务之前准备本线程的工作缓冲区，领完之后合并本线程的结果（合并时要自己加锁）。worker在工作线程中再调用
+     * ParallelRun时只在当前线程上执行，不会再占用线程池中的线程。任一线程抛出的第一个异常会在所有线程结束后重新抛出。
+     *
+     * @param count 任务个数。
+     * @param worker 工作函数，形如void(ParallelTasks &tasks)，会在多个线程中同时被调用。
+     *
+     * @see ParallelFor
+     */
+    template <class Worker>
+    void ParallelRun(int count, Worker worker)
+    {
+      if (count <= 0) return;
+
+      ParallelTasks tasks(count);
+      std::exception_ptr error;
+      std::mutex lock;
+      auto run = [&]()
+      {
+        bool &inside = _InParallelRun();
+        const bool outer = inside;
+        inside = true;
+        try
+        {
+          worker(tasks);
+        }
+        catch (...)
+        {
+          tasks.Failed = true;
+          std::lock_guard<std::mutex> guard(lock);
+          if (!error) error = std::current_exception();
+        }
+        inside = outer;
+      };
+
+      const int threads = _InParallelRun() ? 1 : GetMin(GetParallelThreads(), count);
+      if (threads > 1)
+      {
+        _ParallelJob job = {&_RunParallelJob<decltype(run)>, &run, threads - 1, 0};
+        _ParallelPool &pool = _ParallelPool::Instance();
+        pool.Submit(&job);
+        run();
+        pool.Wait(&job);
+      }
+      else
+      {
+        run();
+      }
+
+      if (error) std::rethrow_exception(error);
+    }
+
+    /**
+     * @brief 在多个线程上执行循环。
+     *
+     * 对[begin, end)中的每个k调用一次body(k)，各次调用之间不能有依赖关系。循环动态地分配给各个线程，适合各次调用耗时不同的
+     * 情况，如按分块或条带处理图像。
+     *
+     * @param begin 循环变量的起始值。
+     * @param end 循环变量的结束值（不含）。
+     * @param body 循环体，形如void(int k)，会在多个线程中同时被调用。
+     *
+     * @see ParallelRun
+     */
+    template <class Body>
+    void ParallelFor(int begin, int end, Body body)
+    {
+      ParallelRun(end - begin, [&](ParallelTasks &tasks)
+      {
+        int k;
+        while (tasks.Next(&k)) body(begin + k);
+      });
+    }
+
     /**
      * @brief 将一个wchar_t类型的字符串对象转换为char类型的字符串对象。
      *
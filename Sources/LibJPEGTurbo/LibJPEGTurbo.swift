@@ -8,30 +8,183 @@ public func tjGetErrorStr(_ handle: tjhandle?) -> String {
 public func tjCompress<T>(_ srcBuf: [T], _ pixelFormat: TJPF, _ width: Int, _ height: Int, _ pitch: Int = 0, _ quality: Int = 85, _ flip: Bool = false)
     -> [UInt8]
 {
-    let tj = tj3Init(Int32(TJINIT_COMPRESS.rawValue))
-    defer { tj3Destroy(tj) }
-    tj3Set(tj, Int32(TJPARAM_QUALITY.rawValue), Int32(quality))
-    tj3Set(tj, Int32(TJPARAM_SUBSAMP.rawValue), TJSAMP_420.rawValue)
-    tj3Set(tj, Int32(TJPARAM_BOTTOMUP.rawValue), flip ? 1 : 0)
+    return srcBuf.withUnsafeBytes { buf in
+        TJPool.shared.compress(buf, pixelFormat, width, height, pitch, quality, flip) ?? []
+    }
+}
 
-    var jpegBuf: UnsafeMutablePointer<UInt8>? = nil
-    defer { tj3Free(jpegBuf) }
-    var jpegSize: Int = 0
+public func tjDecompressHeader(_ jpegBuf: [UInt8]) -> (width: Int, height: Int) {
+    return jpegBuf.withUnsafeBytes { buf in
+        TJPool.shared.decompressHeader(buf) ?? (-1, -1)
+    }
+}
 
-    return srcBuf.withUnsafeBytes { buf in
-        guard tj3Compress8(tj, buf.baseAddress, Int32(width), Int32(pitch), Int32(height), pixelFormat.rawValue, &jpegBuf, &jpegSize) == 0 else { return [] }
+/// Returns the number of bytes per pixel of `pixelFormat`.
+public func tjPixelBytes(_ pixelFormat: TJPF) -> Int {
+    return withUnsafeBytes(of: tjPixelSize) { Int($0.load(fromByteOffset: Int(pixelFormat.rawValue) * MemoryLayout<Int32>.stride, as: Int32.self)) }
+}
 
-        return Array(UnsafeBufferPointer(start: jpegBuf, count: jpegSize))
+/// One tile of a batch decode: the compressed data and where its pixels go.
+public struct TJDecodeJob {
+    public var jpeg: UnsafeRawBufferPointer
+    public var destination: UnsafeMutableRawBufferPointer
+    /// Bytes between rows of the destination, 0 for `width * tjPixelBytes(pixelFormat)`.
+    public var pitch: Int
+
+    public init(jpeg: UnsafeRawBufferPointer, destination: UnsafeMutableRawBufferPointer, pitch: Int = 0) {
+        self.jpeg = jpeg
+        self.destination = destination
+        self.pitch = pitch
     }
 }
 
-public func tjDecompressHeader(_ jpegBuf: [UInt8]) -> (width: Int, height: Int) {
-    let tj = tj3Init(Int32(TJINIT_DECOMPRESS.rawValue))
-    defer { tj3Destroy(tj) }
+/// A thread-safe pool of reusable turbojpeg handles.
+///
+/// Creating and destroying a handle for every image costs more than decoding a small tile. The pool keeps idle compress and
+/// decompress handles and lends one to each caller, so concurrent threads never share a handle and the number of live handles
+/// stays at the number of threads actually working. Decoding writes into caller memory; nothing is allocated per image.
+public final class TJPool: @unchecked Sendable {
+    /// The pool used by `tjCompress` and `tjDecompressHeader`.
+    public static let shared = TJPool()
 
-    return jpegBuf.withUnsafeBytes { buf in
-        guard tj3DecompressHeader(tj, buf.baseAddress, buf.count) == 0 else { return (-1, -1) }
+    private let lock = NSLock()
+    private var compressors = [tjhandle]()
+    private var decompressors = [tjhandle]()
+
+    public init() {}
+
+    deinit {
+        for tj in compressors + decompressors {
+            tj3Destroy(tj)
+        }
+    }
+
+    /// Runs `body` with a compress handle that no other thread uses meanwhile.
+    public func withCompressor<R>(_ body: (tjhandle) throws -> R) rethrows -> R? {
+        guard let tj = acquire(compress: true) else { return nil }
+        defer { release(tj, compress: true) }
+        return try body(tj)
+    }
+
+    /// Runs `body` with a decompress handle that no other thread uses meanwhile.
+    public func withDecompressor<R>(_ body: (tjhandle) throws -> R) rethrows -> R? {
+        guard let tj = acquire(compress: false) else { return nil }
+        defer { release(tj, compress: false) }
+        return try body(tj)
+    }
+
+    /// Returns the size of a JPEG image, or nil if the header is invalid.
+    public func decompressHeader(_ jpeg: UnsafeRawBufferPointer) -> (width: Int, height: Int)? {
+        return withDecompressor { tj -> (width: Int, height: Int)? in
+            guard tj3DecompressHeader(tj, jpeg.baseAddress?.assumingMemoryBound(to: UInt8.self), jpeg.count) == 0 else { return nil }
+            return (Int(tj3Get(tj, Int32(TJPARAM_JPEGWIDTH.rawValue))), Int(tj3Get(tj, Int32(TJPARAM_JPEGHEIGHT.rawValue))))
+        } ?? nil
+    }
+
+    /// Decodes `jpeg` into `destination` and returns the image size, or nil if it fails or does not fit.
+    public func decompress(
+        _ jpeg: UnsafeRawBufferPointer, into destination: UnsafeMutableRawBufferPointer, pitch: Int = 0, pixelFormat: TJPF = TJPF_RGB
+    ) -> (width: Int, height: Int)? {
+        return withDecompressor { tj -> (width: Int, height: Int)? in
+            let src = jpeg.baseAddress?.assumingMemoryBound(to: UInt8.self)
+            guard tj3DecompressHeader(tj, src, jpeg.count) == 0 else { return nil }
+
+            let width = Int(tj3Get(tj, Int32(TJPARAM_JPEGWIDTH.rawValue)))
+            let height = Int(tj3Get(tj, Int32(TJPARAM_JPEGHEIGHT.rawValue)))
+            let rowBytes = width * tjPixelBytes(pixelFormat)
+            let stride = pitch > 0 ? pitch : rowBytes
+            guard stride >= rowBytes, destination.count >= (height - 1) * stride + rowBytes else { return nil }
+
+            tj3Set(tj, Int32(TJPARAM_BOTTOMUP.rawValue), 0)
+            guard tj3Decompress8(tj, src, jpeg.count, destination.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(stride),
+                pixelFormat.rawValue) == 0 else { return nil }
+            return (width, height)
+        } ?? nil
+    }
+
+    /// Decodes `jpeg` into `buffer`, growing it only when it is too small, so one buffer can be reused for many images.
+    public func decompress(_ jpeg: [UInt8], into buffer: inout [UInt8], pixelFormat: TJPF = TJPF_RGB) -> (width: Int, height: Int)? {
+        return jpeg.withUnsafeBytes { src in
+            guard let size = decompressHeader(src) else { return nil }
+
+            let count = size.width * size.height * tjPixelBytes(pixelFormat)
+            if buffer.count < count {
+                buffer = [UInt8](repeating: 0, count: count)
+            }
+            return buffer.withUnsafeMutableBytes { decompress(src, into: $0, pixelFormat: pixelFormat) }
+        }
+    }
+
+    /// Decodes many images in parallel across all cores and returns which of them succeeded.
+    public func decompress(_ jobs: [TJDecodeJob], pixelFormat: TJPF = TJPF_RGB) -> [Bool] {
+        var results = [Bool](repeating: false, count: jobs.count)
+        results.withUnsafeMutableBufferPointer { out in
+            DispatchQueue.concurrentPerform(iterations: jobs.count) { i in
+                let job = jobs[i]
+                out[i] = decompress(job.jpeg, into: job.destination, pitch: job.pitch, pixelFormat: pixelFormat) != nil
+            }
+        }
+        return results
+    }
+
+    /// Compresses an image and returns the JPEG data, or nil if it fails.
+    public func compress(
+        _ src: UnsafeRawBufferPointer, _ pixelFormat: TJPF, _ width: Int, _ height: Int, _ pitch: Int = 0, _ quality: Int = 85,
+        _ flip: Bool = false
+    ) -> [UInt8]? {
+        return withCompressor { tj -> [UInt8]? in
+            setCompressParams(tj, quality, flip, noRealloc: false)
+
+            var jpegBuf: UnsafeMutablePointer<UInt8>? = nil
+            defer { tj3Free(jpegBuf) }
+            var jpegSize: Int = 0
+            guard tj3Compress8(tj, src.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(width), Int32(pitch), Int32(height),
+                pixelFormat.rawValue, &jpegBuf, &jpegSize) == 0 else { return nil }
+
+            return Array(UnsafeBufferPointer(start: jpegBuf, count: jpegSize))
+        } ?? nil
+    }
+
+    /// Compresses an image into `destination` and returns the JPEG size, or nil if it fails or does not fit.
+    ///
+    /// A destination of `tj3JPEGBufSize(width, height, TJSAMP_420.rawValue)` bytes always fits.
+    public func compress(
+        _ src: UnsafeRawBufferPointer, _ pixelFormat: TJPF, _ width: Int, _ height: Int, into destination: UnsafeMutableRawBufferPointer,
+        pitch: Int = 0, quality: Int = 85, flip: Bool = false
+    ) -> Int? {
+        return withCompressor { tj -> Int? in
+            setCompressParams(tj, quality, flip, noRealloc: true)
+
+            var jpegBuf = destination.baseAddress?.assumingMemoryBound(to: UInt8.self)
+            var jpegSize = destination.count
+            guard tj3Compress8(tj, src.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(width), Int32(pitch), Int32(height),
+                pixelFormat.rawValue, &jpegBuf, &jpegSize) == 0 else { return nil }
+
+            return jpegSize
+        } ?? nil
+    }
+
+    private func setCompressParams(_ tj: tjhandle, _ quality: Int, _ flip: Bool, noRealloc: Bool) {
+        tj3Set(tj, Int32(TJPARAM_QUALITY.rawValue), Int32(quality))
+        tj3Set(tj, Int32(TJPARAM_SUBSAMP.rawValue), TJSAMP_420.rawValue)
+        tj3Set(tj, Int32(TJPARAM_BOTTOMUP.rawValue), flip ? 1 : 0)
+        tj3Set(tj, Int32(TJPARAM_NOREALLOC.rawValue), noRealloc ? 1 : 0)
+    }
+
+    private func acquire(compress: Bool) -> tjhandle? {
+        lock.lock()
+        let tj = compress ? compressors.popLast() : decompressors.popLast()
+        lock.unlock()
+        return tj ?? tj3Init(Int32((compress ? TJINIT_COMPRESS : TJINIT_DECOMPRESS).rawValue))
+    }
 
-        return (Int(tj3Get(tj, TJPARAM_JPEGWIDTH.rawValue)), Int(tj3Get(tj, TJPARAM_JPEGHEIGHT.rawValue)))
+    private func release(_ tj: tjhandle, compress: Bool) {
+        lock.lock()
+        if compress {
+            compressors.append(tj)
+        } else {
+            decompressors.append(tj)
+        }
+        lock.unlock()
     }
 }
@@ -0,0 +1,350 @@
+import CLibTIFF
+import Foundation
+import LibJPEGTurbo
+
+/// Reads individual tiles and regions of a tiled TIFF, such as an SVS whole-slide image, as packed 8-bit RGB.
+///
+/// Every tiled directory of the file is one level, ordered from the largest to the smallest. JPEG-compressed YCbCr and
+/// grayscale tiles are read raw and decoded with turbojpeg straight into the destination; RGB JPEG tiles and tiles with
+/// other codecs are decoded by libtiff.
+/// Decoded tiles are kept in a least-recently-used cache bounded by `cacheCapacity` bytes, so a viewer reading
+/// overlapping regions only decodes the tiles it has not touched recently.
+///
+/// A reader owns one TIFF handle and one turbojpeg handle and is not thread-safe; use one reader per thread.
+public final class TIFFTileReader {
+    /// A tiled directory of the file.
+    public struct Level {
+        public let directory: UInt32
+        public let width: Int
+        public let height: Int
+        public let tileWidth: Int
+        public let tileHeight: Int
+        public let compression: UInt16
+        public let photometric: UInt16
+        fileprivate let jpegTables: [UInt8]?
+
+        public var columns: Int { (width + tileWidth - 1) / tileWidth }
+        public var rows: Int { (height + tileHeight - 1) / tileHeight }
+        /// Bytes of one decoded tile.
+        public var tileBytes: Int { tileWidth * tileHeight * 3 }
+
+        /// RGB JPEG tiles usually carry no Adobe marker, so turbojpeg would take their samples as YCbCr.
+        fileprivate var decodesWithTurboJPEG: Bool {
+            compression == UInt16(COMPRESSION_JPEG)
+                && (photometric == UInt16(PHOTOMETRIC_YCBCR) || photometric == UInt16(PHOTOMETRIC_MINISBLACK))
+        }
+    }
+
+    public let levels: [Level]
+
+    private let tiff: OpaquePointer
+    private let tj: tjhandle?
+    private let cache: TileCache
+    private var rawBuffer = [UInt8]()
+    private var rgbaBuffer = [UInt32]()
+
+    /// Opens `path`, or returns nil if it cannot be opened or has no tiled directory.
+    public init?(path: String, cacheCapacity: Int = 64 * 1024 * 1024) {
+        guard let tiff = TIFFOpen(path, "r") else { return nil }
+
+        var levels = [Level]()
+        var dir: UInt32 = 0
+        repeat {
+            if TIFFIsTiled(tiff) != 0,
+                let w: UInt32 = TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH),
+                let h: UInt32 = TIFFGetField(tiff, TIFFTAG_IMAGELENGTH),
+                let tw: UInt32 = TIFFGetField(tiff, TIFFTAG_TILEWIDTH),
+                let th: UInt32 = TIFFGetField(tiff, TIFFTAG_TILELENGTH)
+            {
+                let comp: UInt16 = TIFFGetField(tiff, TIFFTAG_COMPRESSION) ?? UInt16(COMPRESSION_NONE)
+                // Without the tag the interpretation is left to libtiff.
+                let photometric: UInt16 = TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC) ?? UInt16(PHOTOMETRIC_RGB)
+                var tables: [UInt8]? = nil
+                if comp == UInt16(COMPRESSION_JPEG) {
+                    let dqt: (count: UInt32?, data: UnsafeMutableRawPointer?) = TIFFGetField(tiff, TIFFTAG_JPEGTABLES)
+                    if let count = dqt.count, count >= 4, let data = dqt.data {
+                        tables = Array(UnsafeBufferPointer(start: data.assumingMemoryBound(to: UInt8.self), count: Int(count)))
+                    }
+                }
+                levels.append(
+                    Level(
+                        directory: dir, width: Int(w), height: Int(h), tileWidth: Int(tw), tileHeight: Int(th), compression: comp,
+                        photometric: photometric, jpegTables: tables))
+            }
+            dir += 1
+        } while TIFFReadDirectory(tiff) == 1
+
+        guard !levels.isEmpty else {
+            TIFFClose(tiff)
+            return nil
+        }
+
+        self.tiff = tiff
+        self.levels = levels.sorted { $0.width > $1.width }
+        self.tj = tj3Init(Int32(TJINIT_DECOMPRESS.rawValue))
+        self.cache = TileCache(capacity: cacheCapacity)
+    }
+
+    deinit {
+        tj3Destroy(tj)
+        TIFFClose(tiff)
+    }
+
+    /// Bytes of decoded tiles currently held in the cache.
+    public var cachedBytes: Int { cache.bytes }
+
+    /// Decodes a whole tile into `buffer`, which must hold `tileHeight` rows of `rowBytes` (0 means `tileWidth * 3`).
+    ///
+    /// On a cache miss the tile is decoded directly into `buffer` and then remembered in the cache.
+    public func readTile(level: Int, column: Int, row: Int, into buffer: UnsafeMutableRawBufferPointer, rowBytes: Int = 0) -> Bool {
+        guard levels.indices.contains(level) else { return false }
+        let lv = levels[level]
+        let pitch = rowBytes > 0 ? rowBytes : lv.tileWidth * 3
+        guard column >= 0, column < lv.columns, row >= 0, row < lv.rows, pitch >= lv.tileWidth * 3,
+            let dst = buffer.baseAddress, buffer.count >= (lv.tileHeight - 1) * pitch + lv.tileWidth * 3
+        else { return false }
+
+        let key = TileCache.Key(level: level, column: column, row: row)
+        if let data = cache.get(key) {
+            copyRows(from: data, tileWidth: lv.tileWidth, x: 0, y: 0, width: lv.tileWidth, height: lv.tileHeight, to: dst, pitch: pitch)
+            return true
+        }
+
+        guard decode(lv, column, row, into: dst.assumingMemoryBound(to: UInt8.self), pitch: pitch) else { return false }
+        if lv.tileBytes <= cache.capacity {
+            let data = [UInt8](unsafeUninitializedCapacity: lv.tileBytes) { buf, initializedCount in
+                for y in 0..<lv.tileHeight {
+                    UnsafeMutableRawPointer(buf.baseAddress!).advanced(by: y * lv.tileWidth * 3).copyMemory(
+                        from: dst.advanced(by: y * pitch), byteCount: lv.tileWidth * 3)
+                }
+                initializedCount = lv.tileBytes
+            }
+            cache.put(key, data)
+        }
+        return true
+    }
+
+    /// Copies the region at (`x`, `y`) of `level` into `buffer`, with rows `rowBytes` apart (0 means `width * 3`).
+    ///
+    /// Only the tiles the region touches are decoded. The region must lie inside the level.
+    public func readRegion(
+        level: Int, x: Int, y: Int, width: Int, height: Int, into buffer: UnsafeMutableRawBufferPointer, rowBytes: Int = 0
+    ) -> Bool {
+        guard levels.indices.contains(level) else { return false }
+        let lv = levels[level]
+        let pitch = rowBytes > 0 ? rowBytes : width * 3
+        guard x >= 0, y >= 0, width > 0, height > 0, x + width <= lv.width, y + height <= lv.height, pitch >= width * 3,
+            let dst = buffer.baseAddress, buffer.count >= (height - 1) * pitch + width * 3
+        else { return false }
+
+        for row in (y / lv.tileHeight)...((y + height - 1) / lv.tileHeight) {
+            for column in (x / lv.tileWidth)...((x + width - 1) / lv.tileWidth) {
+                guard let data = tile(level: level, column: column, row: row) else { return false }
+
+                let x0 = max(x, column * lv.tileWidth)
+                let y0 = max(y, row * lv.tileHeight)
+                let x1 = min(x + width, (column + 1) * lv.tileWidth)
+                let y1 = min(y + height, (row + 1) * lv.tileHeight)
+                copyRows(
+                    from: data, tileWidth: lv.tileWidth, x: x0 - column * lv.tileWidth, y: y0 - row * lv.tileHeight, width: x1 - x0,
+                    height: y1 - y0, to: dst.advanced(by: (y0 - y) * pitch + (x0 - x) * 3), pitch: pitch)
+            }
+        }
+        return true
+    }
+
+    /// Returns the region at (`x`, `y`) of `level` as packed RGB, or nil if it cannot be read.
+    public func readRegion(level: Int, x: Int, y: Int, width: Int, height: Int) -> [UInt8]? {
+        guard width > 0, height > 0 else { return nil }
+
+        // Every byte of a region that is read is written, so the array is not zero-filled first.
+        var ok = false
+        let rgb = [UInt8](unsafeUninitializedCapacity: width * height * 3) { buf, initializedCount in
+            ok = readRegion(level: level, x: x, y: y, width: width, height: height, into: UnsafeMutableRawBufferPointer(buf))
+            initializedCount = ok ? buf.count : 0
+        }
+        return ok ? rgb : nil
+    }
+
+    private func tile(level: Int, column: Int, row: Int) -> [UInt8]? {
+        let key = TileCache.Key(level: level, column: column, row: row)
+        if let data = cache.get(key) { return data }
+
+        let lv = levels[level]
+        // decode writes the whole tile, so the array is not zero-filled first.
+        var ok = false
+        let data = [UInt8](unsafeUninitializedCapacity: lv.tileBytes) { buf, initializedCount in
+            ok = decode(lv, column, row, into: buf.baseAddress!, pitch: lv.tileWidth * 3)
+            initializedCount = ok ? buf.count : 0
+        }
+        guard ok else { return nil }
+
+        cache.put(key, data)
+        return data
+    }
+
+    private func decode(_ lv: Level, _ column: Int, _ row: Int, into dst: UnsafeMutablePointer<UInt8>, pitch: Int) -> Bool {
+        guard TIFFSetDirectory(tiff, lv.directory, nil) else { return false }
+
+        let x = UInt32(column * lv.tileWidth)
+        let y = UInt32(row * lv.tileHeight)
+        if lv.decodesWithTurboJPEG {
+            return decodeJPEG(lv, TIFFComputeTile(tiff, x, y, 0, 0), into: dst, pitch: pitch)
+        }
+
+        // libtiff returns the tile as ABGR with the origin at the lower left.
+        let count = lv.tileWidth * lv.tileHeight
+        if rgbaBuffer.count < count {
+            rgbaBuffer = [UInt32](repeating: 0, count: count)
+        }
+        return rgbaBuffer.withUnsafeMutableBufferPointer { raster in
+            guard TIFFReadRGBATile(tiff, x, y, raster.baseAddress) == 1 else { return false }
+
+            for r in 0..<lv.tileHeight {
+                let src = raster.baseAddress! + (lv.tileHeight - 1 - r) * lv.tileWidth
+                let out = dst + r * pitch
+                for c in 0..<lv.tileWidth {
+                    let abgr = src[c]
+                    out[c * 3] = UInt8(truncatingIfNeeded: abgr)
+                    out[c * 3 + 1] = UInt8(truncatingIfNeeded: abgr >> 8)
+                    out[c * 3 + 2] = UInt8(truncatingIfNeeded: abgr >> 16)
+                }
+            }
+            return true
+        }
+    }
+
+    private func decodeJPEG(_ lv: Level, _ index: UInt32, into dst: UnsafeMutablePointer<UInt8>, pitch: Int) -> Bool {
+        let rawSize = Int(TIFFGetStrileByteCount(tiff, index))
+        guard rawSize > 2 else { return false }
+
+        // Abbreviated tiles start with SOI and rely on the shared tables, which run from SOI to EOI. The tile is read right
+        // after the tables less their EOI, and its own SOI is then overwritten by the end of the tables.
+        let tables = lv.jpegTables ?? []
+        let offset = tables.isEmpty ? 0 : tables.count - 4
+        if rawBuffer.count < offset + rawSize {
+            rawBuffer = [UInt8](repeating: 0, count: offset + rawSize)
+        }
+
+        return rawBuffer.withUnsafeMutableBytes { buf in
+            let base = buf.baseAddress!
+            let read = Int(TIFFReadRawTile(tiff, index, base + offset, tmsize_t(rawSize)))
+            guard read > 2 else { return false }
+
+            var jpeg = base + offset
+            var jpegSize = read
+            if offset > 0 && jpeg.load(as: UInt8.self) == 0xFF && jpeg.load(fromByteOffset: 1, as: UInt8.self) == 0xD8 {
+                tables.withUnsafeBytes { base.copyMemory(from: $0.baseAddress!, byteCount: offset + 2) }
+                jpeg = base
+                jpegSize = offset + read
+            }
+
+            let src = jpeg.assumingMemoryBound(to: UInt8.self)
+            guard tj3DecompressHeader(tj, src, jpegSize) == 0 else { return false }
+            let jpegWidth = Int(tj3Get(tj, Int32(TJPARAM_JPEGWIDTH.rawValue)))
+            let jpegHeight = Int(tj3Get(tj, Int32(TJPARAM_JPEGHEIGHT.rawValue)))
+            guard jpegWidth <= lv.tileWidth, jpegHeight <= lv.tileHeight else { return false }
+
+            // Tiles are normally padded to the full tile size; clear whatever a smaller one would leave unwritten.
+            if jpegWidth < lv.tileWidth || jpegHeight < lv.tileHeight {
+                for r in 0..<lv.tileHeight {
+                    (dst + r * pitch).initialize(repeating: 0, count: lv.tileWidth * 3)
+                }
+            }
+
+            return tj3Decompress8(tj, src, jpegSize, dst, Int32(pitch), TJPF_RGB.rawValue) == 0
+        }
+    }
+
+    private func copyRows(
+        from data: [UInt8], tileWidth: Int, x: Int, y: Int, width: Int, height: Int, to dst: UnsafeMutableRawPointer, pitch: Int
+    ) {
+        data.withUnsafeBytes { src in
+            for r in 0..<height {
+                (dst + r * pitch).copyMemory(from: src.baseAddress! + ((y + r) * tileWidth + x) * 3, byteCount: width * 3)
+            }
+        }
+    }
+}
+
+/// A least-recently-used cache of decoded tiles bounded by the total number of bytes.
+private final class TileCache {
+    struct Key: Hashable {
+        let level: Int
+        let column: Int
+        let row: Int
+    }
+
+    private final class Node {
+        let key: Key
+        let data: [UInt8]
+        weak var newer: Node?
+        var older: Node?
+
+        init(_ key: Key, _ data: [UInt8]) {
+            self.key = key
+            self.data = data
+        }
+    }
+
+    let capacity: Int
+    private(set) var bytes = 0
+    private var nodes = [Key: Node]()
+    private var newest: Node?
+    private var oldest: Node?
+
+    init(capacity: Int) {
+        self.capacity = max(capacity, 0)
+    }
+
+    func get(_ key: Key) -> [UInt8]? {
+        guard let node = nodes[key] else { return nil }
+
+        unlink(node)
+        pushFront(node)
+        return node.data
+    }
+
+    func put(_ key: Key, _ data: [UInt8]) {
+        guard data.count <= capacity else { return }
+
+        if let node = nodes.removeValue(forKey: key) {
+            unlink(node)
+            bytes -= node.data.count
+        }
+        let node = Node(key, data)
+        nodes[key] = node
+        pushFront(node)
+        bytes += data.count
+
+        while bytes > capacity, let node = oldest {
+            unlink(node)
+            nodes.removeValue(forKey: node.key)
+            bytes -= node.data.count
+        }
+    }
+
+    private func pushFront(_ node: Node) {
+        node.older = newest
+        newest?.newer = node
+        newest = node
+        if oldest == nil {
+            oldest = node
+        }
+    }
+
+    private func unlink(_ node: Node) {
+        let newer = node.newer
+        let older = node.older
+        newer?.older = older
+        older?.newer = newer
+        if newest === node {
+            newest = older
+        }
+        if oldest === node {
+            oldest = newer
+        }
+        node.newer = nil
+        node.older = nil
+    }
+}
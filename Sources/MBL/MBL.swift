@@ -1,17 +1,223 @@
 import CMBL
 
+/// Resampling filter used by `scaleImage`.
+public enum ScaleFilter {
+    /// Bilinear interpolation, suitable for enlarging and small reductions.
+    case bilinear
+    /// Area averaging, suitable for thumbnails and other large reductions. Enlarging falls back to bilinear.
+    case area
+}
+
+extension ScaleFilter {
+    fileprivate var cValue: ScaleImageFilter {
+        switch self {
+        case .bilinear:
+            return SCALE_IMAGE_FILTER_BILINEAR
+        case .area:
+            return SCALE_IMAGE_FILTER_AREA
+        }
+    }
+}
+
+/// Scales packed RGB pixels straight into caller memory, without intermediate images or extra copies.
+///
+/// Rows are `srcRowBytes` and `destRowBytes` apart; 0 means the rows are packed. Returns false if a buffer is too small or the
+/// sizes are invalid, in which case `destRGB` is left untouched.
+@discardableResult
+public func scaleImage(
+    _ srcRGB: UnsafeRawBufferPointer, _ srcWidth: Int, _ srcHeight: Int, srcRowBytes: Int = 0,
+    into destRGB: UnsafeMutableRawBufferPointer, _ destWidth: Int, _ destHeight: Int, destRowBytes: Int = 0,
+    filter: ScaleFilter = .bilinear
+) -> Bool {
+    guard srcWidth > 0, srcHeight > 0, destWidth > 0, destHeight > 0 else { return false }
+
+    let srcPitch = srcRowBytes > 0 ? srcRowBytes : srcWidth * 3
+    let destPitch = destRowBytes > 0 ? destRowBytes : destWidth * 3
+    guard srcPitch >= srcWidth * 3, destPitch >= destWidth * 3,
+        srcRGB.count >= (srcHeight - 1) * srcPitch + srcWidth * 3,
+        destRGB.count >= (destHeight - 1) * destPitch + destWidth * 3
+    else { return false }
+
+    return ScaleImageStrided(
+        srcRGB.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(srcWidth), Int32(srcHeight), Int32(srcPitch),
+        destRGB.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(destWidth), Int32(destHeight), Int32(destPitch),
+        filter.cValue) == 0
+}
+
 public func scaleImage(
-    _ srcRGB: [UInt8], _ srcWidth: Int, _ srcHeight: Int, _ destWidth: Int, _ destHeight: Int
+    _ srcRGB: [UInt8], _ srcWidth: Int, _ srcHeight: Int, _ destWidth: Int, _ destHeight: Int,
+    filter: ScaleFilter = .bilinear
 ) -> [UInt8] {
-    var destRGB = [UInt8](repeating: 0, count: destWidth * destHeight * 3)
+    let count = destWidth * destHeight * 3
 
-    destRGB.withUnsafeMutableBytes { destBuf in
-        srcRGB.withUnsafeBytes { srcBuf in
-            ScaleImage(
-                srcBuf.baseAddress, Int32(srcWidth), Int32(srcHeight), destBuf.baseAddress,
-                Int32(destWidth), Int32(destHeight))
+    // Every destination byte is written by the scaler, so the array is not zero-filled first.
+    return [UInt8](unsafeUninitializedCapacity: count) { destBuf, initializedCount in
+        let done = srcRGB.withUnsafeBytes { srcBuf in
+            scaleImage(
+                srcBuf, srcWidth, srcHeight, into: UnsafeMutableRawBufferPointer(destBuf), destWidth, destHeight, filter: filter)
         }
+        if !done {
+            destBuf.initialize(repeating: 0)
+        }
+        initializedCount = count
     }
+}
+
+/// Builds the 2x reduced levels of an RGB image pyramid from base-level tiles in a single streaming pass.
+///
+/// Push base-level tiles one tile row after another; reduced tiles are delivered to `onTile` as soon as they are complete.
+/// Only a strip of one tile height is kept per level, so memory does not grow with the image height.
+public final class ImagePyramidBuilder {
+    /// Receives a reduced tile: level (1 is half size), tile column, tile row, packed RGB pixels, width and height.
+    public typealias TileHandler = (_ level: Int, _ column: Int, _ row: Int, _ rgb: [UInt8], _ width: Int, _ height: Int) -> Void
 
-    return destRGB
+    private final class Context {
+        let onTile: TileHandler
+
+        init(_ onTile: @escaping TileHandler) {
+            self.onTile = onTile
+        }
+    }
+
+    private let context: Context
+    private let handle: OpaquePointer
+
+    /// Creates a builder, or returns nil if the sizes are invalid. `levels` of 0 reduces until a level fits in one tile.
+    public init?(width: Int, height: Int, tileWidth: Int, tileHeight: Int, levels: Int = 0, onTile: @escaping TileHandler) {
+        let context = Context(onTile)
+        let handle = CreateImagePyramid(
+            Int32(width), Int32(height), Int32(tileWidth), Int32(tileHeight), Int32(levels),
+            { context, level, column, row, rgb, width, height, rowBytes in
+                guard let context, let rgb else { return }
+                let rowLength = Int(width) * 3
+                // Every row is copied from the builder, so the tile is not zero-filled first.
+                let tile = [UInt8](unsafeUninitializedCapacity: rowLength * Int(height)) { buf, initializedCount in
+                    for y in 0..<Int(height) {
+                        UnsafeMutableRawPointer(buf.baseAddress!).advanced(by: y * rowLength).copyMemory(
+                            from: rgb.advanced(by: y * Int(rowBytes)), byteCount: rowLength)
+                    }
+                    initializedCount = buf.count
+                }
+                Unmanaged<Context>.fromOpaque(context).takeUnretainedValue().onTile(
+                    Int(level), Int(column), Int(row), tile, Int(width), Int(height))
+            }, Unmanaged.passUnretained(context).toOpaque())
+        guard let handle else { return nil }
+
+        self.context = context
+        self.handle = handle
+    }
+
+    deinit {
+        DestroyImagePyramid(handle)
+    }
+
+    /// The number of reduced levels, not counting the base level.
+    public var levelCount: Int {
+        Int(GetImagePyramidLevelCount(handle))
+    }
+
+    /// Pushes a packed RGB base-level tile. Returns false if the tile is out of order, has the wrong size or `rgb` is too short.
+    @discardableResult
+    public func pushTile(column: Int, row: Int, rgb: [UInt8], width: Int, height: Int) -> Bool {
+        guard width > 0, height > 0, rgb.count >= width * height * 3 else { return false }
+        return rgb.withUnsafeBytes { buf in
+            PushImagePyramidTile(
+                handle, Int32(column), Int32(row), buf.baseAddress?.assumingMemoryBound(to: UInt8.self), Int32(width),
+                Int32(height), 0) == 0
+        }
+    }
+
+    /// Flushes the remaining tiles of every level. Returns false if some base-level tiles are missing.
+    @discardableResult
+    public func finish() -> Bool {
+        FinishImagePyramid(handle) == 0
+    }
+}
+
+/// Focus measure used to pick the sharpest frame at each pixel of a focus stack.
+public enum FocusMergeMethod {
+    /// The brightest frame.
+    case maxGray
+    /// The frame farthest from the mean brightness of the stack.
+    case contrast
+    /// The frame with the largest Sobel gradient energy in a window around the pixel.
+    case tenengrad
+}
+
+extension FocusMergeMethod {
+    fileprivate var cValue: FocusStackMergeMethod {
+        switch self {
+        case .maxGray:
+            return FOCUS_MERGE_MAX
+        case .contrast:
+            return FOCUS_MERGE_CONTRAST
+        case .tenengrad:
+            return FOCUS_MERGE_TENENGRAD
+        }
+    }
+}
+
+/// Fuses a focus stack of packed RGB frames pushed one at a time, keeping only a few frames of state.
+///
+/// `finish` returns the height map (the frame index of each pixel, capped at 255) and the all-in-focus image. When `threshold`
+/// is 0 both match the whole-stack C function `MergeFocusStack`, which runs the in-memory DEM functions and then
+/// `MontageSequenceDEM` on the same frames.
+public final class FocusStackMerger {
+    private let handle: OpaquePointer
+    public let width: Int
+    public let height: Int
+
+    /// Creates a merger, or returns nil if the sizes are invalid. `windowSize` and `threshold` are used by `.tenengrad` only.
+    public init?(width: Int, height: Int, method: FocusMergeMethod = .tenengrad, windowSize: Int = 2, threshold: Int = 0) {
+        guard let handle = CreateFocusMerger(Int32(width), Int32(height), method.cValue, Int32(windowSize), Int32(threshold))
+        else { return nil }
+
+        self.handle = handle
+        self.width = width
+        self.height = height
+    }
+
+    deinit {
+        DestroyFocusMerger(handle)
+    }
+
+    /// Pushes the next frame. Returns false if the frame is too small or `finish` has been called.
+    @discardableResult
+    public func pushFrame(rgb: [UInt8]) -> Bool {
+        guard rgb.count >= width * height * 3 else { return false }
+        return rgb.withUnsafeBytes { buf in
+            PushFocusMergerFrame(handle, buf.baseAddress?.assumingMemoryBound(to: UInt8.self), 0) == 0
+        }
+    }
+
+    /// Returns the height map and the fused RGB image, or nil if no frame has been pushed.
+    public func finish() -> (dem: [UInt8], montage: [UInt8])? {
+        // Every byte of both results is written by the merger, so the arrays are not zero-filled first.
+        var done = false
+        var montage: [UInt8] = []
+        let dem = [UInt8](unsafeUninitializedCapacity: width * height) { demBuf, demCount in
+            montage = [UInt8](unsafeUninitializedCapacity: width * height * 3) { montageBuf, montageCount in
+                done = FinishFocusMerger(handle, demBuf.baseAddress, montageBuf.baseAddress) == 0
+                montageCount = done ? montageBuf.count : 0
+            }
+            demCount = done ? demBuf.count : 0
+        }
+        return done ? (dem, montage) : nil
+    }
+}
+
+/// Fuses a focus stack that is already in memory, returning the height map and the all-in-focus RGB image.
+///
+/// The frames are pushed through a `FocusStackMerger` one at a time and read in place, so the stack is never copied.
+public func mergeFocusStack(
+    _ frames: [[UInt8]], width: Int, height: Int, method: FocusMergeMethod = .tenengrad, windowSize: Int = 2
+) -> (dem: [UInt8], montage: [UInt8])? {
+    guard width > 0, height > 0, !frames.isEmpty,
+        let merger = FocusStackMerger(width: width, height: height, method: method, windowSize: windowSize)
+    else { return nil }
+
+    for frame in frames where !merger.pushFrame(rgb: frame) {
+        return nil
+    }
+    return merger.finish()
 }
@@ -0,0 +1,70 @@
+// 比较ScaleImage2Linear与ScaleImage2LinearFast速度的测试程序，不属于任何SwiftPM目标，需要时单独编译运行：
+//
+//   c++ -std=c++17 -O2 -include cstring -I Sources/CMBL/Sources Tests/Benchmarks/ScaleImageBenchmark.cpp -o ScaleImageBenchmark -pthread
+//   ./ScaleImageBenchmark [线程数]
+//
+// 源图像为8192x8192的RGB图像，缩小到512、2048和4096，输出每秒得到的目标图像象素数（MP/s），各取5次中最快的一次。
+// 线程数默认为1，即单核速度；为0时使用全部逻辑核心。ScaleImage2Linear是单线程的，线程数只影响ScaleImage2LinearFast。
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Exception.h"
+#include "Utility.h"
+#include "ImageDef.h"
+#include "ImageSubArea.h"
+#include "ImageSequenceDef.h"
+#include "ImageRW.h"
+#include "ImageTransform.h"
+
+using namespace MBL::Image2D;
+
+template <class Scale>
+static double MeasureScale(ImageDef<unsigned char> *image, int dest_size, Scale scale)
+{
+  double best = 0;
+  for (int k = 0; k < 5; k++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ImageDef<unsigned char> *dest = scale(image, dest_size, dest_size);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    delete dest;
+
+    double rate = static_cast<double>(dest_size) * dest_size / 1e6 / elapsed.count();
+    if (rate > best) best = rate;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  MBL::Utility::SetParallelThreads(argc > 1 ? atoi(argv[1]) : 1);
+
+  // 用不均匀的内容，避免常数图像让任何算法都显得一样快。
+  const int size = 8192;
+  ImageDef<unsigned char> *image = ImageDef<unsigned char>::CreateInstance(IMAGE_FORMAT_RGB, size, size);
+  unsigned int seed = 12345;
+  for (int y = 0; y < size; y++)
+  {
+    unsigned char *row = GetRowPointer(image, y);
+    for (int x = 0; x < size * 3; x++)
+    {
+      seed = seed * 1103515245 + 12345;
+      row[x] = static_cast<unsigned char>(seed >> 24);
+    }
+  }
+
+  printf("%dx%d RGB, %d thread(s)\n", size, size, MBL::Utility::GetParallelThreads());
+  const int dest_sizes[] = {512, 2048, 4096};
+  for (int dest_size : dest_sizes)
+  {
+    double linear = MeasureScale(image, dest_size, ScaleImage2Linear<unsigned char>);
+    double fast = MeasureScale(image, dest_size, static_cast<ImageDef<unsigned char> *(*)(ImageDef<unsigned char> *, int, int)>(
+                                                     ScaleImage2LinearFast<unsigned char>));
+    printf("  dest %d: %.0f -> %.0f MP/s\n", dest_size, linear, fast);
+  }
+
+  delete image;
+  return 0;
+}
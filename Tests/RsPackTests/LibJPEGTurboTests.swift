@@ -16,3 +16,41 @@ func testLibJPEGTurbo() async throws {
     let (w, h) = tjDecompressHeader(jpg)
     #expect(w == 345 && h == 678)
 }
+
+@Test
+func testTJPoolBatchDecode() async throws {
+    let size = 240
+    let count = 64
+    let pool = TJPool()
+    let tiles = (0..<count).map { i in
+        [UInt8](repeating: UInt8(i * 3), count: size * size * 3).withUnsafeBytes { rgb in
+            pool.compress(rgb, TJPF_RGB, size, size, 0, 95) ?? []
+        }
+    }
+    #expect(tiles.allSatisfy { !$0.isEmpty })
+
+    // Decode every tile into its own slot of one shared output buffer.
+    let tileBytes = size * size * 3
+    var pixels = [UInt8](repeating: 0, count: count * tileBytes)
+    let jpegs = tiles.map { tile in
+        let buf = UnsafeMutableRawBufferPointer.allocate(byteCount: tile.count, alignment: 1)
+        buf.copyBytes(from: tile)
+        return UnsafeRawBufferPointer(buf)
+    }
+    defer { jpegs.forEach { $0.deallocate() } }
+    let results = pixels.withUnsafeMutableBytes { out in
+        let jobs = (0..<count).map { i in
+            TJDecodeJob(jpeg: jpegs[i], destination: UnsafeMutableRawBufferPointer(rebasing: out[i * tileBytes..<(i + 1) * tileBytes]))
+        }
+        return pool.decompress(jobs)
+    }
+    #expect(results.allSatisfy { $0 })
+    for i in 0..<count {
+        #expect(pixels[i * tileBytes..<(i + 1) * tileBytes].allSatisfy { abs(Int($0) - i * 3) <= 2 })
+    }
+
+    var buffer = [UInt8]()
+    let decoded = pool.decompress(tiles[1], into: &buffer)
+    #expect(decoded?.width == size && decoded?.height == size)
+    #expect(buffer.count == tileBytes)
+}
@@ -16,3 +16,66 @@ func testLibTIFF() async throws {
     } while TIFFReadDirectory(f) == 1
     TIFFClose(f)
 }
+
+@Test
+func testTIFFTileReaderSVS() async throws {
+    let path = try #require(Bundle.module.path(forResource: "TCGA-BR-4369-01Z-00-DX1.svs"))
+    let reader = try #require(TIFFTileReader(path: path))
+    #expect(reader.levels.count == 1)
+
+    let level = reader.levels[0]
+    #expect(level.width == 1600 && level.height == 1200)
+    #expect(level.tileWidth == 256 && level.tileHeight == 256)
+
+    // The fixture uses Aperio JPEG 2000, which is decoded only when libtiff was built with that codec.
+    let region = reader.readRegion(level: 0, x: 200, y: 200, width: 300, height: 100)
+    #expect((region != nil) == (TIFFIsCODECConfigured(level.compression) != 0))
+}
+
+// RGB JPEG tiles go through libtiff rather than turbojpeg, which would take their samples as YCbCr.
+@Test(arguments: [PHOTOMETRIC_YCBCR, PHOTOMETRIC_RGB])
+func testTIFFTileReaderJPEG(photometric: Int32) async throws {
+    try #require(TIFFIsCODECConfigured(UInt16(COMPRESSION_JPEG)) != 0)
+
+    let path = FileManager.default.temporaryDirectory.appendingPathComponent("tile-reader-\(UUID().uuidString).tif").path
+    defer { try? FileManager.default.removeItem(atPath: path) }
+
+    let width = 80
+    let height = 48
+    let tileSize = 32
+    let color: [UInt8] = [90, 160, 60]
+    let tiff = try #require(TIFFOpen(path, "w"))
+    _ = TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, UInt32(width))
+    _ = TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, UInt32(height))
+    _ = TIFFSetField(tiff, TIFFTAG_TILEWIDTH, UInt32(tileSize))
+    _ = TIFFSetField(tiff, TIFFTAG_TILELENGTH, UInt32(tileSize))
+    _ = TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, Int32(8))
+    _ = TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, Int32(3))
+    _ = TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, Int32(PLANARCONFIG_CONTIG))
+    _ = TIFFSetField(tiff, TIFFTAG_COMPRESSION, Int32(COMPRESSION_JPEG))
+    _ = TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, photometric)
+    if photometric == PHOTOMETRIC_YCBCR {
+        _ = TIFFSetField(tiff, TIFFTAG_JPEGCOLORMODE, Int32(JPEGCOLORMODE_RGB))
+    }
+    var tile = [UInt8](repeating: 0, count: tileSize * tileSize * 3)
+    for i in 0..<tileSize * tileSize {
+        tile[i * 3..<i * 3 + 3] = color[...]
+    }
+    for y in stride(from: 0, to: height, by: tileSize) {
+        for x in stride(from: 0, to: width, by: tileSize) {
+            #expect(TIFFWriteTile(tiff, &tile, UInt32(x), UInt32(y), 0, 0) > 0)
+        }
+    }
+    TIFFClose(tiff)
+
+    let reader = try #require(TIFFTileReader(path: path, cacheCapacity: 2 * tileSize * tileSize * 3))
+    #expect(reader.levels[0].photometric == UInt16(photometric))
+    let region = try #require(reader.readRegion(level: 0, x: 10, y: 20, width: 60, height: 25))
+    #expect(region.count == 60 * 25 * 3)
+    #expect(region.enumerated().allSatisfy { abs(Int($0.element) - Int(color[$0.offset % 3])) <= 4 })
+    #expect(reader.cachedBytes == 2 * tileSize * tileSize * 3)
+
+    var whole = [UInt8](repeating: 0, count: tileSize * tileSize * 3)
+    #expect(whole.withUnsafeMutableBytes { reader.readTile(level: 0, column: 2, row: 1, into: $0) })
+    #expect(whole.enumerated().allSatisfy { abs(Int($0.element) - Int(color[$0.offset % 3])) <= 4 })
+}
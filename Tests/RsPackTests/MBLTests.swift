@@ -1,3 +1,4 @@
+import CMBL
 import Foundation
 import MBL
 import Testing
@@ -10,3 +11,132 @@ func testMBL() async throws {
     let img2 = scaleImage(img, width, height, 512, 512)
     #expect(img2.count == 512 * 512 * 3)
 }
+
+@Test
+func testScaleImageMatchesBilinearReference() async throws {
+    // Reference output of the floating-weight ScaleImage2Linear for the same input; the fixed-point path may differ by 1.
+    let width = 20
+    let height = 14
+    let img = (0..<width * height * 3).map { UInt8(truncatingIfNeeded: $0 * 7) }
+    let expected: [UInt8] = [
+        0, 7, 14, 67, 74, 81, 133, 140, 147, 200, 207, 214, 95, 17, 24, 77, 84, 91, 143, 150, 157,
+        170, 177, 184, 83, 90, 97, 150, 157, 164, 114, 121, 128, 180, 85, 92, 93, 100, 107, 160, 167, 174,
+        85, 92, 99, 100, 107, 114, 167, 174, 181, 131, 138, 145, 95, 102, 109, 110, 117, 124, 177, 184, 191,
+        50, 57, 64, 117, 124, 131, 166, 139, 146, 199, 206, 110, 60, 67, 74, 127, 134, 141, 142, 149, 156,
+        67, 74, 81, 134, 141, 148, 200, 156, 163, 113, 120, 127, 77, 84, 91, 144, 151, 158, 210, 217, 71,
+        84, 91, 98, 151, 158, 165, 217, 224, 231, 28, 35, 42, 94, 101, 108, 161, 168, 175, 227, 234, 241,
+    ]
+    let img2 = scaleImage(img, width, height, 7, 6)
+    #expect(img2.count == expected.count)
+    #expect(zip(img2, expected).allSatisfy { abs(Int($0) - Int($1)) <= 1 })
+}
+
+@Test
+func testScaleImageArea() async throws {
+    // 2x2 checkerboard blocks of 0 and 255 average to mid gray when reduced by 2.
+    let width = 64
+    let height = 32
+    var img = [UInt8](repeating: 0, count: width * height * 3)
+    for y in 0..<height {
+        for x in 0..<width where (x + y) % 2 == 1 {
+            for c in 0..<3 { img[(y * width + x) * 3 + c] = 255 }
+        }
+    }
+    let img2 = scaleImage(img, width, height, width / 2, height / 2, filter: .area)
+    #expect(img2.count == width / 2 * height / 2 * 3)
+    #expect(img2.allSatisfy { $0 == 128 })
+}
+
+@Test
+func testImagePyramidBuilder() async throws {
+    let width = 1000
+    let height = 700
+    let tileSize = 256
+    var tiles = [Int: Int]()
+    var uniform = true
+    let builder = try #require(
+        ImagePyramidBuilder(width: width, height: height, tileWidth: tileSize, tileHeight: tileSize) { level, _, _, rgb, w, h in
+            tiles[level, default: 0] += 1
+            uniform = uniform && rgb.count == w * h * 3 && rgb.allSatisfy { $0 == 200 }
+        })
+    #expect(builder.levelCount == 2)
+
+    for row in 0..<(height + tileSize - 1) / tileSize {
+        for column in 0..<(width + tileSize - 1) / tileSize {
+            let w = min(tileSize, width - column * tileSize)
+            let h = min(tileSize, height - row * tileSize)
+            #expect(builder.pushTile(column: column, row: row, rgb: [UInt8](repeating: 200, count: w * h * 3), width: w, height: h))
+        }
+    }
+    #expect(builder.finish())
+    #expect(tiles[1] == 2 * 2)
+    #expect(tiles[2] == 1)
+    #expect(uniform)
+}
+
+@Test
+func testScaleImageIntoBuffer() async throws {
+    let width = 300
+    let height = 200
+    let img = (0..<width * height * 3).map { UInt8(truncatingIfNeeded: $0 * 7) }
+    let expected = scaleImage(img, width, height, 120, 80)
+
+    // Write into the middle of a larger canvas whose rows are wider than the scaled image.
+    let rowBytes = 160 * 3
+    var canvas = [UInt8](repeating: 0xAB, count: rowBytes * 100)
+    let ok = img.withUnsafeBytes { src in
+        canvas.withUnsafeMutableBytes { dest in
+            scaleImage(
+                src, width, height, into: UnsafeMutableRawBufferPointer(rebasing: dest[(10 * rowBytes + 20 * 3)...]), 120, 80,
+                destRowBytes: rowBytes)
+        }
+    }
+    #expect(ok)
+    for y in 0..<80 {
+        let row = (10 + y) * rowBytes + 20 * 3
+        #expect(Array(canvas[row..<row + 120 * 3]) == Array(expected[y * 120 * 3..<(y + 1) * 120 * 3]))
+        #expect(canvas[row - 1] == 0xAB && canvas[row + 120 * 3] == 0xAB)
+    }
+}
+
+@Test
+func testFocusStackMergerMatchesWholeStack() async throws {
+    // Each 8x8 block is sharpest at its own frame. With 300 frames some blocks peak beyond 255, where the height map saturates.
+    let width = 32
+    let height = 32
+    for count in [5, 300] {
+        let frames = (0..<count).map { k in
+            (0..<width * height * 3).map { i -> UInt8 in
+                let pixel = i / 3
+                let target = (pixel % width / 8 + pixel / width / 8 * 4) * 19 % count
+                return UInt8(128 + (((i * 7) & 255) - 128) * 64 / (64 + abs(k - target)))
+            }
+        }
+        // The reference is the whole-stack C path, which runs the in-memory DEM function and then MontageSequenceDEM.
+        let stack = frames.flatMap { $0 }
+        let methods: [(FocusMergeMethod, FocusStackMergeMethod)] = [
+            (.maxGray, FOCUS_MERGE_MAX), (.contrast, FOCUS_MERGE_CONTRAST), (.tenengrad, FOCUS_MERGE_TENENGRAD),
+        ]
+        for (method, cMethod) in methods {
+            var expectedDEM = [UInt8](repeating: 0, count: width * height)
+            var expectedMontage = [UInt8](repeating: 0, count: width * height * 3)
+            let merged = stack.withUnsafeBufferPointer { stackBuf in
+                let table: [UnsafePointer<UInt8>?] = (0..<count).map { stackBuf.baseAddress! + $0 * width * height * 3 }
+                return MergeFocusStack(table, Int32(count), Int32(width), Int32(height), cMethod, 2, &expectedDEM, &expectedMontage)
+            }
+            #expect(merged == 0)
+
+            let merger = try #require(FocusStackMerger(width: width, height: height, method: method))
+            for frame in frames {
+                #expect(merger.pushFrame(rgb: frame))
+            }
+            let result = try #require(merger.finish())
+            #expect(result.dem == expectedDEM)
+            #expect(result.montage == expectedMontage)
+
+            let whole = try #require(mergeFocusStack(frames, width: width, height: height, method: method))
+            #expect(whole.dem == expectedDEM)
+            #expect(whole.montage == expectedMontage)
+        }
+    }
+}